@@ -0,0 +1,137 @@
+"""Benchmark suite comparing cstring with str and bytes.
+
+Runs offline with the standard library only. For each operation, input
+size (small/medium/huge) and data kind (ascii/non-ascii), reports ns/op
+and bytes/s for cstring, str and bytes, plus cstring's speed relative to
+each. Use --json to write machine-readable results for trend tracking.
+
+Usage:
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python benchmarks/bench.py [--quick] [--filter NAME] [--json FILE]
+"""
+import argparse
+import json
+import platform
+import sys
+import time
+import timeit
+
+from cstring import cstring
+
+
+SIZES = {
+    'small': 16,
+    'medium': 1024,
+    'huge': 1024 * 1024,
+}
+
+WORDS = {
+    'ascii': 'lorem ipsum dolor sit amet consectetur ',
+    'nonascii': 'lörem ïpsum dölør sït ämet \U0001f642 ',
+}
+
+
+def make_text(kind, size):
+    """Text of about `size` UTF-8 bytes."""
+    word = WORDS[kind]
+    text = word * (size // len(word.encode()) + 1)
+    while len(text.encode()) > size:
+        text = text[:-1]
+    return text
+
+
+def to_bytes(s):
+    return s.encode() if isinstance(s, str) else bytes(s)
+
+
+TYPES = {
+    'cstring': cstring,
+    'str': str,
+    'bytes': to_bytes,
+}
+
+
+# name -> function(convert, text) returning the zero-argument callable to time
+CASES = {
+    # from a bytearray, so that no type can return its argument unchanged
+    'construct': lambda conv, text: (
+        lambda src=bytearray(text.encode()): str(src, 'utf-8') if conv is str else conv(src)),
+    # hash of a fresh object (str and cstring cache hashes per object)
+    'hash': lambda conv, text: (lambda: hash(conv(text))),
+    'compare_eq': lambda conv, text: (lambda a=conv(text), b=conv(text): a == b),
+    'compare_lt': lambda conv, text: (lambda a=conv(text), b=conv(text + 'x'): a < b),
+    'find': lambda conv, text: (lambda s=conv(text), n=conv('zz'): s.find(n)),
+    'rfind': lambda conv, text: (lambda s=conv(text), n=conv('zz'): s.rfind(n)),
+    'count': lambda conv, text: (lambda s=conv(text), n=conv('um'): s.count(n)),
+    'split': lambda conv, text: (lambda s=conv(text), sep=conv(' '): s.split(sep)),
+    'split_ws': lambda conv, text: (lambda s=conv(text): s.split()),
+    'join': lambda conv, text: (lambda sep=conv(' '), items=conv(text).split(conv(' ')): sep.join(items)),
+    'lower': lambda conv, text: (lambda s=conv(text): s.lower()),
+    'upper': lambda conv, text: (lambda s=conv(text): s.upper()),
+    'swapcase': lambda conv, text: (lambda s=conv(text): s.swapcase()),
+    'strip': lambda conv, text: (lambda s=conv('  ' + text + '  '): s.strip()),
+}
+
+
+def measure(func, min_time):
+    timer = timeit.Timer(func)
+    number, _ = timer.autorange()
+    best = float('inf')
+    deadline = time.perf_counter() + min_time
+    while True:
+        best = min(best, timer.timeit(number) / number)
+        if time.perf_counter() >= deadline:
+            return best
+
+
+def run(cases, sizes, min_time):
+    results = []
+    for case in cases:
+        for size_name, size in sizes.items():
+            for kind in WORDS:
+                text = make_text(kind, size)
+                nbytes = len(text.encode())
+                row = {'case': case, 'size': size_name, 'kind': kind, 'bytes': nbytes}
+                for type_name, convert in TYPES.items():
+                    func = CASES[case](convert, text)
+                    seconds = measure(func, min_time)
+                    row[type_name] = {
+                        'ns_per_op': seconds * 1e9,
+                        'bytes_per_s': nbytes / seconds,
+                    }
+                row['vs_str'] = row['str']['ns_per_op'] / row['cstring']['ns_per_op']
+                row['vs_bytes'] = row['bytes']['ns_per_op'] / row['cstring']['ns_per_op']
+                results.append(row)
+                print('%-10s %-6s %-8s  cstring %12.1f ns  %9.1f MB/s  %5.2fx str  %5.2fx bytes' % (
+                    case, size_name, kind,
+                    row['cstring']['ns_per_op'], row['cstring']['bytes_per_s'] / 1e6,
+                    row['vs_str'], row['vs_bytes']))
+                sys.stdout.flush()
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--quick', action='store_true', help='skip huge inputs and shorten timing')
+    parser.add_argument('--filter', action='append', help='only run cases containing this string')
+    parser.add_argument('--json', help='write results to this file')
+    args = parser.parse_args()
+
+    cases = [c for c in CASES if not args.filter or any(f in c for f in args.filter)]
+    sizes = {k: v for k, v in SIZES.items() if not (args.quick and k == 'huge')}
+    min_time = 0.05 if args.quick else 0.5
+
+    results = run(cases, sizes, min_time)
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({
+                'python': sys.version,
+                'platform': platform.platform(),
+                'time': time.time(),
+                'results': results,
+            }, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,55 @@
+"""Huge-page storage benchmark.
+
+Builds a large cstring with and without huge-page-backed storage and
+reports full-scan throughput (find/count of an absent needle, lower) for
+each. The effect depends on transparent huge pages being available
+(/sys/kernel/mm/transparent_hugepage/enabled set to "madvise" or
+"always").
+
+Usage: python benchmarks/hugepages.py [size_mb]
+"""
+import sys
+import time
+
+import cstring as module
+from cstring import cstring
+
+
+def scan(target, repeat):
+    results = {}
+    for name, work in [
+        ('find', lambda: target.find('#missing#')),
+        ('count', lambda: target.count('#m')),
+        ('lower', lambda: target.lower()),
+    ]:
+        work()
+        best = float('inf')
+        for _ in range(repeat):
+            start = time.perf_counter()
+            work()
+            best = min(best, time.perf_counter() - start)
+        results[name] = len(target) / best / 1e9
+    return results
+
+
+def main():
+    size = int(sys.argv[1]) * 1024 * 1024 if len(sys.argv) > 1 else 256 * 1024 * 1024
+    text = ('lorem ipsum dolor sit amet ' * (size // 27 + 1))[:size]
+
+    rows = []
+    for label, threshold in [('inline', 0), ('hugepage', 1)]:
+        previous = module.set_hugepage_threshold(threshold)
+        try:
+            target = cstring(text, copy=True)
+            rows.append((label, scan(target, 5)))
+            del target
+        finally:
+            module.set_hugepage_threshold(previous)
+
+    print('%-10s %10s %10s %10s   (GB/s, %d MiB)' % ('storage', 'find', 'count', 'lower', size >> 20))
+    for label, results in rows:
+        print('%-10s %10.2f %10.2f %10.2f' % (label, results['find'], results['count'], results['lower']))
+
+
+if __name__ == '__main__':
+    main()
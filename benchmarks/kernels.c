@@ -0,0 +1,189 @@
+/*
+ * Microbenchmarks for the byte kernels in src/cstring.c.
+ *
+ * The extension source is included directly so its static kernels can be
+ * called without going through the Python call machinery. Each kernel is
+ * run over a range of input sizes (and needle shapes, for searches) and
+ * reported in cycles/byte (rdtsc, x86) and ns/byte (clock_gettime).
+ *
+ * Build and run with `make -C benchmarks kernels`; set CSTRING_KERNELS to
+ * compare dispatch variants.
+ */
+#include "../src/cstring.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+static const Py_ssize_t sizes[] = {16, 64, 256, 1024, 4096, 65536, 1024 * 1024};
+#define NSIZES  ((int)(sizeof(sizes) / sizeof(sizes[0])))
+
+/* total bytes to process per measurement */
+#define WORK_BYTES  (64 * 1024 * 1024)
+
+static volatile Py_ssize_t sink;
+
+static double _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned long long _cycles(void) {
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct bench {
+    const char *name;
+    const char *shape;
+    void (*run)(const char *s, char *d, Py_ssize_t len, const char *needle, Py_ssize_t needlelen);
+};
+
+static void run_lower(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    _kernel_lower(s, d, len);
+}
+
+static void run_lower_padded(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    _kernel_lower_padded(s, d, len);
+}
+
+static void run_upper(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    _kernel_upper(s, d, len);
+}
+
+static void run_swapcase(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    _kernel_swapcase(s, d, len);
+}
+
+static void run_isprintable(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    sink = _kernel_isprintable(s, len);
+}
+
+static void run_islower(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    sink = _kernel_islower(s, len);
+}
+
+static void run_isspace(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    sink = _kernel_isspace(d, len);     /* d holds all-whitespace input */
+}
+
+static void run_find(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    sink = _kernel_find(s, len, n, nl);
+}
+
+static void run_rfind(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    sink = _kernel_rfind(s, len, n, nl);
+}
+
+static void run_count(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    sink = _kernel_count(s, len, n, nl);
+}
+
+static void run_split(const char *s, char *d, Py_ssize_t len, const char *n, Py_ssize_t nl) {
+    struct _split_state st;
+    Py_ssize_t start, end, pieces = 0;
+    _split_init(&st, s, len, nl ? n : NULL, nl, -1);
+    while(_split_next(&st, &start, &end))
+        ++pieces;
+    sink = pieces;
+}
+
+/* needle shapes for search kernels */
+static const struct {
+    const char *shape;
+    const char *needle;
+} needles[] = {
+    {"missing-1", "#"},
+    {"missing-4", "#ab#"},
+    {"missing-16", "lorem ipsum####"},
+    {"common-1", "o"},
+    {"common-4", "psum"},
+};
+#define NNEEDLES    ((int)(sizeof(needles) / sizeof(needles[0])))
+
+static const struct bench benches[] = {
+    {"lower", NULL, run_lower},
+    {"lower-padded", NULL, run_lower_padded},
+    {"upper", NULL, run_upper},
+    {"swapcase", NULL, run_swapcase},
+    {"isprintable", NULL, run_isprintable},
+    {"islower", NULL, run_islower},
+    {"isspace", NULL, run_isspace},
+    {"find", "needles", run_find},
+    {"rfind", "needles", run_rfind},
+    {"count", "needles", run_count},
+    {"split", "whitespace", run_split},
+    {"split", "sep", run_split},
+};
+#define NBENCHES    ((int)(sizeof(benches) / sizeof(benches[0])))
+
+static void measure(const struct bench *b, const char *shape, const char *src, char *dst, Py_ssize_t len, const char *needle) {
+    Py_ssize_t needlelen = needle ? (Py_ssize_t)strlen(needle) : 0;
+    long iterations = WORK_BYTES / len;
+
+    /* warm up */
+    for(long i = 0; i < iterations / 16 + 1; ++i)
+        b->run(src, dst, len, needle, needlelen);
+
+    double t0 = _now_ns();
+    unsigned long long c0 = _cycles();
+    for(long i = 0; i < iterations; ++i)
+        b->run(src, dst, len, needle, needlelen);
+    unsigned long long c1 = _cycles();
+    double t1 = _now_ns();
+
+    double bytes = (double)iterations * len;
+    printf("%-12s %-12s %8zd  %8.3f cycles/B  %8.3f ns/B  %8.2f GB/s\n",
+        b->name, shape, (size_t)len,
+        (c1 - c0) / bytes, (t1 - t0) / bytes, bytes / (t1 - t0));
+}
+
+int main(int argc, char **argv) {
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    Py_ssize_t maxsize = sizes[NSIZES - 1];
+    const char *text = "lorem ipsum dolor sit amet consectetur adipiscing elit ";
+
+    /* inputs padded so kernels may read past len during future SIMD work */
+    char *src = malloc(maxsize + 64);
+    char *dst = malloc(maxsize + 64);
+    if(!src || !dst)
+        return 1;
+    for(Py_ssize_t i = 0; i < maxsize + 64; ++i)
+        src[i] = text[i % strlen(text)];
+
+    if(_kernels_init() < 0)
+        fprintf(stderr, "CSTRING_KERNELS ignored\n");
+    printf("kernels: %s\n", _kernels->name);
+    printf("%-12s %-12s %8s\n", "kernel", "shape", "bytes");
+    for(int b = 0; b < NBENCHES; ++b) {
+        const struct bench *bench = &benches[b];
+        if(filter && !strstr(bench->name, filter))
+            continue;
+        for(int i = 0; i < NSIZES; ++i) {
+            if(bench->run == run_isspace) {
+                memset(dst, ' ', maxsize + 64);
+                measure(bench, "-", src, dst, sizes[i], NULL);
+            } else if(bench->shape && strcmp(bench->shape, "needles") == 0) {
+                for(int n = 0; n < NNEEDLES; ++n)
+                    measure(bench, needles[n].shape, src, dst, sizes[i], needles[n].needle);
+            } else if(bench->shape && strcmp(bench->shape, "sep") == 0) {
+                measure(bench, "sep", src, dst, sizes[i], " ");
+            } else {
+                measure(bench, bench->shape ? bench->shape : "-", src, dst, sizes[i], NULL);
+            }
+        }
+    }
+
+    free(src);
+    free(dst);
+    return 0;
+}
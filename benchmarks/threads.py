@@ -0,0 +1,67 @@
+"""Thread scaling benchmark.
+
+Runs the same cstring workload on 1..N threads and reports throughput
+relative to a single thread. Scaling above 1x requires a free-threaded
+(no-GIL) interpreter or GIL-releasing operations.
+
+Usage: python benchmarks/threads.py [max_threads]
+"""
+import os
+import sys
+import threading
+import time
+
+from cstring import cstring, cstringarray, lookup
+
+
+ITEMS = [cstring('field-%d,value-%d,extra' % (i, i)) for i in range(2000)]
+TABLE = cstringarray('field-%d' % i for i in range(0, 4000, 2))
+KEYS = cstringarray('field-%d' % i for i in range(4000))
+SEP = cstring(',')
+
+
+def parse_work():
+    for item in ITEMS:
+        hash(item.upper())
+        item.split(SEP)
+
+
+def lookup_work():
+    lookup(KEYS, TABLE)
+
+
+def measure(work, nthreads, repeat):
+    barrier = threading.Barrier(nthreads + 1)
+
+    def worker():
+        barrier.wait()
+        for _ in range(repeat):
+            work()
+
+    threads = [threading.Thread(target=worker) for _ in range(nthreads)]
+    for t in threads:
+        t.start()
+    start = time.perf_counter()
+    barrier.wait()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+    return nthreads * repeat / elapsed
+
+
+def main():
+    max_threads = int(sys.argv[1]) if len(sys.argv) > 1 else (os.cpu_count() or 1)
+    gil = getattr(sys, '_is_gil_enabled', lambda: True)()
+    print('GIL enabled: %s' % gil)
+    for name, work, repeat in [('parse', parse_work, 20), ('lookup', lookup_work, 50)]:
+        base = None
+        nthreads = 1
+        while nthreads <= max_threads:
+            rate = measure(work, nthreads, repeat)
+            base = base or rate
+            print('%-8s threads=%-3d %10.1f ops/s  %5.2fx' % (name, nthreads, rate, rate / base))
+            nthreads *= 2
+
+
+if __name__ == '__main__':
+    main()
@@ -13,6 +13,6 @@ setup(
     ext_modules=[Extension('cstring', sources=['src/cstring.c'])],
     classifiers=[
     ],
-    python_requires='>=3.6',
+    python_requires='>=3.11',
 )
 
@@ -1,7 +1,98 @@
 #include <Python.h>
+#include <pythread.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#if defined(MAP_ANONYMOUS)
+#define CSTRING_HAVE_MMAP 1
+#endif
+#endif
 
 #define WHITESPACE_CHARS    " \t\n\v\f\r"
 
+/*
+ * Relaxed atomics for globals and fields shared between threads: by the
+ * GIL-free thread pool, by free-threaded (Py_GIL_DISABLED) builds, and by
+ * subinterpreters running under their own GILs. _ATOMIC_CAS stores
+ * `desired` only if *p equals `expected`, returning whether it did. Plain
+ * accesses on compilers without the GNU builtins.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define _ATOMIC_LOAD(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#define _ATOMIC_STORE(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define _ATOMIC_ADD(p, v)       __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define _ATOMIC_CAS(p, expected, desired)   __sync_bool_compare_and_swap((p), (expected), (desired))
+#else
+#define _ATOMIC_LOAD(p)         (*(p))
+#define _ATOMIC_STORE(p, v)     (*(p) = (v))
+#define _ATOMIC_ADD(p, v)       ((*(p) += (v)) - (v))
+#define _ATOMIC_CAS(p, expected, desired)   (*(p) == (expected) ? (*(p) = (desired), 1) : 0)
+#endif
+
+/*
+ * USDT probes for perf/bpftrace/systemtap, under provider "cstring":
+ *
+ *   alloc(size)                    realloc(size)
+ *   hash(len)
+ *   search__entry(len, sublen)     search__return(len, result)
+ *   split__entry(len, seplen)      split__return(len, pieces)
+ *
+ * Compiled in when <sys/sdt.h> is available, unless CSTRING_NO_PROBES is
+ * defined. A disabled probe is a single nop.
+ */
+#if !defined(CSTRING_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CSTRING_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef CSTRING_HAVE_PROBES
+#define CSTRING_PROBE1(name, a)     DTRACE_PROBE1(cstring, name, a)
+#define CSTRING_PROBE2(name, a, b)  DTRACE_PROBE2(cstring, name, a, b)
+#else
+#define CSTRING_PROBE1(name, a)     do { } while(0)
+#define CSTRING_PROBE2(name, a, b)  do { } while(0)
+#endif
+
+/*
+ * Operation counters, reported by cstring.stats(). Collection is off until
+ * enable_stats() is called; disabled cost is one predictable branch per
+ * site. Define CSTRING_NO_STATS to compile the counters out entirely.
+ *
+ * Counters are process-wide (shared by subinterpreters), so they are
+ * updated atomically wherever the compiler allows.
+ */
+#define CSTRING_STATS_FIELDS(X) \
+    X(allocs)           /* cstrings allocated */ \
+    X(alloc_bytes)      /* bytes of string data allocated */ \
+    X(copy_bytes)       /* bytes copied into new cstrings */ \
+    X(reallocs)         /* in-place resizes */ \
+    X(realloc_bytes)    /* string data size after resizing */ \
+    X(hash_computes)    /* hashes computed (cache misses) */ \
+    X(hash_hits)        /* hashes served from the cache */ \
+    X(hash_bytes)       /* bytes hashed */ \
+    X(searches)         /* find/rfind/index/rindex/count calls */ \
+    X(search_bytes)     /* bytes of haystack searched */ \
+    X(splits)           /* split operations started */ \
+    X(split_pieces)     /* pieces produced by split */ \
+    X(split_bytes)      /* bytes of input split */
+
+struct _stats {
+#define X(name) Py_ssize_t name;
+    CSTRING_STATS_FIELDS(X)
+#undef X
+};
+
+#ifndef CSTRING_NO_STATS
+static int _stats_enabled;
+static struct _stats _stats;
+
+#define _STAT_ADD(name, v)  do { if(_ATOMIC_LOAD(&_stats_enabled)) _ATOMIC_ADD(&_stats.name, (v)); } while(0)
+#else
+#define _STAT_ADD(name, v)  do { } while(0)
+#endif
+
 /* memrchr not available on some systems, so reimplement. */
 const char *_memrchr(const char *s, int c, size_t n) {
     for(const char *p = s + n - 1; p >= s; --p) {
@@ -20,24 +111,536 @@ const char *_strrstr(const char *s, const char *find) {
     return NULL;
 }
 
+/*
+ * Byte kernels.
+ *
+ * These operate on (pointer, length) ranges, never call the Python C API
+ * and are safe to run without the GIL. Classification and case conversion
+ * are ASCII-only, like the corresponding `bytes` methods.
+ */
+
+static void _kernel_lower_scalar(const char *s, char *d, Py_ssize_t len) {
+    for(Py_ssize_t i = 0; i < len; ++i)
+        d[i] = Py_TOLOWER(s[i]);
+}
+
+static void _kernel_upper_scalar(const char *s, char *d, Py_ssize_t len) {
+    for(Py_ssize_t i = 0; i < len; ++i)
+        d[i] = Py_TOUPPER(s[i]);
+}
+
+static void _kernel_swapcase(const char *s, char *d, Py_ssize_t len) {
+    for(Py_ssize_t i = 0; i < len; ++i) {
+        if(Py_ISLOWER(s[i])) {
+            d[i] = Py_TOUPPER(s[i]);
+        } else if(Py_ISUPPER(s[i])) {
+            d[i] = Py_TOLOWER(s[i]);
+        } else {
+            d[i] = s[i];
+        }
+    }
+}
+
+static int _kernel_isalnum(const char *s, Py_ssize_t len) {
+    for(Py_ssize_t i = 0; i < len; ++i) {
+        if(!Py_ISALNUM(s[i]))
+            return 0;
+    }
+    return 1;
+}
+
+static int _kernel_isalpha(const char *s, Py_ssize_t len) {
+    for(Py_ssize_t i = 0; i < len; ++i) {
+        if(!Py_ISALPHA(s[i]))
+            return 0;
+    }
+    return 1;
+}
+
+static int _kernel_isdigit(const char *s, Py_ssize_t len) {
+    for(Py_ssize_t i = 0; i < len; ++i) {
+        if(!Py_ISDIGIT(s[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/* at least one lc alpha and no uc alphas */
+static int _kernel_islower(const char *s, Py_ssize_t len) {
+    int cased = 0;
+    for(Py_ssize_t i = 0; i < len; ++i) {
+        if(Py_ISUPPER(s[i]))
+            return 0;
+        cased |= Py_ISLOWER(s[i]) != 0;
+    }
+    return cased;
+}
+
+/* at least one uc alpha and no lc alphas */
+static int _kernel_isupper(const char *s, Py_ssize_t len) {
+    int cased = 0;
+    for(Py_ssize_t i = 0; i < len; ++i) {
+        if(Py_ISLOWER(s[i]))
+            return 0;
+        cased |= Py_ISUPPER(s[i]) != 0;
+    }
+    return cased;
+}
+
+static int _kernel_isprintable(const char *s, Py_ssize_t len) {
+    for(Py_ssize_t i = 0; i < len; ++i) {
+        if(!isprint((unsigned char)s[i]))
+            return 0;
+    }
+    return 1;
+}
+
+static int _kernel_isspace(const char *s, Py_ssize_t len) {
+    for(Py_ssize_t i = 0; i < len; ++i) {
+        if(!Py_ISSPACE(s[i]))
+            return 0;
+    }
+    return len > 0;
+}
+
+/* Narrow [*start, *end) by dropping bytes found in `chars` from either side. */
+static void _kernel_strip(const char *s, const char *chars, Py_ssize_t nchars, int left, int right, Py_ssize_t *start, Py_ssize_t *end) {
+    if(left) {
+        while(*start < *end && memchr(chars, s[*start], nchars))
+            ++*start;
+    }
+    if(right) {
+        while(*end > *start && memchr(chars, s[*end - 1], nchars))
+            --*end;
+    }
+}
+
+static Py_ssize_t _kernel_find_scalar(const char *s, Py_ssize_t len, const char *sub, Py_ssize_t sublen) {
+    if(sublen == 0)
+        return 0;
+    const char *p = s;
+    const char *last = s + len - sublen;
+    while(p <= last) {
+        p = memchr(p, *sub, last - p + 1);
+        if(!p)
+            return -1;
+        if(memcmp(p, sub, sublen) == 0)
+            return p - s;
+        ++p;
+    }
+    return -1;
+}
+
+/* Offset of the last occurrence of `sub` in `s`, or -1. */
+static Py_ssize_t _kernel_rfind(const char *s, Py_ssize_t len, const char *sub, Py_ssize_t sublen) {
+    if(sublen > len)
+        return -1;
+    if(sublen == 0)
+        return len;
+    Py_ssize_t n = len - sublen + 1;
+    for(;;) {
+        const char *p = _memrchr(s, *sub, n);
+        if(!p)
+            return -1;
+        if(memcmp(p, sub, sublen) == 0)
+            return p - s;
+        n = p - s;
+    }
+}
+
+/*
+ * MinHash update: sig[i] = min(sig[i], (a[i] * x + b[i]) mod 2**64 >> 32)
+ * over the 32-bit shingle hashes x[0:n] (multiply-add-shift hashing, one
+ * random a, b per permutation).
+ */
+static void _kernel_minhash_scalar(uint64_t *sig, const uint64_t *a, const uint64_t *b, Py_ssize_t nperm, const uint64_t *x, Py_ssize_t n) {
+    for(Py_ssize_t i = 0; i < nperm; ++i) {
+        uint64_t m = sig[i];
+        for(Py_ssize_t j = 0; j < n; ++j) {
+            uint64_t v = (a[i] * x[j] + b[i]) >> 32;
+            if(v < m)
+                m = v;
+        }
+        sig[i] = m;
+    }
+}
+
+/*
+ * Owned cstring data is allocated in multiples of CSTRING_PADDING bytes,
+ * zero-filled past the terminator, so whole-block kernels may read (and,
+ * for a padded destination, write) up to the next multiple without a tail
+ * loop. The find kernel keeps its tail: its second load is offset by
+ * len(sub) - 1, so it can reach past the padding.
+ */
+#define CSTRING_PADDING     32
+#define CSTRING_PADDED_SIZE(n)  (((n) + CSTRING_PADDING - 1) & ~(Py_ssize_t)(CSTRING_PADDING - 1))
+
+/*
+ * Runtime kernel dispatch.
+ *
+ * Kernels with SIMD variants are compiled once per ISA using target
+ * attributes, so the extension needs no special compiler flags. The best
+ * variant the CPU supports is selected once by _kernels_init() at module
+ * init; CSTRING_KERNELS=<name> in the environment forces a variant (for
+ * testing and benchmarking). Callers always go through the _kernel_*
+ * wrappers below.
+ */
+struct _kernel_table {
+    const char *name;
+    void (*lower)(const char *s, char *d, Py_ssize_t len);
+    void (*upper)(const char *s, char *d, Py_ssize_t len);
+    /* as above, for buffers padded to CSTRING_PADDED_SIZE(len) */
+    void (*lower_padded)(const char *s, char *d, Py_ssize_t len);
+    void (*upper_padded)(const char *s, char *d, Py_ssize_t len);
+    Py_ssize_t (*find)(const char *s, Py_ssize_t len, const char *sub, Py_ssize_t sublen);
+    void (*minhash)(uint64_t *sig, const uint64_t *a, const uint64_t *b, Py_ssize_t nperm, const uint64_t *x, Py_ssize_t n);
+};
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CSTRING_X86_KERNELS 1
+#include <immintrin.h>
+
+/*
+ * Case conversion: bytes in [lo, hi] get bit 0x20 flipped. Signed compares
+ * leave bytes >= 0x80 alone, as they compare below any ASCII letter.
+ */
+#define _SIMD_CASE_KERNEL(name, isa, vec, width, set1, load, store, cmpgt, and_, xor_, lo, hi) \
+__attribute__((target(isa))) \
+static void name(const char *s, char *d, Py_ssize_t len) { \
+    const vec below = set1((char)((lo) - 1)); \
+    const vec above = set1((char)((hi) + 1)); \
+    const vec bit = set1(0x20); \
+    Py_ssize_t i = 0; \
+    for(; i + (width) <= len; i += (width)) { \
+        vec v = load((const vec *)(s + i)); \
+        vec m = and_(cmpgt(v, below), cmpgt(above, v)); \
+        store((vec *)(d + i), xor_(v, and_(m, bit))); \
+    } \
+    for(; i < len; ++i) \
+        d[i] = (s[i] >= (lo) && s[i] <= (hi)) ? s[i] ^ 0x20 : s[i]; \
+}
+
+/* whole blocks only: s and d must be padded to a multiple of width */
+#define _SIMD_CASE_KERNEL_PADDED(name, isa, vec, width, set1, load, store, cmpgt, and_, xor_, lo, hi) \
+__attribute__((target(isa))) \
+static void name(const char *s, char *d, Py_ssize_t len) { \
+    const vec below = set1((char)((lo) - 1)); \
+    const vec above = set1((char)((hi) + 1)); \
+    const vec bit = set1(0x20); \
+    for(Py_ssize_t i = 0; i < len; i += (width)) { \
+        vec v = load((const vec *)(s + i)); \
+        vec m = and_(cmpgt(v, below), cmpgt(above, v)); \
+        store((vec *)(d + i), xor_(v, and_(m, bit))); \
+    } \
+}
+
+_SIMD_CASE_KERNEL(_kernel_lower_sse2, "sse2", __m128i, 16, _mm_set1_epi8, _mm_loadu_si128, _mm_storeu_si128,
+    _mm_cmpgt_epi8, _mm_and_si128, _mm_xor_si128, 'A', 'Z')
+_SIMD_CASE_KERNEL(_kernel_upper_sse2, "sse2", __m128i, 16, _mm_set1_epi8, _mm_loadu_si128, _mm_storeu_si128,
+    _mm_cmpgt_epi8, _mm_and_si128, _mm_xor_si128, 'a', 'z')
+_SIMD_CASE_KERNEL(_kernel_lower_avx2, "avx2", __m256i, 32, _mm256_set1_epi8, _mm256_loadu_si256, _mm256_storeu_si256,
+    _mm256_cmpgt_epi8, _mm256_and_si256, _mm256_xor_si256, 'A', 'Z')
+_SIMD_CASE_KERNEL(_kernel_upper_avx2, "avx2", __m256i, 32, _mm256_set1_epi8, _mm256_loadu_si256, _mm256_storeu_si256,
+    _mm256_cmpgt_epi8, _mm256_and_si256, _mm256_xor_si256, 'a', 'z')
+
+_SIMD_CASE_KERNEL_PADDED(_kernel_lower_padded_sse2, "sse2", __m128i, 16, _mm_set1_epi8, _mm_loadu_si128, _mm_storeu_si128,
+    _mm_cmpgt_epi8, _mm_and_si128, _mm_xor_si128, 'A', 'Z')
+_SIMD_CASE_KERNEL_PADDED(_kernel_upper_padded_sse2, "sse2", __m128i, 16, _mm_set1_epi8, _mm_loadu_si128, _mm_storeu_si128,
+    _mm_cmpgt_epi8, _mm_and_si128, _mm_xor_si128, 'a', 'z')
+_SIMD_CASE_KERNEL_PADDED(_kernel_lower_padded_avx2, "avx2", __m256i, 32, _mm256_set1_epi8, _mm256_loadu_si256, _mm256_storeu_si256,
+    _mm256_cmpgt_epi8, _mm256_and_si256, _mm256_xor_si256, 'A', 'Z')
+_SIMD_CASE_KERNEL_PADDED(_kernel_upper_padded_avx2, "avx2", __m256i, 32, _mm256_set1_epi8, _mm256_loadu_si256, _mm256_storeu_si256,
+    _mm256_cmpgt_epi8, _mm256_and_si256, _mm256_xor_si256, 'a', 'z')
+
+/*
+ * Substring search: compare the first and last bytes of `sub` against a
+ * block of candidate positions at once, and memcmp only where both match.
+ * Single-byte needles use memchr, which the C library already vectorizes.
+ */
+#define _SIMD_FIND_KERNEL(name, isa, vec, width, set1, load, cmpeq, and_, movemask) \
+__attribute__((target(isa))) \
+static Py_ssize_t name(const char *s, Py_ssize_t len, const char *sub, Py_ssize_t sublen) { \
+    if(sublen < 2 || sublen > len) \
+        return _kernel_find_scalar(s, len, sub, sublen); \
+    const vec first = set1(sub[0]); \
+    const vec last = set1(sub[sublen - 1]); \
+    Py_ssize_t i = 0; \
+    for(; i + sublen - 1 + (width) <= len; i += (width)) { \
+        vec a = load((const vec *)(s + i)); \
+        vec b = load((const vec *)(s + i + sublen - 1)); \
+        unsigned mask = (unsigned)movemask(and_(cmpeq(a, first), cmpeq(b, last))); \
+        while(mask) { \
+            int bit = __builtin_ctz(mask); \
+            if(memcmp(s + i + bit + 1, sub + 1, sublen - 2) == 0) \
+                return i + bit; \
+            mask &= mask - 1; \
+        } \
+    } \
+    Py_ssize_t found = _kernel_find_scalar(s + i, len - i, sub, sublen); \
+    return found < 0 ? -1 : i + found; \
+}
+
+_SIMD_FIND_KERNEL(_kernel_find_sse2, "sse2", __m128i, 16, _mm_set1_epi8, _mm_loadu_si128,
+    _mm_cmpeq_epi8, _mm_and_si128, _mm_movemask_epi8)
+_SIMD_FIND_KERNEL(_kernel_find_avx2, "avx2", __m256i, 32, _mm256_set1_epi8, _mm256_loadu_si256,
+    _mm256_cmpeq_epi8, _mm256_and_si256, _mm256_movemask_epi8)
+
+/*
+ * MinHash, four permutations per vector: 64x32-bit products from two
+ * 32x32 multiplies. Values fit in 32 bits, so the signed 64-bit compare
+ * works as an unsigned min. (SSE2 lacks that compare; it uses the scalar
+ * kernel.)
+ */
+__attribute__((target("avx2")))
+static void _kernel_minhash_avx2(uint64_t *sig, const uint64_t *a, const uint64_t *b, Py_ssize_t nperm, const uint64_t *x, Py_ssize_t n) {
+    Py_ssize_t i = 0;
+    for(; i + 4 <= nperm; i += 4) {
+        const __m256i av = _mm256_loadu_si256((const __m256i *)(a + i));
+        const __m256i ahi = _mm256_srli_epi64(av, 32);
+        const __m256i bv = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i m = _mm256_loadu_si256((const __m256i *)(sig + i));
+        for(Py_ssize_t j = 0; j < n; ++j) {
+            const __m256i xv = _mm256_set1_epi64x((long long)x[j]);
+            __m256i v = _mm256_add_epi64(_mm256_mul_epu32(av, xv), _mm256_slli_epi64(_mm256_mul_epu32(ahi, xv), 32));
+            v = _mm256_srli_epi64(_mm256_add_epi64(v, bv), 32);
+            m = _mm256_blendv_epi8(m, v, _mm256_cmpgt_epi64(m, v));
+        }
+        _mm256_storeu_si256((__m256i *)(sig + i), m);
+    }
+    _kernel_minhash_scalar(sig + i, a + i, b + i, nperm - i, x, n);
+}
+#endif
+
+/* in order of preference, best last */
+static const struct _kernel_table _kernel_tables[] = {
+    {"scalar", _kernel_lower_scalar, _kernel_upper_scalar, _kernel_lower_scalar, _kernel_upper_scalar, _kernel_find_scalar,
+        _kernel_minhash_scalar},
+#ifdef CSTRING_X86_KERNELS
+    {"sse2", _kernel_lower_sse2, _kernel_upper_sse2, _kernel_lower_padded_sse2, _kernel_upper_padded_sse2, _kernel_find_sse2,
+        _kernel_minhash_scalar},
+    {"avx2", _kernel_lower_avx2, _kernel_upper_avx2, _kernel_lower_padded_avx2, _kernel_upper_padded_avx2, _kernel_find_avx2,
+        _kernel_minhash_avx2},
+#endif
+};
+#define NKERNEL_TABLES  ((int)(sizeof(_kernel_tables) / sizeof(_kernel_tables[0])))
+
+static const struct _kernel_table *_kernels = &_kernel_tables[0];
+static int _kernels_selected;
+
+static int _kernel_table_supported(const struct _kernel_table *table) {
+#ifdef CSTRING_X86_KERNELS
+    if(strcmp(table->name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+    if(strcmp(table->name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+#endif
+    return strcmp(table->name, "scalar") == 0;
+}
+
+/*
+ * Select the kernel table, once per process: later module executions (in
+ * other interpreters) keep the first selection, since those interpreters
+ * may already be calling through it. Returns 0, or -1 if CSTRING_KERNELS
+ * names a variant that is unknown or unsupported here (the best supported
+ * one is used regardless).
+ */
+static int _kernels_init(void) {
+#ifdef CSTRING_X86_KERNELS
+    __builtin_cpu_init();
+#endif
+    const struct _kernel_table *best = &_kernel_tables[0];
+    for(int i = 0; i < NKERNEL_TABLES; ++i) {
+        if(_kernel_table_supported(&_kernel_tables[i]))
+            best = &_kernel_tables[i];
+    }
+
+    const struct _kernel_table *chosen = best;
+    int rc = 0;
+    const char *forced = getenv("CSTRING_KERNELS");
+    if(forced && *forced) {
+        rc = -1;
+        for(int i = 0; i < NKERNEL_TABLES; ++i) {
+            if(strcmp(_kernel_tables[i].name, forced) == 0 && _kernel_table_supported(&_kernel_tables[i])) {
+                chosen = &_kernel_tables[i];
+                rc = 0;
+            }
+        }
+    }
+
+    if(_ATOMIC_CAS(&_kernels_selected, 0, 1))
+        _ATOMIC_STORE(&_kernels, chosen);
+    return rc;
+}
+
+static void _kernel_lower(const char *s, char *d, Py_ssize_t len) {
+    _ATOMIC_LOAD(&_kernels)->lower(s, d, len);
+}
+
+static void _kernel_upper(const char *s, char *d, Py_ssize_t len) {
+    _ATOMIC_LOAD(&_kernels)->upper(s, d, len);
+}
+
+static void _kernel_lower_padded(const char *s, char *d, Py_ssize_t len) {
+    _ATOMIC_LOAD(&_kernels)->lower_padded(s, d, len);
+}
+
+static void _kernel_upper_padded(const char *s, char *d, Py_ssize_t len) {
+    _ATOMIC_LOAD(&_kernels)->upper_padded(s, d, len);
+}
+
+/* Offset of the first occurrence of `sub` in `s`, or -1. */
+static Py_ssize_t _kernel_find(const char *s, Py_ssize_t len, const char *sub, Py_ssize_t sublen) {
+    return _ATOMIC_LOAD(&_kernels)->find(s, len, sub, sublen);
+}
+
+static void _kernel_minhash(uint64_t *sig, const uint64_t *a, const uint64_t *b, Py_ssize_t nperm, const uint64_t *x, Py_ssize_t n) {
+    _ATOMIC_LOAD(&_kernels)->minhash(sig, a, b, nperm, x, n);
+}
+
+/* Number of non-overlapping occurrences of `sub` in `s`. */
+static Py_ssize_t _kernel_count(const char *s, Py_ssize_t len, const char *sub, Py_ssize_t sublen) {
+    if(sublen == 0)
+        return len + 1;
+    Py_ssize_t result = 0;
+    Py_ssize_t i = 0;
+    for(;;) {
+        Py_ssize_t found = _kernel_find(s + i, len - i, sub, sublen);
+        if(found < 0)
+            return result;
+        ++result;
+        i += found + sublen;
+    }
+}
+
 
+/*
+ * value normally points at the inline data, which is 16-byte aligned (on
+ * 64-bit builds, where the header is 48 bytes) and padded with zeros to
+ * CSTRING_PADDED_SIZE(Py_SIZE). A borrowed cstring instead points into an
+ * immutable `base` object (bytes or str) that it keeps alive, and has no
+ * inline data or padding. Py_SIZE is len + 1 either way.
+ */
 struct cstring {
     PyObject_VAR_HEAD
     Py_hash_t hash;
-    char value[];
+    char *value;
+    PyObject *base;
+    char data[];
 };
 
-static PyTypeObject cstring_type;
+#define CSTRING_PADDED(self)        (((struct cstring *)self)->base == NULL)
+#define CSTRING_MAPPED(self)        (!((struct cstring *)self)->base && ((struct cstring *)self)->value != ((struct cstring *)self)->data)
+
+/*
+ * Large-object storage: owned data of at least _hugepage_threshold bytes
+ * is placed in its own anonymous mapping, 2 MiB aligned and advised for
+ * transparent huge pages, instead of inline. Fresh mappings are zeroed, so
+ * padding needs no extra work. 0 disables this path.
+ */
+#define HUGEPAGE_SIZE           ((Py_ssize_t)2 * 1024 * 1024)
+#define HUGEPAGE_MAPPED_SIZE(n) ((CSTRING_PADDED_SIZE(n) + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1))
+
+#ifdef CSTRING_HAVE_MMAP
+static Py_ssize_t _hugepage_threshold = 64 * 1024 * 1024;
+#else
+static Py_ssize_t _hugepage_threshold = 0;
+#endif
+
+/* Map zeroed storage for `size` bytes of data, or return NULL. */
+static char *_cstring_map(Py_ssize_t size) {
+#ifdef CSTRING_HAVE_MMAP
+    Py_ssize_t mapped = HUGEPAGE_MAPPED_SIZE(size);
+    /* over-map, then trim to a 2 MiB aligned range */
+    char *p = mmap(NULL, mapped + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+        return NULL;
+    char *aligned = (char *)(((uintptr_t)p + HUGEPAGE_SIZE - 1) & ~(uintptr_t)(HUGEPAGE_SIZE - 1));
+    if(aligned > p)
+        munmap(p, aligned - p);
+    if(aligned + mapped < p + mapped + HUGEPAGE_SIZE)
+        munmap(aligned + mapped, p + mapped + HUGEPAGE_SIZE - (aligned + mapped));
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, mapped, MADV_HUGEPAGE);
+#endif
+    return aligned;
+#else
+    return NULL;
+#endif
+}
+
+static void _cstring_unmap(char *p, Py_ssize_t size) {
+#ifdef CSTRING_HAVE_MMAP
+    munmap(p, HUGEPAGE_MAPPED_SIZE(size));
+#endif
+}
+
+/* per-module state (PEP 573), shared by all types defined in the module */
+typedef struct {
+    PyTypeObject *cstring_type;
+    PyTypeObject *cstringarray_type;
+    PyTypeObject *cstringcategorical_type;
+    PyTypeObject *asplit_type;
+    PyTypeObject *template_type;
+    PyObject *empty;    /* empty cstring singleton */
+    PyObject *format_cache;     /* dict: cstring -> Template */
+} cstring_state;
+
+/*
+ * None of the module's types is subclassable, so every instance's type is
+ * one created by PyType_FromModuleAndSpec and carries the module directly:
+ * no MRO walk is needed.
+ */
+static inline cstring_state *_state_from_type(PyTypeObject *type) {
+    return PyType_GetModuleState(type);
+}
+
+#define CSTRING_STATE(self)         (_state_from_type(Py_TYPE(self)))
 
 #define CSTRING_HASH(self)          (((struct cstring *)self)->hash)
 #define CSTRING_VALUE(self)         (((struct cstring *)self)->value)
 #define CSTRING_VALUE_AT(self, i)   (&CSTRING_VALUE(self)[(i)])
 #define CSTRING_LAST_BYTE(self)     (CSTRING_VALUE(self)[Py_SIZE(self) - 1])
 
-#define CSTRING_ALLOC(tp, len)      ((struct cstring *)(tp)->tp_alloc((tp), (len)))
+static struct cstring *_cstring_alloc(PyTypeObject *type, Py_ssize_t size) {
+    _STAT_ADD(allocs, 1);
+    _STAT_ADD(alloc_bytes, size);
+    CSTRING_PROBE1(alloc, size);
+
+    Py_ssize_t threshold = _ATOMIC_LOAD(&_hugepage_threshold);
+    if(threshold > 0 && size >= threshold) {
+        char *mapped = _cstring_map(size);
+        if(mapped) {
+            struct cstring *new = (struct cstring *)type->tp_alloc(type, 0);
+            if(!new) {
+                _cstring_unmap(mapped, size);
+                return NULL;
+            }
+            Py_SET_SIZE(new, size);
+            new->hash = -1;
+            new->value = mapped;
+            new->base = NULL;
+            return new;
+        }
+        /* fall back to inline storage */
+    }
+
+    /*
+     * tp_alloc zero-fills, which provides the padding. It also allocates
+     * one item more than asked for, so this comes to exactly the padded
+     * size.
+     */
+    Py_ssize_t padded = CSTRING_PADDED_SIZE(size);
+    struct cstring *new = (struct cstring *)type->tp_alloc(type, padded ? padded - 1 : 0);
+    if(new) {
+        Py_SET_SIZE(new, size);
+        new->hash = -1;
+        new->value = new->data;
+        new->base = NULL;
+    }
+    return new;
+}
 
-/* singleton, initialized in cstring_new_empty */
-static const struct cstring *cstring_EMPTY = NULL;
+#define CSTRING_ALLOC(tp, len)      (_cstring_alloc((tp), (len)))
 
 static void *_bad_argument_type(PyObject *o) {
     PyErr_Format(
@@ -53,18 +656,56 @@ static PyObject *_cstring_new(PyTypeObject *type, const char *value, Py_ssize_t
         return NULL;
     new->hash = -1;
     memcpy(new->value, value, len);
+    _STAT_ADD(copy_bytes, len);
     CSTRING_LAST_BYTE(new) = '\0';
     return (PyObject *)new;
 }
 
+/* True if no other reference (or thread) can observe `self`. */
+static int _cstring_is_unique(PyObject *self) {
+#if PY_VERSION_HEX >= 0x030E0000
+    return PyUnstable_Object_IsUniquelyReferenced(self);
+#elif defined(Py_GIL_DISABLED)
+    return _Py_IsOwnedByCurrentThread(self) && Py_REFCNT(self) == 1;
+#else
+    return Py_REFCNT(self) == 1;
+#endif
+}
+
 static PyObject *_cstring_realloc(PyObject *self, Py_ssize_t len) {
-    if(Py_REFCNT(self) > 1)
+    if(!_cstring_is_unique(self) || ((struct cstring *)self)->base)
         return PyErr_BadInternalCall(), NULL;
-    struct cstring *new = PyObject_Realloc(self, sizeof(struct cstring) + len + 1);
+    if(CSTRING_MAPPED(self)) {
+        struct cstring *cs = (struct cstring *)self;
+        Py_ssize_t oldsize = Py_SIZE(self);
+        if(HUGEPAGE_MAPPED_SIZE(len + 1) != HUGEPAGE_MAPPED_SIZE(oldsize)) {
+            char *mapped = _cstring_map(len + 1);
+            if(!mapped)
+                return PyErr_NoMemory();
+            memcpy(mapped, cs->value, Py_MIN(oldsize, len + 1));
+            _cstring_unmap(cs->value, oldsize);
+            cs->value = mapped;
+        } else if(len + 1 < oldsize) {
+            memset(cs->value + len + 1, 0, oldsize - len - 1);
+        }
+        Py_SET_SIZE(cs, len + 1);
+        cs->hash = -1;
+        _STAT_ADD(reallocs, 1);
+        _STAT_ADD(realloc_bytes, len + 1);
+        CSTRING_PROBE1(realloc, len + 1);
+        return self;
+    }
+    Py_ssize_t padded = CSTRING_PADDED_SIZE(len + 1);
+    struct cstring *new = PyObject_Realloc(self, sizeof(struct cstring) + padded);
     if(!new)
         return PyErr_NoMemory();
+    memset(new->data + len + 1, 0, padded - len - 1);
     Py_SET_SIZE(new, len + 1);
     new->hash = -1;
+    new->value = new->data;
+    _STAT_ADD(reallocs, 1);
+    _STAT_ADD(realloc_bytes, len + 1);
+    CSTRING_PROBE1(realloc, len + 1);
     return (PyObject *)new;
 }
 
@@ -72,16 +713,12 @@ static PyObject *_cstring_copy(PyObject *self) {
     return _cstring_new(Py_TYPE(self), CSTRING_VALUE(self), Py_SIZE(self) - 1);
 }
 
-static PyObject *cstring_new_empty(void) {
-    if(!cstring_EMPTY) {
-        cstring_EMPTY = (struct cstring *)_cstring_new(&cstring_type, "", 0);
-    }
-    /* leaking one reference for singleton cache (never cleaned up) */
-    Py_INCREF(cstring_EMPTY);
-    return (PyObject *)cstring_EMPTY;
+static PyObject *cstring_new_empty(cstring_state *state) {
+    Py_INCREF(state->empty);
+    return state->empty;
 }
 
-static const char *_obj_as_string_and_size(PyObject *o, Py_ssize_t *s) {
+static const char *_obj_as_string_and_size(cstring_state *state, PyObject *o, Py_ssize_t *s) {
     if(PyUnicode_Check(o))
         return PyUnicode_AsUTF8AndSize(o, s);
 
@@ -96,7 +733,7 @@ static const char *_obj_as_string_and_size(PyObject *o, Py_ssize_t *s) {
         return buffer;
     }
 
-    if(PyObject_TypeCheck(o, &cstring_type)) {
+    if(PyObject_TypeCheck(o, state->cstring_type)) {
         /* TODO: implement buffer protocol for cstring */
         *s = Py_SIZE(o) - 1;
         return CSTRING_VALUE(o);
@@ -106,9 +743,26 @@ static const char *_obj_as_string_and_size(PyObject *o, Py_ssize_t *s) {
     return _bad_argument_type(o);
 }
 
+/*
+ * New cstring viewing `len` bytes at `value`, which must be NUL-terminated
+ * and owned by the immutable object `base`.
+ */
+static PyObject *_cstring_borrow(PyTypeObject *type, PyObject *base, const char *value, Py_ssize_t len) {
+    struct cstring *new = _cstring_alloc(type, 0);
+    if(!new)
+        return NULL;
+    Py_SET_SIZE(new, len + 1);
+    new->value = (char *)value;
+    Py_INCREF(base);
+    new->base = base;
+    return (PyObject *)new;
+}
+
 static PyObject *cstring_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
     PyObject *argobj = NULL;
-    if(!PyArg_ParseTuple(args, "O", &argobj))
+    PyObject *copyobj = Py_None;
+    char *kwlist[] = {"", "copy", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &argobj, &copyobj))
         return NULL;
 
     if(PyObject_TypeCheck(argobj, type)) {
@@ -116,28 +770,51 @@ static PyObject *cstring_new(PyTypeObject *type, PyObject *args, PyObject *kwarg
         return argobj;
     }
 
+    int copy = 1;   /* None: copy; borrowing is opt-in */
+    if(copyobj != Py_None && (copy = PyObject_IsTrue(copyobj)) < 0)
+        return NULL;
+
     Py_ssize_t len = 0;
-    const char *buffer = _obj_as_string_and_size(argobj, &len);
+    cstring_state *state = _state_from_type(type);
+    const char *buffer = _obj_as_string_and_size(state, argobj, &len);
     if(!buffer)
         return NULL;
 
+    /* bytes and str are immutable, and their data is NUL-terminated */
+    int borrowable = PyBytes_Check(argobj) || PyUnicode_Check(argobj);
+    if(copy == 0 && !borrowable) {
+        PyErr_Format(
+            PyExc_ValueError,
+            "copy=False requires bytes or str, not %s",
+            Py_TYPE(argobj)->tp_name);
+        return NULL;
+    }
+
     if(len == 0)
-        return cstring_new_empty();
+        return cstring_new_empty(state);
+
+    if(!copy)
+        return _cstring_borrow(type, argobj, buffer, len);
 
     return _cstring_new(type, buffer, len);
 }
 
 static void cstring_dealloc(PyObject *self) {
-    Py_TYPE(self)->tp_free(self);
+    PyTypeObject *type = Py_TYPE(self);
+    Py_XDECREF(((struct cstring *)self)->base);
+    if(CSTRING_MAPPED(self))
+        _cstring_unmap(CSTRING_VALUE(self), Py_SIZE(self));
+    type->tp_free(self);
+    Py_DECREF(type);
 }
 
-static int _ensure_cstring(PyObject *self) {
-    if(PyObject_TypeCheck(self, &cstring_type))
+static int _ensure_cstring(cstring_state *state, PyObject *o) {
+    if(PyObject_TypeCheck(o, state->cstring_type))
         return 1;
     PyErr_Format(
         PyExc_TypeError,
         "Object must have type cstring, not %s.",
-        Py_TYPE(self)->tp_name);
+        Py_TYPE(o)->tp_name);
     return 0;
 }
 
@@ -153,13 +830,22 @@ static PyObject *cstring_repr(PyObject *self) {
 }
 
 static Py_hash_t cstring_hash(PyObject *self) {
-    if(CSTRING_HASH(self) == -1)
-        CSTRING_HASH(self) = _Py_HashBytes(CSTRING_VALUE(self), Py_SIZE(self));
-    return CSTRING_HASH(self);
+    /* racing threads compute and publish the same value */
+    Py_hash_t hash = _ATOMIC_LOAD(&CSTRING_HASH(self));
+    if(hash == -1) {
+        CSTRING_PROBE1(hash, Py_SIZE(self));
+        hash = _Py_HashBytes(CSTRING_VALUE(self), Py_SIZE(self));
+        _ATOMIC_STORE(&CSTRING_HASH(self), hash);
+        _STAT_ADD(hash_computes, 1);
+        _STAT_ADD(hash_bytes, Py_SIZE(self));
+    } else {
+        _STAT_ADD(hash_hits, 1);
+    }
+    return hash;
 }
 
 static PyObject *cstring_richcompare(PyObject *self, PyObject *other, int op) {
-    if(!_ensure_cstring(other))
+    if(!_ensure_cstring(CSTRING_STATE(self), other))
         return NULL;
 
     const char *left = CSTRING_VALUE(self);
@@ -190,14 +876,14 @@ static Py_ssize_t cstring_len(PyObject *self) {
     return Py_SIZE(self) - 1;
 }
 
-static PyObject *_concat_in_place(PyObject *self, PyObject *other) {
+static PyObject *_concat_in_place(cstring_state *state, PyObject *self, PyObject *other) {
     if(!other)
         return PyErr_BadArgument(), NULL;
-    if(!_ensure_cstring(other))
+    if(!_ensure_cstring(state, other))
         return NULL;
     if(!self)
         return _cstring_copy(other);  /* new (mutable) copy with refcnt=1 */
-    if(!_ensure_cstring(self))
+    if(!_ensure_cstring(state, self))
         return NULL;
 
     Py_ssize_t origlen = cstring_len(self);
@@ -212,9 +898,8 @@ static PyObject *_concat_in_place(PyObject *self, PyObject *other) {
 }
 
 static PyObject *cstring_concat(PyObject *left, PyObject *right) {
-    if(!_ensure_cstring(left))
-        return NULL;
-    if(!_ensure_cstring(right))
+    cstring_state *state = CSTRING_STATE(left);
+    if(!_ensure_cstring(state, right))
         return NULL;
 
     Py_ssize_t size = cstring_len(left) + cstring_len(right) + 1;
@@ -228,10 +913,8 @@ static PyObject *cstring_concat(PyObject *left, PyObject *right) {
 }
 
 static PyObject *cstring_repeat(PyObject *self, Py_ssize_t count) {
-    if(!_ensure_cstring(self))
-        return NULL;
     if(count <= 0)
-        return cstring_new_empty();
+        return cstring_new_empty(CSTRING_STATE(self));
 
     Py_ssize_t size = (cstring_len(self) * count) + 1;
 
@@ -258,7 +941,7 @@ static PyObject *cstring_item(PyObject *self, Py_ssize_t i) {
 }
 
 static int cstring_contains(PyObject *self, PyObject *arg) {
-    if(!_ensure_cstring(arg))
+    if(!_ensure_cstring(CSTRING_STATE(self), arg))
         return -1;
     if(strstr(CSTRING_VALUE(self), CSTRING_VALUE(arg)))
         return 1;
@@ -290,6 +973,7 @@ static PyObject *_cstring_subscript_slice(PyObject *self, PyObject *slice) {
         src += step;
     }
     new->value[slicelen] = '\0';
+    _STAT_ADD(copy_bytes, slicelen);
     return (PyObject *)new;
 }
 
@@ -314,11 +998,15 @@ static Py_ssize_t _fix_index(Py_ssize_t i, Py_ssize_t len) {
     return result;
 }
 
+/* release the GIL while searching at least this many bytes */
+#define NOGIL_SEARCH_THRESHOLD  (64 * 1024)
+
 struct _substr_params {
     const char *start;
     const char *end;
     const char *substr;
     Py_ssize_t substr_len;
+    int nogil;
 };
 
 static struct _substr_params *_parse_substr_args(PyObject *self, PyObject *args, struct _substr_params *params) {
@@ -330,7 +1018,7 @@ static struct _substr_params *_parse_substr_args(PyObject *self, PyObject *args,
         return NULL;
 
     Py_ssize_t substr_len;
-    const char *substr = _obj_as_string_and_size(substr_obj, &substr_len);
+    const char *substr = _obj_as_string_and_size(CSTRING_STATE(self), substr_obj, &substr_len);
     if(!substr)
         return NULL;
 
@@ -342,6 +1030,10 @@ static struct _substr_params *_parse_substr_args(PyObject *self, PyObject *args,
     params->substr = substr;
     params->substr_len = substr_len;
 
+    /* substr must not change under us: only immutable objects qualify */
+    params->nogil = (end - start >= NOGIL_SEARCH_THRESHOLD)
+        && (PyUnicode_Check(substr_obj) || PyBytes_Check(substr_obj) || PyObject_TypeCheck(substr_obj, Py_TYPE(self)));
+
     return params;
 }
 
@@ -352,36 +1044,43 @@ static PyObject *cstring_count(PyObject *self, PyObject *args) {
     if(!_parse_substr_args(self, args, &params))
         return NULL;
 
-    const char *p = params.start;
-    long result = 0;
-    while((p = strstr(p, params.substr)) != NULL) {
-        ++result;
-        p += params.substr_len;
-        if(p >= params.end)
-            break;
-    }
+    _STAT_ADD(searches, 1);
+    _STAT_ADD(search_bytes, params.end - params.start);
 
-    return PyLong_FromLong(result);
+    CSTRING_PROBE2(search__entry, params.end - params.start, params.substr_len);
+    PyThreadState *ts = params.nogil ? PyEval_SaveThread() : NULL;
+    Py_ssize_t result = _kernel_count(params.start, params.end - params.start, params.substr, params.substr_len);
+    if(ts)
+        PyEval_RestoreThread(ts);
+    CSTRING_PROBE2(search__return, params.end - params.start, result);
+
+    return PyLong_FromSsize_t(result);
 }
 
 static const char *_substr_params_str(const struct _substr_params *params) {
-    const char *p = strstr(params->start, params->substr);
-    if(!p || p + params->substr_len > params->end)
-        return NULL;
-    return p;
+    _STAT_ADD(searches, 1);
+    _STAT_ADD(search_bytes, params->end - params->start);
+
+    CSTRING_PROBE2(search__entry, params->end - params->start, params->substr_len);
+    PyThreadState *ts = params->nogil ? PyEval_SaveThread() : NULL;
+    Py_ssize_t i = _kernel_find(params->start, params->end - params->start, params->substr, params->substr_len);
+    if(ts)
+        PyEval_RestoreThread(ts);
+    CSTRING_PROBE2(search__return, params->end - params->start, i);
+    return i < 0 ? NULL : params->start + i;
 }
 
 static const char *_substr_params_rstr(const struct _substr_params *params) {
-    const char *p = params->end - params->substr_len + 1;
-    for(;;) {
-        p = _memrchr(params->start, *params->substr, p - params->start);
-        if(!p)
-            goto done;
-        if(memcmp(p, params->substr, params->substr_len) == 0)
-            return p;
-    }
-done:
-    return NULL;
+    _STAT_ADD(searches, 1);
+    _STAT_ADD(search_bytes, params->end - params->start);
+
+    CSTRING_PROBE2(search__entry, params->end - params->start, params->substr_len);
+    PyThreadState *ts = params->nogil ? PyEval_SaveThread() : NULL;
+    Py_ssize_t i = _kernel_rfind(params->start, params->end - params->start, params->substr, params->substr_len);
+    if(ts)
+        PyEval_RestoreThread(ts);
+    CSTRING_PROBE2(search__return, params->end - params->start, i);
+    return i < 0 ? NULL : params->start + i;
 }
 
 PyDoc_STRVAR(find__doc__, "");
@@ -416,103 +1115,42 @@ PyObject *cstring_index(PyObject *self, PyObject *args) {
 
 PyDoc_STRVAR(isalnum__doc__, "");
 PyObject *cstring_isalnum(PyObject *self, PyObject *args) {
-    const char *p = CSTRING_VALUE(self);
-    while(*p) {
-        if(!isalnum(*p))
-            Py_RETURN_FALSE;
-        ++p;
-    }
-    Py_RETURN_TRUE;
+    return PyBool_FromLong(_kernel_isalnum(CSTRING_VALUE(self), cstring_len(self)));
 }
 
 PyDoc_STRVAR(isalpha__doc__, "");
 PyObject *cstring_isalpha(PyObject *self, PyObject *args) {
-    const char *p = CSTRING_VALUE(self);
-    while(*p) {
-        if(!isalpha(*p))
-            Py_RETURN_FALSE;
-        ++p;
-    }
-    Py_RETURN_TRUE;
+    return PyBool_FromLong(_kernel_isalpha(CSTRING_VALUE(self), cstring_len(self)));
 }
 
 PyDoc_STRVAR(isdigit__doc__, "");
 PyObject *cstring_isdigit(PyObject *self, PyObject *args) {
-    const char *p = CSTRING_VALUE(self);
-    while(*p) {
-        if(!isdigit(*p))
-            Py_RETURN_FALSE;
-        ++p;
-    }
-    Py_RETURN_TRUE;
+    return PyBool_FromLong(_kernel_isdigit(CSTRING_VALUE(self), cstring_len(self)));
 }
 
 PyDoc_STRVAR(islower__doc__, "");
 PyObject *cstring_islower(PyObject *self, PyObject *args) {
-    const char *p = CSTRING_VALUE(self);
-    while(*p) {
-        if(isalpha(*p)) {
-            if(!islower(*p))
-                Py_RETURN_FALSE;
-            ++p;
-            while(*p) {
-                if(isalpha(*p) && !islower(*p))
-                    Py_RETURN_FALSE;
-                ++p;
-            }
-            /* at least one lc alpha and no uc alphas */
-            Py_RETURN_TRUE;
-        }
-        ++p;
-    }
-    Py_RETURN_FALSE;
+    return PyBool_FromLong(_kernel_islower(CSTRING_VALUE(self), cstring_len(self)));
 }
 
 PyDoc_STRVAR(isprintable__doc__, "");
 PyObject *cstring_isprintable(PyObject *self, PyObject *args) {
-    const char *p = CSTRING_VALUE(self);
-    while(*p) {
-        if(!isprint(*p))
-            Py_RETURN_FALSE;
-        ++p;
-    }
-    Py_RETURN_TRUE;
+    return PyBool_FromLong(_kernel_isprintable(CSTRING_VALUE(self), cstring_len(self)));
 }
 
 PyDoc_STRVAR(isspace__doc__, "");
 PyObject *cstring_isspace(PyObject *self, PyObject *args) {
-    const char *p = CSTRING_VALUE(self);
-    while(*p) {
-        if(!isspace(*p))
-            Py_RETURN_FALSE;
-        ++p;
-    }
-    return PyBool_FromLong(p != CSTRING_VALUE(self));
+    return PyBool_FromLong(_kernel_isspace(CSTRING_VALUE(self), cstring_len(self)));
 }
 
 PyDoc_STRVAR(isupper__doc__, "");
 PyObject *cstring_isupper(PyObject *self, PyObject *args) {
-    const char *p = CSTRING_VALUE(self);
-    while(*p) {
-        if(isalpha(*p)) {
-            if(!isupper(*p))
-                Py_RETURN_FALSE;
-            ++p;
-            while(*p) {
-                if(isalpha(*p) && !isupper(*p))
-                    Py_RETURN_FALSE;
-                ++p;
-            }
-            /* at least one uc alpha and no lc alphas */
-            Py_RETURN_TRUE;
-        }
-        ++p;
-    }
-    Py_RETURN_FALSE;
+    return PyBool_FromLong(_kernel_isupper(CSTRING_VALUE(self), cstring_len(self)));
 }
 
 PyDoc_STRVAR(join__doc__, "");
 PyObject *cstring_join(PyObject *self, PyObject *arg) {
+    cstring_state *state = CSTRING_STATE(self);
     PyObject *iter = PyObject_GetIter(arg);
     if(!iter)
         return NULL;
@@ -522,12 +1160,12 @@ PyObject *cstring_join(PyObject *self, PyObject *arg) {
 
     while((item = PyIter_Next(iter)) != NULL) {
         if(result) {
-            PyObject *next = _concat_in_place(result, self);
+            PyObject *next = _concat_in_place(state, result, self);
             if(!next)
                 goto fail;
             result = next;
         }
-        PyObject *next = _concat_in_place(result, item);
+        PyObject *next = _concat_in_place(state, result, item);
         if(!next)
             goto fail;
         Py_DECREF(item);
@@ -547,12 +1185,10 @@ PyObject *cstring_lower(PyObject *self, PyObject *args) {
     struct cstring *new = CSTRING_ALLOC(Py_TYPE(self), Py_SIZE(self));
     if(!new)
         return NULL;
-    const char *s = CSTRING_VALUE(self);
-    char *d = CSTRING_VALUE(new);
-
-    while((*d++ = tolower(*s++)) != '\0')
-        ;
-
+    if(CSTRING_PADDED(self))
+        _kernel_lower_padded(CSTRING_VALUE(self), CSTRING_VALUE(new), Py_SIZE(self));
+    else
+        _kernel_lower(CSTRING_VALUE(self), CSTRING_VALUE(new), Py_SIZE(self));
     return (PyObject *)new;
 }
 
@@ -578,9 +1214,54 @@ fail:
     return NULL;
 }
 
+/*
+ * New array.array of `count` zeroed items with type `typecode`.
+ * `*data` receives a pointer to the items.
+ */
+static PyObject *_array_new(const char *typecode, Py_ssize_t count, void **data) {
+    PyObject *arraymod = PyImport_ImportModule("array");
+    if(!arraymod)
+        return NULL;
+    PyObject *result = PyObject_CallMethod(arraymod, "array", "s", typecode);
+    Py_DECREF(arraymod);
+    if(!result)
+        return NULL;
+
+    Py_buffer view;
+    if(PyObject_GetBuffer(result, &view, PyBUF_SIMPLE) < 0)
+        goto fail;
+    Py_ssize_t itemsize = view.itemsize;
+    PyBuffer_Release(&view);
+    if(count > PY_SSIZE_T_MAX / itemsize) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    PyObject *zeros = PyBytes_FromStringAndSize(NULL, count * itemsize);
+    if(!zeros)
+        goto fail;
+    memset(PyBytes_AS_STRING(zeros), 0, count * itemsize);
+    PyObject *tmp = PyObject_CallMethod(result, "frombytes", "O", zeros);
+    Py_DECREF(zeros);
+    if(!tmp)
+        goto fail;
+    Py_DECREF(tmp);
+
+    if(PyObject_GetBuffer(result, &view, PyBUF_WRITABLE) < 0)
+        goto fail;
+    *data = view.buf;
+    PyBuffer_Release(&view);
+    return result;
+
+fail:
+    Py_DECREF(result);
+    return NULL;
+}
+
 PyDoc_STRVAR(partition__doc__, "");
 PyObject *cstring_partition(PyObject *self, PyObject *arg) {
-    if(!_ensure_cstring(arg))
+    cstring_state *state = CSTRING_STATE(self);
+    if(!_ensure_cstring(state, arg))
         return NULL;
 
     const char *search = CSTRING_VALUE(arg);
@@ -590,8 +1271,8 @@ PyObject *cstring_partition(PyObject *self, PyObject *arg) {
     if(!mid) {
         return _tuple_steal_refs(3,
             (Py_INCREF(self), self),
-            cstring_new_empty(),
-            cstring_new_empty());
+            cstring_new_empty(state),
+            cstring_new_empty(state));
     }
     const char *right = mid + strlen(search);
 
@@ -603,7 +1284,8 @@ PyObject *cstring_partition(PyObject *self, PyObject *arg) {
 
 PyDoc_STRVAR(rpartition__doc__, "");
 PyObject *cstring_rpartition(PyObject *self, PyObject *arg) {
-    if(!_ensure_cstring(arg))
+    cstring_state *state = CSTRING_STATE(self);
+    if(!_ensure_cstring(state, arg))
         return NULL;
 
     const char *search = CSTRING_VALUE(arg);
@@ -612,8 +1294,8 @@ PyObject *cstring_rpartition(PyObject *self, PyObject *arg) {
     const char *mid = _strrstr(left, search);
     if(!mid) {
         return _tuple_steal_refs(3,
-            cstring_new_empty(),
-            cstring_new_empty(),
+            cstring_new_empty(state),
+            cstring_new_empty(state),
             (Py_INCREF(self), self));
     }
     const char *right = mid + strlen(search);
@@ -655,81 +1337,169 @@ PyObject *cstring_rindex(PyObject *self, PyObject *args) {
     return PyLong_FromSsize_t(p - CSTRING_VALUE(self));
 }
 
-PyObject *_cstring_split_on_chars(PyObject *self, const char seps[], Py_ssize_t maxsplit) {
-    if(maxsplit < 0)
-        maxsplit = PY_SSIZE_T_MAX;
+/*
+ * Incremental split engine shared by split and asplit.
+ *
+ * With sep == NULL, splits on runs of whitespace and ignores leading and
+ * trailing whitespace; otherwise splits on each occurrence of sep.
+ */
+struct _split_state {
+    const char *s;
+    Py_ssize_t len;
+    Py_ssize_t pos;         /* start of the current piece */
+    Py_ssize_t scan;        /* where a suspended scan resumes */
+    const char *sep;
+    Py_ssize_t seplen;
+    Py_ssize_t maxsplit;
+    Py_ssize_t pieces;
+    int in_piece;           /* the piece at pos has been started */
+    int done;
+};
 
-    const char *start = CSTRING_VALUE(self);
+static void _split_init(struct _split_state *st, const char *s, Py_ssize_t len, const char *sep, Py_ssize_t seplen, Py_ssize_t maxsplit) {
+    st->s = s;
+    st->len = len;
+    st->pos = 0;
+    st->scan = 0;
+    st->in_piece = 0;
+    st->sep = sep;
+    st->seplen = seplen;
+    st->maxsplit = maxsplit < 0 ? PY_SSIZE_T_MAX : maxsplit;
+    st->pieces = 0;
+    st->done = 0;
+    _STAT_ADD(splits, 1);
+    _STAT_ADD(split_bytes, len);
+    CSTRING_PROBE2(split__entry, len, seplen);
+}
 
-    PyObject *list = PyList_New(0);
-    if(!list)
-        return NULL;
+/* Start the piece at pos; returns 0 if maxsplit makes it the last one. */
+static int _split_start_piece(struct _split_state *st) {
+    st->in_piece = 1;
+    _STAT_ADD(split_pieces, 1);
+    ++st->pieces;
+    return st->maxsplit-- > 0;
+}
 
-    while(*start) {
-        const char *end = start;
-        while(*end && !strchr(seps, *end))
-            ++end;
+/*
+ * Store the next piece in [*start, *end), scanning at most about `budget`
+ * bytes. Returns 1 with a piece, 0 when exhausted, or -1 when the budget
+ * ran out first; the scan then resumes where it stopped on the next call.
+ */
+static int _split_step(struct _split_state *st, Py_ssize_t budget, Py_ssize_t *start, Py_ssize_t *end) {
+    if(st->done)
+        return 0;
+    Py_ssize_t stop = budget < st->len - st->scan ? st->scan + budget : st->len;
+
+    if(!st->sep) {
+        if(!st->in_piece) {
+            while(st->scan < stop && Py_ISSPACE(st->s[st->scan]))
+                ++st->scan;
+            if(st->scan == st->len) {
+                st->done = 1;
+                return 0;
+            }
+            if(st->scan == stop)
+                return -1;
+            st->pos = st->scan;
+            if(!_split_start_piece(st)) {
+                *start = st->pos;
+                *end = st->len;
+                st->done = 1;
+                return 1;
+            }
+        }
+        while(st->scan < stop && !Py_ISSPACE(st->s[st->scan]))
+            ++st->scan;
+        if(st->scan == stop && stop < st->len)
+            return -1;
+        *start = st->pos;
+        *end = st->pos = st->scan;
+        st->in_piece = 0;
+        return 1;
+    }
 
-        PyObject *new = _cstring_new(Py_TYPE(self), start, end - start);
-        if(!new)
-            goto fail;
-        PyList_Append(list, new);
-        Py_DECREF(new);
+    if(!st->in_piece && !_split_start_piece(st)) {
+        *start = st->pos;
+        *end = st->len;
+        st->done = 1;
+        return 1;
+    }
+    /* look for a separator starting before stop */
+    Py_ssize_t hi = st->len - stop > st->seplen - 1 ? stop + st->seplen - 1 : st->len;
+    Py_ssize_t found = _kernel_find(st->s + st->scan, hi - st->scan, st->sep, st->seplen);
+    if(found >= 0) {
+        *start = st->pos;
+        *end = st->scan + found;
+        st->pos = st->scan = *end + st->seplen;
+        st->in_piece = 0;
+        return 1;
+    }
+    if(hi < st->len) {
+        st->scan = stop;
+        return -1;
+    }
+    *start = st->pos;
+    *end = st->len;
+    st->done = 1;
+    return 1;
+}
 
-        const char *skip = end + 1;
-        while(*skip && strchr(seps, *skip))
-            ++skip;
-        start = skip;
+/* Store the next piece in [*start, *end). Returns 0 when exhausted. */
+static int _split_next(struct _split_state *st, Py_ssize_t *start, Py_ssize_t *end) {
+    return _split_step(st, PY_SSIZE_T_MAX, start, end) > 0;
+}
 
-        if(PyList_GET_SIZE(list) + 1 > maxsplit) {
-            PyObject *new = _cstring_new(Py_TYPE(self), start, strlen(start));
-            if(!new)
-                goto fail;
-            PyList_Append(list, new);
-            Py_DECREF(new);
-            break;
+/* Bytes of the source consumed so far. */
+static Py_ssize_t _split_scanned(const struct _split_state *st) {
+    return st->done ? st->len : st->scan;
+}
+
+/* Parse split-style (sep, maxsplit) arguments into a split state over self. */
+static int _split_init_from_args(struct _split_state *st, PyObject *self, PyObject *sepobj, Py_ssize_t maxsplit) {
+    const char *sep = NULL;
+    Py_ssize_t seplen = 0;
+    if(sepobj != Py_None) {
+        if(!_ensure_cstring(CSTRING_STATE(self), sepobj))
+            return -1;
+        sep = CSTRING_VALUE(sepobj);
+        seplen = cstring_len(sepobj);
+        if(seplen == 0) {
+            PyErr_SetString(PyExc_ValueError, "empty separator");
+            return -1;
         }
     }
-
-    return list;
-
-fail:
-    Py_DECREF(list);
-    return NULL;
+    _split_init(st, CSTRING_VALUE(self), cstring_len(self), sep, seplen, maxsplit);
+    return 0;
 }
 
-PyObject *_cstring_split_on_cstring(PyObject *self, PyObject *sepobj, Py_ssize_t maxsplit) {
-    if(!_ensure_cstring(sepobj))
+PyDoc_STRVAR(split__doc__, "");
+PyObject *cstring_split(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *sepobj = Py_None;
+    Py_ssize_t maxsplit = -1;
+    char *kwlist[] = {"sep", "maxsplit", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|On", kwlist, &sepobj, &maxsplit))
         return NULL;
 
-    if(maxsplit < 0)
-        maxsplit = PY_SSIZE_T_MAX;
+    struct _split_state st;
+    if(_split_init_from_args(&st, self, sepobj, maxsplit) < 0)
+        return NULL;
 
     PyObject *list = PyList_New(0);
     if(!list)
         return NULL;
 
-    const char *sep = CSTRING_VALUE(sepobj);
-    const char *s = CSTRING_VALUE(self);
-    for(;;) {
-        const char *e = strstr(s, sep);
-        if(!e)
-            break;
-        PyObject *new = _cstring_new(Py_TYPE(self), s, e - s);
+    Py_ssize_t start, end;
+    while(_split_next(&st, &start, &end)) {
+        PyObject *new = _cstring_new(Py_TYPE(self), CSTRING_VALUE_AT(self, start), end - start);
         if(!new)
             goto fail;
-        PyList_Append(list, new);
+        int rc = PyList_Append(list, new);
         Py_DECREF(new);
-        s = e + strlen(sep);
-        if(PyList_GET_SIZE(list) + 1 > maxsplit)
-            break;
+        if(rc < 0)
+            goto fail;
     }
 
-    PyObject *new = _cstring_new(Py_TYPE(self), s, strlen(s));
-    if(!new)
-        goto fail;
-    PyList_Append(list, new);
-
+    CSTRING_PROBE2(split__return, st.len, st.pieces);
     return list;
 
 fail:
@@ -737,19 +1507,6 @@ fail:
     return NULL;
 }
 
-PyDoc_STRVAR(split__doc__, "");
-PyObject *cstring_split(PyObject *self, PyObject *args, PyObject *kwargs) {
-    PyObject *sepobj = Py_None;
-    int maxsplit = -1;
-    char *kwlist[] = {"sep", "maxsplit", NULL};
-    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|Oi", kwlist, &sepobj, &maxsplit))
-        return NULL;
-
-    return (sepobj == Py_None)
-        ? _cstring_split_on_chars(self, WHITESPACE_CHARS, maxsplit)
-        : _cstring_split_on_cstring(self, sepobj, maxsplit);
-}
-
 PyDoc_STRVAR(startswith__doc__, "");
 PyObject *cstring_startswith(PyObject *self, PyObject *args) {
     struct _substr_params params;
@@ -777,46 +1534,30 @@ const char *_strip_chars_from_args(PyObject *args) {
     return chars;
 }
 
-PyDoc_STRVAR(strip__doc__, "");
-PyObject *cstring_strip(PyObject *self, PyObject *args) {
+static PyObject *_cstring_strip(PyObject *self, PyObject *args, int left, int right) {
     const char *chars = _strip_chars_from_args(args);
+    if(!chars)
+        return NULL;
 
-    const char *start = CSTRING_VALUE(self);
-    while(strchr(chars, *start))
-        ++start;
-
-    const char *end = &CSTRING_LAST_BYTE(self) - 1;
-    while(strchr(chars, *end))
-        --end;
+    Py_ssize_t start = 0;
+    Py_ssize_t end = cstring_len(self);
+    _kernel_strip(CSTRING_VALUE(self), chars, strlen(chars), left, right, &start, &end);
+    return _cstring_new(Py_TYPE(self), CSTRING_VALUE_AT(self, start), end - start);
+}
 
-    Py_ssize_t newsize = end - start + 1;
-    return _cstring_new(Py_TYPE(self), start, newsize);
+PyDoc_STRVAR(strip__doc__, "");
+PyObject *cstring_strip(PyObject *self, PyObject *args) {
+    return _cstring_strip(self, args, 1, 1);
 }
 
 PyDoc_STRVAR(lstrip__doc__, "");
 PyObject *cstring_lstrip(PyObject *self, PyObject *args) {
-    const char *chars = _strip_chars_from_args(args);
-
-    const char *start = CSTRING_VALUE(self);
-    while(strchr(chars, *start))
-        ++start;
-    const char *end = &CSTRING_LAST_BYTE(self) - 1;
-
-    Py_ssize_t newsize = end - start + 1;
-    return _cstring_new(Py_TYPE(self), start, newsize);
+    return _cstring_strip(self, args, 1, 0);
 }
 
 PyDoc_STRVAR(rstrip__doc__, "");
 PyObject *cstring_rstrip(PyObject *self, PyObject *args) {
-    const char *chars = _strip_chars_from_args(args);
-
-    const char *start = CSTRING_VALUE(self);
-    const char *end = &CSTRING_LAST_BYTE(self) - 1;
-    while(strchr(chars, *end))
-        --end;
-
-    Py_ssize_t newsize = end - start + 1;
-    return _cstring_new(Py_TYPE(self), start, newsize);
+    return _cstring_strip(self, args, 0, 1);
 }
 
 PyDoc_STRVAR(endswith__doc__, "");
@@ -835,19 +1576,8 @@ PyObject *cstring_swapcase(PyObject *self, PyObject *args) {
     struct cstring *new = CSTRING_ALLOC(Py_TYPE(self), Py_SIZE(self));
     if(!new)
         return NULL;
-    const char *s = CSTRING_VALUE(self);
-    char *d = CSTRING_VALUE(new);
-
-    for(;*s; ++s, ++d) {
-        if(islower(*s)) {
-            *d = toupper(*s);
-        } else if(isupper(*s)) {
-            *d = tolower(*s);
-        } else {
-            *d = *s;
-        }
-    }
-
+    new->hash = -1;
+    _kernel_swapcase(CSTRING_VALUE(self), CSTRING_VALUE(new), Py_SIZE(self));
     return (PyObject *)new;
 }
 
@@ -856,109 +1586,5124 @@ PyObject *cstring_upper(PyObject *self, PyObject *args) {
     struct cstring *new = CSTRING_ALLOC(Py_TYPE(self), Py_SIZE(self));
     if(!new)
         return NULL;
-    const char *s = CSTRING_VALUE(self);
-    char *d = CSTRING_VALUE(new);
+    if(CSTRING_PADDED(self))
+        _kernel_upper_padded(CSTRING_VALUE(self), CSTRING_VALUE(new), Py_SIZE(self));
+    else
+        _kernel_upper(CSTRING_VALUE(self), CSTRING_VALUE(new), Py_SIZE(self));
+    return (PyObject *)new;
+}
 
-    while((*d++ = toupper(*s++)) != '\0')
-        ;
+/*
+ * Awaitable variants.
+ *
+ * afind, arfind and acount run the search on the event loop's default
+ * executor; large searches release the GIL, so other coroutines keep
+ * running meanwhile.
+ */
+static PyObject *_run_in_executor(PyObject *self, const char *method, PyObject *args) {
+    PyObject *asyncio = PyImport_ImportModule("asyncio");
+    if(!asyncio)
+        return NULL;
+    PyObject *loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL);
+    Py_DECREF(asyncio);
+    if(!loop)
+        return NULL;
 
-    return (PyObject *)new;
+    PyObject *result = NULL;
+    PyObject *callargs = NULL;
+    PyObject *func = PyObject_GetAttrString(self, method);
+    if(!func)
+        goto done;
+    PyObject *head = _tuple_steal_refs(2, (Py_INCREF(Py_None), Py_None), func);
+    if(!head)
+        goto done;
+    callargs = PySequence_Concat(head, args);
+    Py_DECREF(head);
+    if(!callargs)
+        goto done;
+
+    PyObject *run = PyObject_GetAttrString(loop, "run_in_executor");
+    if(!run)
+        goto done;
+    result = PyObject_Call(run, callargs, NULL);
+    Py_DECREF(run);
+
+done:
+    Py_XDECREF(callargs);
+    Py_DECREF(loop);
+    return result;
 }
 
-static PySequenceMethods cstring_as_sequence = {
-    .sq_length = cstring_len,
-    .sq_concat = cstring_concat,
-    .sq_repeat = cstring_repeat,
-    .sq_item = cstring_item,
-    .sq_contains = cstring_contains,
-};
+PyDoc_STRVAR(afind__doc__, "");
+PyObject *cstring_afind(PyObject *self, PyObject *args) {
+    return _run_in_executor(self, "find", args);
+}
+
+PyDoc_STRVAR(arfind__doc__, "");
+PyObject *cstring_arfind(PyObject *self, PyObject *args) {
+    return _run_in_executor(self, "rfind", args);
+}
+
+PyDoc_STRVAR(acount__doc__, "");
+PyObject *cstring_acount(PyObject *self, PyObject *args) {
+    return _run_in_executor(self, "count", args);
+}
 
-static PyMappingMethods cstring_as_mapping = {
-    .mp_length = cstring_len,
-    .mp_subscript = cstring_subscript,
+/*
+ * asplit iterator.
+ *
+ * The object is its own async iterator and awaitable: __anext__ returns
+ * self, and each step of awaiting it scans at most `chunk` bytes. A step
+ * that runs out of budget, inside a piece or between pieces, yields None
+ * (a bare yield, which gives the asyncio event loop one iteration) and
+ * the next step resumes the scan; a piece completes the await.
+ */
+struct cstring_asplit {
+    PyObject_HEAD
+    PyObject *source;
+    PyObject *sep;
+    struct _split_state st;
+    Py_ssize_t chunk;
+    Py_ssize_t scanned;
+    PyObject *pending;
 };
 
-static PyMethodDef cstring_methods[] = {
-    /* TODO: capitalize */
-    /* TODO: casefold */
-    /* TODO: center */
-    {"count", cstring_count, METH_VARARGS, count__doc__},
-    /* TODO: encode (decode???) */
-    {"endswith", cstring_endswith, METH_VARARGS, endswith__doc__},
-    /* TODO: expandtabs */
-    {"find", cstring_find, METH_VARARGS, find__doc__},
-    /* TODO: format */
-    /* TODO: format_map */
-    {"index", cstring_index, METH_VARARGS, index__doc__},
-    {"isalnum", cstring_isalnum, METH_NOARGS, isalnum__doc__},
-    {"isalpha", cstring_isalpha, METH_NOARGS, isalpha__doc__},
-    /* TODO: isascii */
-    /* TODO: isdecimal */
-    {"isdigit", cstring_isdigit, METH_NOARGS, isdigit__doc__},
-    /* TODO: isidentifier */
-    {"islower", cstring_islower, METH_NOARGS, islower__doc__},
-    /* TODO: isnumeric */
-    {"isprintable", cstring_isprintable, METH_NOARGS, isprintable__doc__},
-    {"isspace", cstring_isspace, METH_NOARGS, isspace__doc__},
-    /* TODO: istitle */
-    {"isupper", cstring_isupper, METH_NOARGS, isupper__doc__},
-    {"join", cstring_join, METH_O, join__doc__},
-    /* TODO: ljust */
-    {"lower", cstring_lower, METH_NOARGS, lower__doc__},
-    {"lstrip", cstring_lstrip, METH_VARARGS, lstrip__doc__},
-    /* TODO: maketrans */
-    {"partition", cstring_partition, METH_O, partition__doc__},
-    /* TODO: removeprefix */
-    /* TODO: replace */
-    {"rfind", cstring_rfind, METH_VARARGS, rfind__doc__},
-    {"rindex", cstring_rindex, METH_VARARGS, rindex__doc__},
-    /* TODO: rjust */
-    {"rpartition", cstring_rpartition, METH_O, rpartition__doc__},
-    /* TODO: rsplit */
-    {"rstrip", cstring_rstrip, METH_VARARGS, rstrip__doc__},
-    {"split", (PyCFunction)cstring_split, METH_VARARGS | METH_KEYWORDS, split__doc__},
-    /* TODO: splitlines */
-    {"startswith", cstring_startswith, METH_VARARGS, startswith__doc__},
-    {"strip", cstring_strip, METH_VARARGS, strip__doc__},
-    {"swapcase", cstring_swapcase, METH_NOARGS, swapcase__doc__},
-    /* TODO: title */
-    /* TODO: translate */
-    {"upper", cstring_upper, METH_NOARGS, upper__doc__},
-    /* TODO: zfill */
+static void cstring_asplit_dealloc(PyObject *self) {
+    struct cstring_asplit *it = (struct cstring_asplit *)self;
+    PyTypeObject *type = Py_TYPE(self);
+    Py_XDECREF(it->source);
+    Py_XDECREF(it->sep);
+    Py_XDECREF(it->pending);
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+static PyObject *cstring_asplit_anext(PyObject *self) {
+    struct cstring_asplit *it = (struct cstring_asplit *)self;
+    if(it->st.done && !it->pending) {
+        CSTRING_PROBE2(split__return, it->st.len, it->st.pieces);
+        PyErr_SetNone(PyExc_StopAsyncIteration);
+        return NULL;
+    }
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject *cstring_asplit_iternext(PyObject *self) {
+    struct cstring_asplit *it = (struct cstring_asplit *)self;
+    if(it->pending) {
+        PyErr_SetObject(PyExc_StopIteration, it->pending);
+        Py_CLEAR(it->pending);
+        return NULL;
+    }
+
+    Py_ssize_t before = _split_scanned(&it->st);
+    Py_ssize_t start, end;
+    int rc = _split_step(&it->st, it->chunk - it->scanned, &start, &end);
+    it->scanned += _split_scanned(&it->st) - before;
+    if(rc == 0) {
+        CSTRING_PROBE2(split__return, it->st.len, it->st.pieces);
+        PyErr_SetNone(PyExc_StopAsyncIteration);
+        return NULL;
+    }
+    if(rc > 0) {
+        PyObject *piece = _cstring_new(Py_TYPE(it->source), CSTRING_VALUE_AT(it->source, start), end - start);
+        if(!piece)
+            return NULL;
+        if(it->scanned < it->chunk) {
+            PyErr_SetObject(PyExc_StopIteration, piece);
+            Py_DECREF(piece);
+            return NULL;
+        }
+        it->pending = piece;
+    }
+    it->scanned = 0;
+    Py_RETURN_NONE;
+}
+
+static PyType_Slot cstring_asplit_slots[] = {
+    {Py_tp_dealloc, cstring_asplit_dealloc},
+    {Py_am_aiter, PyObject_SelfIter},
+    {Py_am_anext, cstring_asplit_anext},
+    {Py_am_await, PyObject_SelfIter},
+    {Py_tp_iter, PyObject_SelfIter},
+    {Py_tp_iternext, cstring_asplit_iternext},
     {0},
 };
 
-static PyTypeObject cstring_type = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "cstring.cstring",
-    .tp_doc = "",
-    .tp_basicsize = sizeof(struct cstring),
-    .tp_itemsize = sizeof(char),
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_new = cstring_new,
-    .tp_dealloc = cstring_dealloc,
-    .tp_richcompare = cstring_richcompare,
-    .tp_str = cstring_str,
-    .tp_repr = cstring_repr,
-    .tp_hash = cstring_hash,
-    .tp_as_sequence = &cstring_as_sequence,
-    .tp_as_mapping = &cstring_as_mapping,
-    .tp_methods = cstring_methods,
+static PyType_Spec cstring_asplit_spec = {
+    .name = "cstring.asplit_iterator",
+    .basicsize = sizeof(struct cstring_asplit),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = cstring_asplit_slots,
 };
 
-static struct PyModuleDef module = {
-    .m_base = PyModuleDef_HEAD_INIT,
-    .m_name = "cstring",
-    .m_doc = "",
-    .m_size = 0,
-    .m_methods = NULL,
+PyDoc_STRVAR(asplit__doc__, "");
+PyObject *cstring_asplit(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *sepobj = Py_None;
+    Py_ssize_t maxsplit = -1;
+    Py_ssize_t chunk = 1024 * 1024;
+    char *kwlist[] = {"sep", "maxsplit", "chunk", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|Onn", kwlist, &sepobj, &maxsplit, &chunk))
+        return NULL;
+    if(chunk < 1) {
+        PyErr_SetString(PyExc_ValueError, "chunk must be positive");
+        return NULL;
+    }
+
+    PyTypeObject *type = CSTRING_STATE(self)->asplit_type;
+    struct cstring_asplit *it = (struct cstring_asplit *)type->tp_alloc(type, 0);
+    if(!it)
+        return NULL;
+    if(_split_init_from_args(&it->st, self, sepobj, maxsplit) < 0) {
+        Py_DECREF(it);
+        return NULL;
+    }
+    Py_INCREF(self);
+    it->source = self;
+    Py_INCREF(sepobj);
+    it->sep = sepobj;   /* keeps st.sep alive */
+    it->chunk = chunk;
+    return (PyObject *)it;
+}
+
+/*
+ * Compiled format templates.
+ *
+ * A template string is parsed once into a program of literal and field
+ * operations. Rendering resolves every field to a (pointer, length) piece,
+ * sums the lengths, allocates the result once and copies the pieces in.
+ * cstring, str and int arguments with no conversion or format spec are
+ * written without creating intermediate objects.
+ *
+ * Field names with attribute or index access ("{0.x}", "{0[1]}") and
+ * nested fields in format specs ("{:{width}}") are not compiled; such
+ * templates render through str.format.
+ */
+enum _fmt_kind {
+    FMT_LITERAL,
+    FMT_INDEX,      /* positional argument */
+    FMT_NAME,       /* keyword argument or mapping key */
 };
 
-PyMODINIT_FUNC PyInit_cstring(void) {
-    if(PyType_Ready(&cstring_type) < 0)
+struct _fmt_op {
+    enum _fmt_kind kind;
+    Py_ssize_t start;   /* FMT_LITERAL: byte range of the template */
+    Py_ssize_t len;
+    Py_ssize_t index;   /* FMT_INDEX */
+    PyObject *name;     /* FMT_NAME: str */
+    PyObject *spec;     /* str, or NULL */
+    char conversion;    /* 'r', 's', 'a' or 0 */
+};
+
+struct cstring_template {
+    PyObject_HEAD
+    PyObject *source;   /* cstring */
+    Py_ssize_t nops;
+    struct _fmt_op *ops;
+    int fallback;       /* render with str.format */
+};
+
+#define TEMPLATE_INLINE_PIECES  16
+
+/* Write `v` in `base` ending at `end`; returns the first digit. */
+static char *_write_digits(char *end, unsigned long long v, int base) {
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    do {
+        *--end = digits[v % base];
+        v /= base;
+    } while(v);
+    return end;
+}
+
+static void _template_free_ops(struct _fmt_op *ops, Py_ssize_t nops) {
+    for(Py_ssize_t i = 0; i < nops; ++i) {
+        Py_XDECREF(ops[i].name);
+        Py_XDECREF(ops[i].spec);
+    }
+    PyMem_Free(ops);
+}
+
+/*
+ * Parse the field body s[0:len] (between braces) into `op`. Returns 1 on
+ * success, 0 if the field needs the str.format fallback, -1 on error.
+ */
+static int _template_parse_field(const char *s, Py_ssize_t len, struct _fmt_op *op, Py_ssize_t *auto_index, int *numbering) {
+    Py_ssize_t namelen = 0;
+    while(namelen < len && s[namelen] != '!' && s[namelen] != ':')
+        ++namelen;
+
+    Py_ssize_t pos = namelen;
+    op->conversion = 0;
+    if(pos < len && s[pos] == '!') {
+        if(pos + 1 >= len) {
+            PyErr_SetString(PyExc_ValueError, "end of string while looking for conversion specifier");
+            return -1;
+        }
+        op->conversion = s[pos + 1];
+        if(op->conversion != 'r' && op->conversion != 's' && op->conversion != 'a') {
+            PyErr_Format(PyExc_ValueError, "Unknown conversion specifier %c", op->conversion);
+            return -1;
+        }
+        pos += 2;
+        if(pos < len && s[pos] != ':') {
+            PyErr_SetString(PyExc_ValueError, "expected ':' after conversion specifier");
+            return -1;
+        }
+    }
+
+    op->spec = NULL;
+    if(pos < len) {
+        /* s[pos] == ':' */
+        if(memchr(s + pos + 1, '{', len - pos - 1))
+            return 0;
+        if(len - pos - 1 > 0) {
+            op->spec = PyUnicode_DecodeUTF8(s + pos + 1, len - pos - 1, NULL);
+            if(!op->spec)
+                return -1;
+        }
+    }
+
+    for(Py_ssize_t i = 0; i < namelen; ++i) {
+        if(s[i] == '.' || s[i] == '[')
+            return 0;
+    }
+
+    int digits = namelen > 0;
+    for(Py_ssize_t i = 0; i < namelen; ++i)
+        digits &= Py_ISDIGIT(s[i]) != 0;
+
+    if(namelen == 0 || digits) {
+        int manual = namelen > 0;
+        if(*numbering >= 0 && *numbering != manual) {
+            PyErr_SetString(PyExc_ValueError, manual
+                ? "cannot switch from automatic field numbering to manual field specification"
+                : "cannot switch from manual field specification to automatic field numbering");
+            return -1;
+        }
+        *numbering = manual;
+        op->kind = FMT_INDEX;
+        op->name = NULL;
+        if(manual) {
+            op->index = 0;
+            for(Py_ssize_t i = 0; i < namelen; ++i) {
+                if(op->index > (PY_SSIZE_T_MAX - 9) / 10) {
+                    PyErr_SetString(PyExc_ValueError, "Too many decimal digits in format string");
+                    return -1;
+                }
+                op->index = op->index * 10 + (s[i] - '0');
+            }
+        } else {
+            op->index = (*auto_index)++;
+        }
+        return 1;
+    }
+
+    op->kind = FMT_NAME;
+    op->name = PyUnicode_DecodeUTF8(s, namelen, NULL);
+    return op->name ? 1 : -1;
+}
+
+/* Compile `source` (a cstring) into `t`. */
+static int _template_compile(struct cstring_template *t, PyObject *source) {
+    const char *s = CSTRING_VALUE(source);
+    Py_ssize_t len = cstring_len(source);
+
+    /* each brace starts at most one literal and one field */
+    Py_ssize_t cap = 1;
+    for(Py_ssize_t i = 0; i < len; ++i)
+        cap += (s[i] == '{' || s[i] == '}') * 2;
+    struct _fmt_op *ops = PyMem_Calloc(cap, sizeof(struct _fmt_op));
+    if(!ops) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    Py_ssize_t nops = 0;
+    Py_ssize_t auto_index = 0;
+    int numbering = -1;
+    Py_ssize_t lit = 0;
+    Py_ssize_t i = 0;
+    while(i < len) {
+        char c = s[i];
+        if(c != '{' && c != '}') {
+            ++i;
+            continue;
+        }
+        if(i + 1 < len && s[i + 1] == c) {
+            /* escaped brace: keep one as part of the literal */
+            ops[nops++] = (struct _fmt_op){.kind = FMT_LITERAL, .start = lit, .len = i + 1 - lit};
+            i += 2;
+            lit = i;
+            continue;
+        }
+        if(c == '}') {
+            PyErr_SetString(PyExc_ValueError, "Single '}' encountered in format string");
+            goto fail;
+        }
+
+        /* find the closing brace, allowing nested braces in the spec */
+        Py_ssize_t depth = 1;
+        Py_ssize_t j = i + 1;
+        for(; j < len; ++j) {
+            if(s[j] == '{')
+                ++depth;
+            else if(s[j] == '}' && --depth == 0)
+                break;
+        }
+        if(j >= len) {
+            PyErr_SetString(PyExc_ValueError, depth > 1 || j > i + 1
+                ? "expected '}' before end of string"
+                : "Single '{' encountered in format string");
+            goto fail;
+        }
+
+        if(i > lit)
+            ops[nops++] = (struct _fmt_op){.kind = FMT_LITERAL, .start = lit, .len = i - lit};
+        int rc = _template_parse_field(s + i + 1, j - i - 1, &ops[nops], &auto_index, &numbering);
+        if(rc < 0)
+            goto fail;
+        if(rc == 0) {
+            t->fallback = 1;
+            break;
+        }
+        ++nops;
+        i = j + 1;
+        lit = i;
+    }
+    if(!t->fallback && len > lit)
+        ops[nops++] = (struct _fmt_op){.kind = FMT_LITERAL, .start = lit, .len = len - lit};
+
+    if(t->fallback) {
+        _template_free_ops(ops, nops + 1);
+        ops = NULL;
+        nops = 0;
+    }
+    t->ops = ops;
+    t->nops = nops;
+    Py_INCREF(source);
+    t->source = source;
+    return 0;
+
+fail:
+    _template_free_ops(ops, nops + 1);
+    return -1;
+}
+
+static PyObject *_template_new(PyTypeObject *type, PyObject *source) {
+    struct cstring_template *t = (struct cstring_template *)type->tp_alloc(type, 0);
+    if(!t)
+        return NULL;
+    if(_template_compile(t, source) < 0) {
+        Py_DECREF(t);
+        return NULL;
+    }
+    return (PyObject *)t;
+}
+
+static PyObject *cstring_template_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    PyObject *argobj;
+    if(!PyArg_ParseTuple(args, "O", &argobj))
+        return NULL;
+    cstring_state *state = _state_from_type(type);
+    PyObject *source = PyObject_CallOneArg((PyObject *)state->cstring_type, argobj);
+    if(!source)
+        return NULL;
+    PyObject *result = _template_new(type, source);
+    Py_DECREF(source);
+    return result;
+}
+
+static void cstring_template_dealloc(PyObject *self) {
+    struct cstring_template *t = (struct cstring_template *)self;
+    PyTypeObject *type = Py_TYPE(self);
+    if(t->ops)
+        _template_free_ops(t->ops, t->nops);
+    Py_XDECREF(t->source);
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+static PyObject *cstring_template_repr(PyObject *self) {
+    PyObject *str = cstring_str(((struct cstring_template *)self)->source);
+    if(!str)
+        return NULL;
+    PyObject *repr = PyUnicode_FromFormat("%s(%R)", Py_TYPE(self)->tp_name, str);
+    Py_DECREF(str);
+    return repr;
+}
+
+/* Render through str.format / str.format_map. */
+static PyObject *_template_render_fallback(struct cstring_template *t, PyObject *args, PyObject *kwargs, PyObject *mapping) {
+    PyObject *str = cstring_str(t->source);
+    if(!str)
+        return NULL;
+    PyObject *result;
+    if(mapping) {
+        result = PyObject_CallMethod(str, "format_map", "O", mapping);
+    } else {
+        PyObject *method = PyObject_GetAttrString(str, "format");
+        result = method ? PyObject_Call(method, args, kwargs) : NULL;
+        Py_XDECREF(method);
+    }
+    Py_DECREF(str);
+    if(!result)
+        return NULL;
+    PyObject *cs = PyObject_CallOneArg((PyObject *)CSTRING_STATE(t->source)->cstring_type, result);
+    Py_DECREF(result);
+    return cs;
+}
+
+struct _fmt_piece {
+    const char *s;
+    Py_ssize_t len;
+    PyObject *owner;    /* object keeping s alive, or NULL */
+    char buf[72];       /* a long long in base 2, or a float */
+};
+
+/*
+ * Number writers, shared by formatting and the from_int/from_float
+ * constructors. Ints that fit in a long long and all floats are written
+ * into piece->buf; larger ints go through a temporary str.
+ */
+
+/* Digits of a non-negative int too large for a long long. */
+static PyObject *_bigint_to_base(PyObject *v, int base) {
+    if(base == 10)
+        return PyObject_Str(v);
+    if(base == 2 || base == 8 || base == 16) {
+        PyObject *spec = PyUnicode_FromString(base == 2 ? "b" : base == 8 ? "o" : "x");
+        if(!spec)
+            return NULL;
+        PyObject *result = PyObject_Format(v, spec);
+        Py_DECREF(spec);
+        return result;
+    }
+
+    /* peel off chunks of k digits, each fitting in a long long */
+    long long chunk = base;
+    int k = 1;
+    while(chunk <= LLONG_MAX / base) {
+        chunk *= base;
+        ++k;
+    }
+    PyObject *nbits = PyObject_CallMethod(v, "bit_length", NULL);
+    if(!nbits)
+        return NULL;
+    Py_ssize_t cap = PyLong_AsSsize_t(nbits) + k + 1;
+    Py_DECREF(nbits);
+    if(cap < 0 && PyErr_Occurred())
+        return NULL;
+
+    PyObject *chunkobj = PyLong_FromLongLong(chunk);
+    char *digits = PyMem_Malloc(cap);
+    PyObject *n = Py_NewRef(v);
+    PyObject *result = NULL;
+    if(!chunkobj || !digits)
+        goto done;
+
+    char *p = digits + cap;
+    while(PyObject_IsTrue(n)) {
+        PyObject *qr = PyNumber_Divmod(n, chunkobj);
+        if(!qr)
+            goto done;
+        Py_SETREF(n, Py_NewRef(PyTuple_GET_ITEM(qr, 0)));
+        long long r = PyLong_AsLongLong(PyTuple_GET_ITEM(qr, 1));
+        Py_DECREF(qr);
+        char *start = _write_digits(p, (unsigned long long)r, base);
+        while(p - start < k)
+            *--start = '0';
+        p = start;
+    }
+    while(p < digits + cap - 1 && *p == '0')
+        ++p;
+    result = PyUnicode_FromStringAndSize(p, digits + cap - p);
+
+done:
+    Py_DECREF(n);
+    Py_XDECREF(chunkobj);
+    PyMem_Free(digits);
+    return result;
+}
+
+/* Text of the int `v` in `base` (2 to 36), without prefix. */
+static int _int_piece(PyObject *v, int base, struct _fmt_piece *piece) {
+    int overflow;
+    long long x = PyLong_AsLongLongAndOverflow(v, &overflow);
+    if(x == -1 && PyErr_Occurred())
+        return -1;
+
+    if(!overflow) {
+        char *end = piece->buf + sizeof(piece->buf);
+        char *p = _write_digits(end, x < 0 ? 0ULL - (unsigned long long)x : (unsigned long long)x, base);
+        if(x < 0)
+            *--p = '-';
+        piece->s = p;
+        piece->len = end - p;
+        return 0;
+    }
+
+    PyObject *abs = overflow < 0 ? PyNumber_Negative(v) : Py_NewRef(v);
+    if(!abs)
+        return -1;
+    PyObject *digits = _bigint_to_base(abs, base);
+    Py_DECREF(abs);
+    if(!digits)
+        return -1;
+    if(overflow < 0) {
+        Py_SETREF(digits, PyUnicode_FromFormat("-%U", digits));
+        if(!digits)
+            return -1;
+    }
+    piece->owner = digits;
+    piece->s = PyUnicode_AsUTF8AndSize(digits, &piece->len);
+    return piece->s ? 0 : -1;
+}
+
+/*
+ * Fast path for _float_piece: values in repr's fixed-notation range with
+ * at most 15 significant digits (most "human" decimals). For the fewest
+ * fractional digits k such that round(|x| * 10**k) / 10**k == |x|, that
+ * decimal is the unique shortest one that round-trips: with <= 15 digits
+ * candidates are further apart than the round-trip interval, and the
+ * scaled value is off by well under 0.5, so rounding finds it. Returns 0
+ * if x is not handled.
+ */
+static int _float_piece_fast(double x, struct _fmt_piece *piece) {
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    };
+    double ax = x < 0 ? -x : x;
+    if(!(ax >= 1e-4 && ax < 1e15))     /* also rejects nan */
+        return 0;
+
+    for(int k = 0; k < 16; ++k) {
+        double scaled = ax * pow10[k];
+        if(scaled >= 1e15)
+            return 0;
+        long long digits = (long long)(scaled + 0.5);
+        if((double)digits / pow10[k] != ax)
+            continue;
+
+        char *end = piece->buf + sizeof(piece->buf);
+        char *p = end;
+        long long ipart = digits;
+        if(k == 0) {
+            *--p = '0';
+            *--p = '.';
+        } else {
+            long long scale = (long long)pow10[k];
+            long long frac = digits % scale;
+            ipart = digits / scale;
+            char *fend = p;
+            p = _write_digits(p, (unsigned long long)frac, 10);
+            while(fend - p < k)
+                *--p = '0';
+            *--p = '.';
+        }
+        p = _write_digits(p, (unsigned long long)ipart, 10);
+        if(x < 0)
+            *--p = '-';
+        piece->s = p;
+        piece->len = end - p;
+        return 1;
+    }
+    return 0;
+}
+
+/* Shortest text that round-trips to `x`, as repr(float). */
+static int _float_piece(double x, struct _fmt_piece *piece) {
+    if(_float_piece_fast(x, piece))
+        return 0;
+    char *text = PyOS_double_to_string(x, 'r', 0, Py_DTSF_ADD_DOT_0, NULL);
+    if(!text)
+        return -1;
+    size_t len = strlen(text);
+    memcpy(piece->buf, text, len);
+    PyMem_Free(text);
+    piece->s = piece->buf;
+    piece->len = len;
+    return 0;
+}
+
+static int _check_base(int base) {
+    if(base < 2 || base > 36) {
+        PyErr_SetString(PyExc_ValueError, "base must be >= 2 and <= 36");
+        return -1;
+    }
+    return 0;
+}
+
+PyDoc_STRVAR(from_int__doc__,
+"from_int(n, base=10) -> cstring\n"
+"\n"
+"Text of the integer n in the given base (2 to 36), without prefix.");
+static PyObject *cstring_from_int(PyObject *cls, PyObject *args, PyObject *kwargs) {
+    PyObject *n;
+    int base = 10;
+    char *kwlist[] = {"", "base", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", kwlist, &n, &base))
+        return NULL;
+    if(_check_base(base) < 0)
+        return NULL;
+    PyObject *index = PyNumber_Index(n);
+    if(!index)
+        return NULL;
+    struct _fmt_piece piece = {.owner = NULL};
+    PyObject *result = NULL;
+    if(_int_piece(index, base, &piece) == 0)
+        result = _cstring_new((PyTypeObject *)cls, piece.s, piece.len);
+    Py_XDECREF(piece.owner);
+    Py_DECREF(index);
+    return result;
+}
+
+PyDoc_STRVAR(from_float__doc__,
+"from_float(x) -> cstring\n"
+"\n"
+"Shortest text that round-trips to the float x (same as repr(x)).");
+static PyObject *cstring_from_float(PyObject *cls, PyObject *arg) {
+    double x = PyFloat_AsDouble(arg);
+    if(x == -1.0 && PyErr_Occurred())
         return NULL;
-    Py_INCREF(&cstring_type);
-    PyObject *m = PyModule_Create(&module);
-    PyModule_AddObject(m, "cstring", (PyObject *)&cstring_type);
-    return m;
+    struct _fmt_piece piece;
+    if(_float_piece(x, &piece) < 0)
+        return NULL;
+    return _cstring_new((PyTypeObject *)cls, piece.s, piece.len);
+}
+
+/* Resolve `value` formatted per `op` into `piece`. */
+static int _template_piece(cstring_state *state, const struct _fmt_op *op, PyObject *value, struct _fmt_piece *piece) {
+    if(!op->conversion && !op->spec) {
+        if(PyObject_TypeCheck(value, state->cstring_type)) {
+            piece->s = CSTRING_VALUE(value);
+            piece->len = cstring_len(value);
+            return 0;
+        }
+        if(PyUnicode_Check(value)) {
+            piece->s = PyUnicode_AsUTF8AndSize(value, &piece->len);
+            return piece->s ? 0 : -1;
+        }
+        if(PyLong_CheckExact(value))
+            return _int_piece(value, 10, piece);
+    }
+
+    PyObject *converted;
+    switch(op->conversion) {
+    case 'r':
+        converted = PyObject_Repr(value);
+        break;
+    case 'a':
+        converted = PyObject_ASCII(value);
+        break;
+    case 's':
+        converted = PyObject_Str(value);
+        break;
+    default:
+        /* cstring has no __format__; format its str */
+        converted = PyObject_TypeCheck(value, state->cstring_type) ? cstring_str(value) : Py_NewRef(value);
+    }
+    if(!converted)
+        return -1;
+    PyObject *formatted = op->spec || !PyUnicode_Check(converted)
+        ? PyObject_Format(converted, op->spec)
+        : Py_NewRef(converted);
+    Py_DECREF(converted);
+    if(!formatted)
+        return -1;
+    piece->owner = formatted;
+    piece->s = PyUnicode_AsUTF8AndSize(formatted, &piece->len);
+    return piece->s ? 0 : -1;
+}
+
+/*
+ * Render with positional `args` and keyword `kwargs` (format), or with
+ * `mapping` for named fields (format_map).
+ */
+static PyObject *_template_render(struct cstring_template *t, PyObject *args, PyObject *kwargs, PyObject *mapping) {
+    if(t->fallback)
+        return _template_render_fallback(t, args, kwargs, mapping);
+
+    cstring_state *state = CSTRING_STATE(t->source);
+    struct _fmt_piece inline_pieces[TEMPLATE_INLINE_PIECES];
+    struct _fmt_piece *pieces = inline_pieces;
+    if(t->nops > TEMPLATE_INLINE_PIECES) {
+        pieces = PyMem_Malloc(t->nops * sizeof(struct _fmt_piece));
+        if(!pieces)
+            return PyErr_NoMemory();
+    }
+
+    PyObject *result = NULL;
+    Py_ssize_t npieces = 0;
+    Py_ssize_t total = 0;
+    const char *src = CSTRING_VALUE(t->source);
+    for(; npieces < t->nops; ++npieces) {
+        const struct _fmt_op *op = &t->ops[npieces];
+        struct _fmt_piece *piece = &pieces[npieces];
+        piece->owner = NULL;
+
+        if(op->kind == FMT_LITERAL) {
+            piece->s = src + op->start;
+            piece->len = op->len;
+        } else {
+            PyObject *value;
+            if(op->kind == FMT_INDEX) {
+                if(!args) {
+                    PyErr_SetString(PyExc_ValueError, "Format string contains positional fields");
+                    goto done;
+                }
+                if(op->index >= PyTuple_GET_SIZE(args)) {
+                    PyErr_Format(PyExc_IndexError, "Replacement index %zd out of range for positional args tuple", op->index);
+                    goto done;
+                }
+                value = Py_NewRef(PyTuple_GET_ITEM(args, op->index));
+            } else if(mapping) {
+                value = PyObject_GetItem(mapping, op->name);
+                if(!value)
+                    goto done;
+            } else {
+                value = kwargs ? PyDict_GetItemWithError(kwargs, op->name) : NULL;
+                if(!value) {
+                    if(!PyErr_Occurred())
+                        PyErr_SetObject(PyExc_KeyError, op->name);
+                    goto done;
+                }
+                Py_INCREF(value);
+            }
+            int rc = _template_piece(state, op, value, piece);
+            /* a str or cstring piece points into value itself */
+            if(rc == 0 && !piece->owner && (PyUnicode_Check(value) || PyObject_TypeCheck(value, state->cstring_type)))
+                piece->owner = Py_NewRef(value);
+            Py_DECREF(value);
+            if(rc < 0) {
+                ++npieces;
+                goto done;
+            }
+        }
+        total += piece->len;
+    }
+
+    if(total == 0) {
+        result = cstring_new_empty(state);
+        goto done;
+    }
+    struct cstring *new = CSTRING_ALLOC(state->cstring_type, total + 1);
+    if(!new)
+        goto done;
+    char *d = new->value;
+    for(Py_ssize_t i = 0; i < npieces; ++i) {
+        memcpy(d, pieces[i].s, pieces[i].len);
+        d += pieces[i].len;
+    }
+    *d = '\0';
+    result = (PyObject *)new;
+
+done:
+    for(Py_ssize_t i = 0; i < npieces; ++i)
+        Py_XDECREF(pieces[i].owner);
+    if(pieces != inline_pieces)
+        PyMem_Free(pieces);
+    return result;
+}
+
+PyDoc_STRVAR(template_render__doc__,
+"render(*args, **kwargs) -> cstring\n"
+"\n"
+"Like str.format with this template.");
+static PyObject *cstring_template_render(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return _template_render((struct cstring_template *)self, args, kwargs, NULL);
+}
+
+PyDoc_STRVAR(template_render_map__doc__,
+"render_map(mapping) -> cstring\n"
+"\n"
+"Like str.format_map with this template.");
+static PyObject *cstring_template_render_map(PyObject *self, PyObject *mapping) {
+    return _template_render((struct cstring_template *)self, NULL, NULL, mapping);
+}
+
+static PyObject *cstring_template_get_template(PyObject *self, void *closure) {
+    return Py_NewRef(((struct cstring_template *)self)->source);
+}
+
+static PyGetSetDef cstring_template_getset[] = {
+    {"template", cstring_template_get_template, NULL, NULL, NULL},
+    {0},
+};
+
+static PyMethodDef cstring_template_methods[] = {
+    {"render", (PyCFunction)cstring_template_render, METH_VARARGS | METH_KEYWORDS, template_render__doc__},
+    {"render_map", cstring_template_render_map, METH_O, template_render_map__doc__},
+    {0},
+};
+
+static PyType_Slot cstring_template_slots[] = {
+    {Py_tp_doc, ""},
+    {Py_tp_new, cstring_template_new},
+    {Py_tp_dealloc, cstring_template_dealloc},
+    {Py_tp_repr, cstring_template_repr},
+    {Py_tp_getset, cstring_template_getset},
+    {Py_tp_methods, cstring_template_methods},
+    {0},
+};
+
+static PyType_Spec cstring_template_spec = {
+    .name = "cstring.Template",
+    .basicsize = sizeof(struct cstring_template),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots = cstring_template_slots,
+};
+
+/* compiled templates for cstring.format, keyed by template */
+#define FORMAT_CACHE_SIZE   256
+
+static PyObject *_cstring_template(PyObject *self) {
+    cstring_state *state = CSTRING_STATE(self);
+    PyObject *t;
+    /* a strong reference: on free-threaded builds another thread may clear the cache */
+#if PY_VERSION_HEX >= 0x030D0000
+    int found = PyDict_GetItemRef(state->format_cache, self, &t);
+    if(found)
+        return found < 0 ? NULL : t;
+#else
+    t = PyDict_GetItemWithError(state->format_cache, self);
+    if(t)
+        return Py_NewRef(t);
+    if(PyErr_Occurred())
+        return NULL;
+#endif
+    t = _template_new(state->template_type, self);
+    if(!t)
+        return NULL;
+    if(PyDict_GET_SIZE(state->format_cache) >= FORMAT_CACHE_SIZE)
+        PyDict_Clear(state->format_cache);
+    if(PyDict_SetItem(state->format_cache, self, t) < 0)
+        Py_CLEAR(t);
+    return t;
+}
+
+PyDoc_STRVAR(format__doc__, "");
+static PyObject *cstring_format(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *t = _cstring_template(self);
+    if(!t)
+        return NULL;
+    PyObject *result = _template_render((struct cstring_template *)t, args, kwargs, NULL);
+    Py_DECREF(t);
+    return result;
+}
+
+PyDoc_STRVAR(format_map__doc__, "");
+static PyObject *cstring_format_map(PyObject *self, PyObject *mapping) {
+    PyObject *t = _cstring_template(self);
+    if(!t)
+        return NULL;
+    PyObject *result = _template_render((struct cstring_template *)t, NULL, NULL, mapping);
+    Py_DECREF(t);
+    return result;
+}
+
+/*
+ * printf-style formatting: cstring % args.
+ *
+ * Each conversion is resolved to a piece as for templates, then the
+ * result is allocated once. Plain %s of cstring/str and plain %d of int
+ * are written directly; conversions with flags, width or precision (and
+ * all float conversions) are rendered by str's own % for that single
+ * specifier, so the output matches str exactly.
+ */
+#define PRINTF_MAX_SPEC     64
+
+/* Next positional argument, following str.__mod__'s conventions. */
+static PyObject *_printf_next_arg(PyObject *args, Py_ssize_t arglen, Py_ssize_t *argidx) {
+    if(arglen < 0) {
+        if(*argidx == -2) {
+            *argidx = -1;
+            return args;
+        }
+    } else if(*argidx < arglen) {
+        return PyTuple_GET_ITEM(args, (*argidx)++);
+    }
+    PyErr_SetString(PyExc_TypeError, "not enough arguments for format string");
+    return NULL;
+}
+
+/*
+ * Parse a '*' or decimal width/precision at *p into *out. Returns 1 if
+ * present, 0 if absent, -1 on error.
+ */
+static int _printf_number(const char **p, const char *end, PyObject *args, Py_ssize_t arglen, Py_ssize_t *argidx, Py_ssize_t *out) {
+    if(*p < end && **p == '*') {
+        ++*p;
+        PyObject *v = _printf_next_arg(args, arglen, argidx);
+        if(!v)
+            return -1;
+        if(!PyLong_Check(v)) {
+            PyErr_SetString(PyExc_TypeError, "* wants int");
+            return -1;
+        }
+        *out = PyLong_AsSsize_t(v);
+        return (*out == -1 && PyErr_Occurred()) ? -1 : 1;
+    }
+    if(*p >= end || !Py_ISDIGIT(**p))
+        return 0;
+    Py_ssize_t n = 0;
+    while(*p < end && Py_ISDIGIT(**p)) {
+        if(n > (PY_SSIZE_T_MAX - 9) / 10) {
+            PyErr_SetString(PyExc_ValueError, "width too big");
+            return -1;
+        }
+        n = n * 10 + (*(*p)++ - '0');
+    }
+    *out = n;
+    return 1;
+}
+
+/* Format `value` with the single specifier `spec` through str % value. */
+static int _printf_piece_slow(cstring_state *state, const char *spec, PyObject *value, struct _fmt_piece *piece) {
+    PyObject *converted = PyObject_TypeCheck(value, state->cstring_type) ? cstring_str(value) : Py_NewRef(value);
+    if(!converted)
+        return -1;
+    PyObject *fmt = PyUnicode_FromString(spec);
+    PyObject *args = fmt ? PyTuple_Pack(1, converted) : NULL;
+    PyObject *formatted = args ? PyUnicode_Format(fmt, args) : NULL;
+    Py_XDECREF(args);
+    Py_XDECREF(fmt);
+    Py_DECREF(converted);
+    if(!formatted)
+        return -1;
+    piece->owner = formatted;
+    piece->s = PyUnicode_AsUTF8AndSize(formatted, &piece->len);
+    return piece->s ? 0 : -1;
+}
+
+static PyObject *cstring_remainder(PyObject *self, PyObject *args) {
+    if(PyType_GetSlot(Py_TYPE(self), Py_nb_remainder) != (void *)cstring_remainder)
+        Py_RETURN_NOTIMPLEMENTED;
+
+    cstring_state *state = CSTRING_STATE(self);
+    const char *s = CSTRING_VALUE(self);
+    const char *end = s + cstring_len(self);
+
+    Py_ssize_t arglen = -1;
+    Py_ssize_t argidx = -2;
+    if(PyTuple_Check(args)) {
+        arglen = PyTuple_GET_SIZE(args);
+        argidx = 0;
+    }
+    PyObject *dict = NULL;
+    if(PyMapping_Check(args) && !PyTuple_Check(args) && !PyUnicode_Check(args))
+        dict = args;
+
+    /* each '%' yields at most one literal and one conversion */
+    Py_ssize_t cap = 1;
+    for(const char *p = s; p < end; ++p)
+        cap += (*p == '%') * 2;
+    struct _fmt_piece *pieces = PyMem_Malloc(cap * sizeof(struct _fmt_piece));
+    if(!pieces)
+        return PyErr_NoMemory();
+
+    PyObject *result = NULL;
+    Py_ssize_t npieces = 0;
+    Py_ssize_t total = 0;
+    const char *lit = s;
+    const char *p = s;
+    while(p < end) {
+        if(*p != '%') {
+            ++p;
+            continue;
+        }
+        if(p > lit) {
+            pieces[npieces++] = (struct _fmt_piece){.s = lit, .len = p - lit};
+            total += p - lit;
+        }
+        ++p;
+
+        PyObject *value = NULL;     /* borrowed, except from dict */
+        PyObject *keyvalue = NULL;
+        if(p < end && *p == '(') {
+            if(!dict) {
+                PyErr_SetString(PyExc_TypeError, "format requires a mapping");
+                goto done;
+            }
+            const char *key = ++p;
+            int depth = 1;
+            while(p < end && depth) {
+                depth += (*p == '(') - (*p == ')');
+                ++p;
+            }
+            if(depth) {
+                PyErr_SetString(PyExc_ValueError, "incomplete format key");
+                goto done;
+            }
+            PyObject *keyobj = PyUnicode_DecodeUTF8(key, p - 1 - key, NULL);
+            if(!keyobj)
+                goto done;
+            keyvalue = PyObject_GetItem(dict, keyobj);
+            Py_DECREF(keyobj);
+            if(!keyvalue)
+                goto done;
+            value = keyvalue;
+            /* as with str, a mapping argument is not consumed positionally */
+            arglen = -1;
+            argidx = -2;
+        }
+
+        char spec[PRINTF_MAX_SPEC];
+        int n = 0;
+        spec[n++] = '%';
+        while(p < end && *p && strchr("-+ #0", *p)) {
+            if(n < 8)
+                spec[n++] = *p;
+            ++p;
+        }
+
+        Py_ssize_t width = -1;
+        Py_ssize_t prec = -1;
+        int rc = _printf_number(&p, end, args, arglen, &argidx, &width);
+        if(rc < 0)
+            goto fail_key;
+        if(rc && width < 0) {
+            /* negative '*' width means left-justify */
+            spec[n++] = '-';
+            width = -width;
+        }
+        if(p < end && *p == '.') {
+            ++p;
+            prec = 0;
+            if(_printf_number(&p, end, args, arglen, &argidx, &prec) < 0)
+                goto fail_key;
+            if(prec < 0)
+                prec = 0;
+        }
+        int flags = n > 1;
+        /* length modifiers are accepted and ignored, as by str */
+        while(p < end && (*p == 'h' || *p == 'l' || *p == 'L'))
+            ++p;
+        if(p >= end) {
+            PyErr_SetString(PyExc_ValueError, "incomplete format");
+            goto fail_key;
+        }
+        char conv = *p++;
+        lit = p;
+
+        if(conv == '%') {
+            pieces[npieces++] = (struct _fmt_piece){.s = "%", .len = 1};
+            total += 1;
+            Py_XDECREF(keyvalue);
+            continue;
+        }
+        if(!conv || !strchr("sradiuoxXeEfFgGc", conv)) {
+            PyErr_Format(PyExc_ValueError, "unsupported format character '%c' (0x%x) at index %zd",
+                isprint((unsigned char)conv) ? conv : '?', (unsigned char)conv, (Py_ssize_t)(p - 1 - s));
+            goto fail_key;
+        }
+        if(!value) {
+            value = _printf_next_arg(args, arglen, &argidx);
+            if(!value)
+                goto done;
+        }
+
+        struct _fmt_piece *piece = &pieces[npieces++];
+        piece->owner = NULL;
+        rc = -1;
+        if(!flags && width < 0 && prec < 0 && conv == 's'
+                && (PyObject_TypeCheck(value, state->cstring_type) || PyUnicode_Check(value))) {
+            if(PyUnicode_Check(value)) {
+                piece->s = PyUnicode_AsUTF8AndSize(value, &piece->len);
+            } else {
+                piece->s = CSTRING_VALUE(value);
+                piece->len = cstring_len(value);
+            }
+            piece->owner = Py_NewRef(value);
+            rc = piece->s ? 0 : -1;
+        } else if(!flags && width < 0 && prec < 0 && (conv == 'd' || conv == 'i' || conv == 'u') && PyLong_CheckExact(value)) {
+            rc = _int_piece(value, 10, piece);
+        } else {
+            /* at most 9 flag bytes, 19 + 21 digit bytes, conversion and NUL */
+            if(width >= 0)
+                n += PyOS_snprintf(spec + n, sizeof(spec) - n, "%zd", width);
+            if(prec >= 0)
+                n += PyOS_snprintf(spec + n, sizeof(spec) - n, ".%zd", prec);
+            spec[n++] = conv;
+            spec[n] = '\0';
+            rc = _printf_piece_slow(state, spec, value, piece);
+        }
+        Py_XDECREF(keyvalue);
+        if(rc < 0)
+            goto done;
+        total += piece->len;
+        continue;
+
+    fail_key:
+        Py_XDECREF(keyvalue);
+        goto done;
+    }
+    if(end > lit) {
+        pieces[npieces++] = (struct _fmt_piece){.s = lit, .len = end - lit};
+        total += end - lit;
+    }
+
+    if(argidx < arglen && !dict) {
+        PyErr_SetString(PyExc_TypeError, "not all arguments converted during string formatting");
+        goto done;
+    }
+
+    if(total == 0) {
+        result = cstring_new_empty(state);
+        goto done;
+    }
+    struct cstring *new = CSTRING_ALLOC(state->cstring_type, total + 1);
+    if(!new)
+        goto done;
+    char *d = new->value;
+    for(Py_ssize_t i = 0; i < npieces; ++i) {
+        memcpy(d, pieces[i].s, pieces[i].len);
+        d += pieces[i].len;
+    }
+    *d = '\0';
+    result = (PyObject *)new;
+
+done:
+    for(Py_ssize_t i = 0; i < npieces; ++i)
+        Py_XDECREF(pieces[i].owner);
+    PyMem_Free(pieces);
+    return result;
+}
+
+/* Bytes owned by self, including the object header. */
+static Py_ssize_t _cstring_sizeof(PyObject *self) {
+    if(((struct cstring *)self)->base)
+        return sizeof(struct cstring);
+    if(CSTRING_MAPPED(self))
+        return sizeof(struct cstring) + HUGEPAGE_MAPPED_SIZE(Py_SIZE(self));
+    return sizeof(struct cstring) + CSTRING_PADDED_SIZE(Py_SIZE(self));
+}
+
+PyDoc_STRVAR(sizeof__doc__, "");
+static PyObject *cstring_sizeof(PyObject *self, PyObject *Py_UNUSED(args)) {
+    return PyLong_FromSsize_t(_cstring_sizeof(self));
+}
+
+/* sketches are defined with the other n-gram functions below */
+static PyObject *cstring_minhash(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *cstring_simhash(PyObject *self, PyObject *args, PyObject *kwargs);
+
+PyDoc_STRVAR(minhash__doc__,
+"minhash(num_perm=128, shingle=5, analyzer='word', seed=0) -> array('I')\n"
+"\n"
+"MinHash signature over shingles of `shingle` words (or characters).");
+PyDoc_STRVAR(simhash__doc__,
+"simhash(shingle=5, analyzer='word', seed=0) -> int\n"
+"\n"
+"64-bit SimHash over shingles of `shingle` words (or characters).");
+
+static PyMethodDef cstring_methods[] = {
+    {"__sizeof__", cstring_sizeof, METH_NOARGS, sizeof__doc__},
+    {"acount", cstring_acount, METH_VARARGS, acount__doc__},
+    {"afind", cstring_afind, METH_VARARGS, afind__doc__},
+    {"arfind", cstring_arfind, METH_VARARGS, arfind__doc__},
+    {"asplit", (PyCFunction)cstring_asplit, METH_VARARGS | METH_KEYWORDS, asplit__doc__},
+    /* TODO: capitalize */
+    /* TODO: casefold */
+    /* TODO: center */
+    {"count", cstring_count, METH_VARARGS, count__doc__},
+    /* TODO: encode (decode???) */
+    {"endswith", cstring_endswith, METH_VARARGS, endswith__doc__},
+    /* TODO: expandtabs */
+    {"find", cstring_find, METH_VARARGS, find__doc__},
+    {"format", (PyCFunction)cstring_format, METH_VARARGS | METH_KEYWORDS, format__doc__},
+    {"from_float", cstring_from_float, METH_O | METH_CLASS, from_float__doc__},
+    {"from_int", (PyCFunction)cstring_from_int, METH_VARARGS | METH_KEYWORDS | METH_CLASS, from_int__doc__},
+    {"format_map", cstring_format_map, METH_O, format_map__doc__},
+    {"index", cstring_index, METH_VARARGS, index__doc__},
+    {"isalnum", cstring_isalnum, METH_NOARGS, isalnum__doc__},
+    {"isalpha", cstring_isalpha, METH_NOARGS, isalpha__doc__},
+    /* TODO: isascii */
+    /* TODO: isdecimal */
+    {"isdigit", cstring_isdigit, METH_NOARGS, isdigit__doc__},
+    /* TODO: isidentifier */
+    {"islower", cstring_islower, METH_NOARGS, islower__doc__},
+    /* TODO: isnumeric */
+    {"isprintable", cstring_isprintable, METH_NOARGS, isprintable__doc__},
+    {"isspace", cstring_isspace, METH_NOARGS, isspace__doc__},
+    /* TODO: istitle */
+    {"isupper", cstring_isupper, METH_NOARGS, isupper__doc__},
+    {"join", cstring_join, METH_O, join__doc__},
+    /* TODO: ljust */
+    {"lower", cstring_lower, METH_NOARGS, lower__doc__},
+    {"lstrip", cstring_lstrip, METH_VARARGS, lstrip__doc__},
+    /* TODO: maketrans */
+    {"minhash", (PyCFunction)cstring_minhash, METH_VARARGS | METH_KEYWORDS, minhash__doc__},
+    {"partition", cstring_partition, METH_O, partition__doc__},
+    /* TODO: removeprefix */
+    /* TODO: replace */
+    {"rfind", cstring_rfind, METH_VARARGS, rfind__doc__},
+    {"rindex", cstring_rindex, METH_VARARGS, rindex__doc__},
+    /* TODO: rjust */
+    {"rpartition", cstring_rpartition, METH_O, rpartition__doc__},
+    /* TODO: rsplit */
+    {"rstrip", cstring_rstrip, METH_VARARGS, rstrip__doc__},
+    {"simhash", (PyCFunction)cstring_simhash, METH_VARARGS | METH_KEYWORDS, simhash__doc__},
+    {"split", (PyCFunction)cstring_split, METH_VARARGS | METH_KEYWORDS, split__doc__},
+    /* TODO: splitlines */
+    {"startswith", cstring_startswith, METH_VARARGS, startswith__doc__},
+    {"strip", cstring_strip, METH_VARARGS, strip__doc__},
+    {"swapcase", cstring_swapcase, METH_NOARGS, swapcase__doc__},
+    /* TODO: title */
+    /* TODO: translate */
+    {"upper", cstring_upper, METH_NOARGS, upper__doc__},
+    /* TODO: zfill */
+    {0},
+};
+
+static PyType_Slot cstring_slots[] = {
+    {Py_tp_doc, ""},
+    {Py_tp_new, cstring_new},
+    {Py_tp_dealloc, cstring_dealloc},
+    {Py_tp_richcompare, cstring_richcompare},
+    {Py_tp_str, cstring_str},
+    {Py_tp_repr, cstring_repr},
+    {Py_tp_hash, cstring_hash},
+    {Py_nb_remainder, cstring_remainder},
+    {Py_sq_length, cstring_len},
+    {Py_sq_concat, cstring_concat},
+    {Py_sq_repeat, cstring_repeat},
+    {Py_sq_item, cstring_item},
+    {Py_sq_contains, cstring_contains},
+    {Py_mp_length, cstring_len},
+    {Py_mp_subscript, cstring_subscript},
+    {Py_tp_methods, cstring_methods},
+    {0},
+};
+
+static PyType_Spec cstring_spec = {
+    .name = "cstring.cstring",
+    .basicsize = sizeof(struct cstring),
+    .itemsize = sizeof(char),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots = cstring_slots,
+};
+
+/*
+ * cstringarray: a columnar container of C-strings.
+ *
+ * All elements live back-to-back in a single data buffer, each followed by
+ * its terminating zero-byte. Element i starts at offsets[i] and
+ * offsets[i + 1] - offsets[i] is its size *including* the terminator.
+ */
+
+struct cstringarray {
+    PyObject_HEAD
+    Py_ssize_t count;
+    Py_ssize_t *offsets;
+    char *data;
+};
+
+#define CSTRINGARRAY_COUNT(self)        (((struct cstringarray *)self)->count)
+#define CSTRINGARRAY_OFFSETS(self)      (((struct cstringarray *)self)->offsets)
+#define CSTRINGARRAY_DATA(self)         (((struct cstringarray *)self)->data)
+#define CSTRINGARRAY_DATASIZE(self)     (CSTRINGARRAY_OFFSETS(self)[CSTRINGARRAY_COUNT(self)])
+#define CSTRINGARRAY_VALUE(self, i)     (&CSTRINGARRAY_DATA(self)[CSTRINGARRAY_OFFSETS(self)[(i)]])
+#define CSTRINGARRAY_SIZE(self, i)      (CSTRINGARRAY_OFFSETS(self)[(i) + 1] - CSTRINGARRAY_OFFSETS(self)[(i)])
+#define CSTRINGARRAY_LEN(self, i)       (CSTRINGARRAY_SIZE(self, i) - 1)
+
+static struct cstringarray *_cstringarray_alloc(PyTypeObject *type, Py_ssize_t count, Py_ssize_t datasize) {
+    struct cstringarray *new = (struct cstringarray *)type->tp_alloc(type, 0);
+    if(!new)
+        return NULL;
+    new->count = count;
+    new->offsets = PyMem_Malloc((count + 1) * sizeof(Py_ssize_t));
+    new->data = PyMem_Malloc(datasize ? datasize : 1);
+    if(!new->offsets || !new->data) {
+        Py_DECREF(new);
+        return (struct cstringarray *)PyErr_NoMemory();
+    }
+    new->offsets[0] = 0;
+    return new;
+}
+
+static void cstringarray_dealloc(PyObject *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    PyMem_Free(CSTRINGARRAY_OFFSETS(self));
+    PyMem_Free(CSTRINGARRAY_DATA(self));
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+static PyObject *_cstringarray_from_iterable(PyTypeObject *type, PyObject *iterable) {
+    cstring_state *state = _state_from_type(type);
+    PyObject *seq = PySequence_Fast(iterable, "cstringarray argument must be iterable");
+    if(!seq)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+
+    /* first pass: compute buffer size */
+    Py_ssize_t datasize = 0;
+    for(Py_ssize_t i = 0; i < count; ++i) {
+        Py_ssize_t len;
+        if(!_obj_as_string_and_size(state, items[i], &len))
+            goto fail;
+        datasize += len + 1;
+    }
+
+    struct cstringarray *new = _cstringarray_alloc(type, count, datasize);
+    if(!new)
+        goto fail;
+
+    /* second pass: copy */
+    char *d = new->data;
+    for(Py_ssize_t i = 0; i < count; ++i) {
+        Py_ssize_t len;
+        const char *s = _obj_as_string_and_size(state, items[i], &len);
+        memcpy(d, s, len);
+        d[len] = '\0';
+        d += len + 1;
+        new->offsets[i + 1] = d - new->data;
+    }
+
+    Py_DECREF(seq);
+    return (PyObject *)new;
+
+fail:
+    Py_DECREF(seq);
+    return NULL;
+}
+
+/* New reference to `o` as a cstringarray, copying if it is any other iterable. */
+static PyObject *_as_cstringarray(cstring_state *state, PyObject *o) {
+    if(PyObject_TypeCheck(o, state->cstringarray_type)) {
+        Py_INCREF(o);
+        return o;
+    }
+    return _cstringarray_from_iterable(state->cstringarray_type, o);
+}
+
+static PyObject *cstringarray_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    PyObject *argobj = NULL;
+    if(!PyArg_ParseTuple(args, "|O", &argobj))
+        return NULL;
+
+    if(!argobj)
+        return (PyObject *)_cstringarray_alloc(type, 0, 0);
+
+    return _cstringarray_from_iterable(type, argobj);
+}
+
+static Py_ssize_t cstringarray_len(PyObject *self) {
+    return CSTRINGARRAY_COUNT(self);
+}
+
+static PyObject *cstringarray_item(PyObject *self, Py_ssize_t i) {
+    if(i < 0 || i >= CSTRINGARRAY_COUNT(self)) {
+        PyErr_SetString(PyExc_IndexError, "Index is out of bounds");
+        return NULL;
+    }
+    return _cstring_new(CSTRING_STATE(self)->cstring_type, CSTRINGARRAY_VALUE(self, i), CSTRINGARRAY_LEN(self, i));
+}
+
+static PyObject *cstringarray_subscript(PyObject *self, PyObject *key) {
+    if(!PyIndex_Check(key)) {
+        PyErr_SetString(PyExc_TypeError, "Subscript must be int.");
+        return NULL;
+    }
+    Py_ssize_t i = PyNumber_AsSsize_t(key, PyExc_IndexError);
+    if(i == -1 && PyErr_Occurred())
+        return NULL;
+    if(i < 0)
+        i += CSTRINGARRAY_COUNT(self);
+    return cstringarray_item(self, i);
+}
+
+static PyObject *cstringarray_repr(PyObject *self) {
+    PyObject *list = PySequence_List(self);
+    if(!list)
+        return NULL;
+    PyObject *repr = PyUnicode_FromFormat("%s(%R)", Py_TYPE(self)->tp_name, list);
+    Py_DECREF(list);
+    return repr;
+}
+
+static PyObject *cstringarray_richcompare(PyObject *self, PyObject *other, int op) {
+    if(!PyObject_TypeCheck(other, CSTRING_STATE(self)->cstringarray_type) || (op != Py_EQ && op != Py_NE))
+        Py_RETURN_NOTIMPLEMENTED;
+
+    int eq = CSTRINGARRAY_COUNT(self) == CSTRINGARRAY_COUNT(other)
+        && memcmp(CSTRINGARRAY_OFFSETS(self), CSTRINGARRAY_OFFSETS(other),
+                  (CSTRINGARRAY_COUNT(self) + 1) * sizeof(Py_ssize_t)) == 0
+        && memcmp(CSTRINGARRAY_DATA(self), CSTRINGARRAY_DATA(other), CSTRINGARRAY_DATASIZE(self)) == 0;
+
+    return PyBool_FromLong(op == Py_EQ ? eq : !eq);
+}
+
+/* Read element i of an integer buffer with struct-module format `fmt`. */
+static int _buffer_index_at(const Py_buffer *view, Py_ssize_t i, Py_ssize_t *out) {
+    const char *p = (const char *)view->buf + i * view->itemsize;
+    const char *fmt = view->format ? view->format : "B";
+    unsigned long long u;
+    if(*fmt == '@' || *fmt == '=')
+        ++fmt;
+
+    switch(*fmt) {
+    case 'b': *out = *(const signed char *)p; return 0;
+    case 'B': *out = *(const unsigned char *)p; return 0;
+    case 'h': *out = *(const short *)p; return 0;
+    case 'H': *out = *(const unsigned short *)p; return 0;
+    case 'i': *out = *(const int *)p; return 0;
+    case 'I': *out = *(const unsigned int *)p; return 0;
+    case 'l': *out = *(const long *)p; return 0;
+    case 'L': u = *(const unsigned long *)p; break;
+    case 'q': *out = (Py_ssize_t)*(const long long *)p; return 0;
+    case 'Q': u = *(const unsigned long long *)p; break;
+    case 'n': *out = *(const Py_ssize_t *)p; return 0;
+    case 'N': u = *(const size_t *)p; break;
+    default:
+        PyErr_Format(PyExc_TypeError, "Unsupported index buffer format: %s", view->format);
+        return -1;
+    }
+
+    /* unsigned formats: values above PY_SSIZE_T_MAX must not wrap to negative indexes */
+    if(u > (unsigned long long)PY_SSIZE_T_MAX) {
+        PyErr_Format(PyExc_IndexError, "cannot fit %llu into an index-sized integer", u);
+        return -1;
+    }
+    *out = (Py_ssize_t)u;
+    return 0;
+}
+
+/*
+ * Convert an integer buffer or a sequence of ints into a PyMem-allocated
+ * array of indexes, adjusted and bounds-checked against `len`.
+ */
+static Py_ssize_t *_obj_as_indexes(PyObject *o, Py_ssize_t len, Py_ssize_t *count) {
+    Py_ssize_t *result = NULL;
+
+    if(PyObject_CheckBuffer(o)) {
+        Py_buffer view;
+        if(PyObject_GetBuffer(o, &view, PyBUF_FORMAT | PyBUF_ND) < 0)
+            return NULL;
+        *count = view.len / (view.itemsize ? view.itemsize : 1);
+        result = PyMem_Malloc((*count ? *count : 1) * sizeof(Py_ssize_t));
+        if(!result) {
+            PyBuffer_Release(&view);
+            return (Py_ssize_t *)PyErr_NoMemory();
+        }
+        for(Py_ssize_t i = 0; i < *count; ++i) {
+            if(_buffer_index_at(&view, i, &result[i]) < 0) {
+                PyBuffer_Release(&view);
+                goto fail;
+            }
+        }
+        PyBuffer_Release(&view);
+    } else {
+        PyObject *seq = PySequence_Fast(o, "indices must be a sequence of ints");
+        if(!seq)
+            return NULL;
+        *count = PySequence_Fast_GET_SIZE(seq);
+        result = PyMem_Malloc((*count ? *count : 1) * sizeof(Py_ssize_t));
+        if(!result) {
+            Py_DECREF(seq);
+            return (Py_ssize_t *)PyErr_NoMemory();
+        }
+        for(Py_ssize_t i = 0; i < *count; ++i) {
+            result[i] = PyNumber_AsSsize_t(PySequence_Fast_GET_ITEM(seq, i), PyExc_IndexError);
+            if(result[i] == -1 && PyErr_Occurred()) {
+                Py_DECREF(seq);
+                goto fail;
+            }
+        }
+        Py_DECREF(seq);
+    }
+
+    for(Py_ssize_t i = 0; i < *count; ++i) {
+        if(result[i] < 0)
+            result[i] += len;
+        if(result[i] < 0 || result[i] >= len) {
+            PyErr_SetString(PyExc_IndexError, "Index is out of bounds");
+            goto fail;
+        }
+    }
+    return result;
+
+fail:
+    PyMem_Free(result);
+    return NULL;
+}
+
+/* Gather elements `indexes` of `self` into a new contiguous array. */
+static PyObject *_cstringarray_gather(PyObject *self, const Py_ssize_t *indexes, Py_ssize_t count) {
+    /* first pass: compute buffer size */
+    Py_ssize_t datasize = 0;
+    for(Py_ssize_t i = 0; i < count; ++i)
+        datasize += CSTRINGARRAY_SIZE(self, indexes[i]);
+
+    struct cstringarray *new = _cstringarray_alloc(Py_TYPE(self), count, datasize);
+    if(!new)
+        return NULL;
+
+    /* second pass: copy byte ranges */
+    Py_ssize_t offset = 0;
+    for(Py_ssize_t i = 0; i < count; ++i) {
+        Py_ssize_t size = CSTRINGARRAY_SIZE(self, indexes[i]);
+        memcpy(&new->data[offset], CSTRINGARRAY_VALUE(self, indexes[i]), size);
+        offset += size;
+        new->offsets[i + 1] = offset;
+    }
+
+    return (PyObject *)new;
+}
+
+PyDoc_STRVAR(take__doc__, "");
+PyObject *cstringarray_take(PyObject *self, PyObject *arg) {
+    Py_ssize_t count;
+    Py_ssize_t *indexes = _obj_as_indexes(arg, CSTRINGARRAY_COUNT(self), &count);
+    if(!indexes)
+        return NULL;
+    PyObject *result = _cstringarray_gather(self, indexes, count);
+    PyMem_Free(indexes);
+    return result;
+}
+
+/*
+ * Convert a mask (bytes-like of zero/non-zero bytes, or a sequence of
+ * truthy values) of length `len` into a PyMem-allocated array of bytes.
+ */
+static char *_obj_as_mask(PyObject *o, Py_ssize_t len) {
+    char *result = PyMem_Malloc(len ? len : 1);
+    if(!result)
+        return (char *)PyErr_NoMemory();
+
+    if(PyObject_CheckBuffer(o)) {
+        Py_buffer view;
+        if(PyObject_GetBuffer(o, &view, PyBUF_SIMPLE) < 0)
+            goto fail;
+        if(view.len != len) {
+            PyBuffer_Release(&view);
+            goto bad_length;
+        }
+        memcpy(result, view.buf, len);
+        PyBuffer_Release(&view);
+        return result;
+    }
+
+    PyObject *seq = PySequence_Fast(o, "mask must be a bytes-like object or a sequence");
+    if(!seq)
+        goto fail;
+    if(PySequence_Fast_GET_SIZE(seq) != len) {
+        Py_DECREF(seq);
+        goto bad_length;
+    }
+    for(Py_ssize_t i = 0; i < len; ++i) {
+        int truth = PyObject_IsTrue(PySequence_Fast_GET_ITEM(seq, i));
+        if(truth < 0) {
+            Py_DECREF(seq);
+            goto fail;
+        }
+        result[i] = truth;
+    }
+    Py_DECREF(seq);
+    return result;
+
+bad_length:
+    PyErr_SetString(PyExc_ValueError, "mask length does not match array length");
+fail:
+    PyMem_Free(result);
+    return NULL;
+}
+
+PyDoc_STRVAR(filter__doc__, "");
+PyObject *cstringarray_filter(PyObject *self, PyObject *arg) {
+    char *mask = _obj_as_mask(arg, CSTRINGARRAY_COUNT(self));
+    if(!mask)
+        return NULL;
+
+    /* first pass: compute output count and buffer size */
+    Py_ssize_t count = 0;
+    Py_ssize_t datasize = 0;
+    for(Py_ssize_t i = 0; i < CSTRINGARRAY_COUNT(self); ++i) {
+        if(mask[i]) {
+            ++count;
+            datasize += CSTRINGARRAY_SIZE(self, i);
+        }
+    }
+
+    struct cstringarray *new = _cstringarray_alloc(Py_TYPE(self), count, datasize);
+    if(!new)
+        goto done;
+
+    /* second pass: copy byte ranges */
+    Py_ssize_t j = 0;
+    Py_ssize_t offset = 0;
+    for(Py_ssize_t i = 0; i < CSTRINGARRAY_COUNT(self); ++i) {
+        if(!mask[i])
+            continue;
+        Py_ssize_t size = CSTRINGARRAY_SIZE(self, i);
+        memcpy(&new->data[offset], CSTRINGARRAY_VALUE(self, i), size);
+        offset += size;
+        new->offsets[++j] = offset;
+    }
+
+done:
+    PyMem_Free(mask);
+    return (PyObject *)new;
+}
+
+/*
+ * Truth value of calling method `name` on `self` with `args`, e.g.
+ * `cstring('abc').startswith('a')`. Returns -1 on error.
+ */
+static int _cstring_method_truth(PyObject *self, PyObject *name, PyObject *args) {
+    PyObject *meth = PyObject_GetAttr(self, name);
+    if(!meth)
+        return -1;
+    PyObject *result = PyObject_Call(meth, args, NULL);
+    Py_DECREF(meth);
+    if(!result)
+        return -1;
+    int truth = PyObject_IsTrue(result);
+    Py_DECREF(result);
+    return truth;
+}
+
+/* Methods that mask evaluates on the array's data, without creating elements. */
+enum {
+    TRUTH_PREDICATE,    /* is*(), no arguments */
+    TRUTH_STARTSWITH,   /* the others take one substring */
+    TRUTH_ENDSWITH,
+    TRUTH_FIND,         /* find() != 0 */
+    TRUTH_COUNT,        /* count() != 0 */
+};
+
+static const struct {
+    const char *name;
+    int kind;
+    int (*predicate)(const char *s, Py_ssize_t len);
+} _native_truths[] = {
+    {"count", TRUTH_COUNT},
+    {"endswith", TRUTH_ENDSWITH},
+    {"find", TRUTH_FIND},
+    {"isalnum", TRUTH_PREDICATE, _kernel_isalnum},
+    {"isalpha", TRUTH_PREDICATE, _kernel_isalpha},
+    {"isdigit", TRUTH_PREDICATE, _kernel_isdigit},
+    {"islower", TRUTH_PREDICATE, _kernel_islower},
+    {"isprintable", TRUTH_PREDICATE, _kernel_isprintable},
+    {"isspace", TRUTH_PREDICATE, _kernel_isspace},
+    {"isupper", TRUTH_PREDICATE, _kernel_isupper},
+    {"startswith", TRUTH_STARTSWITH},
+};
+
+/*
+ * Evaluate `name(*methargs)` natively over the offsets/data of `self` if
+ * it is one of _native_truths with a plain argument list (no start/end,
+ * no tuple of prefixes). Returns 1 if done, 0 to fall back to calling the
+ * method, -1 on error.
+ */
+static int _cstringarray_native_truths(PyObject *self, PyObject *name, PyObject *methargs, unsigned char *out) {
+    const char *cname = PyUnicode_Check(name) ? PyUnicode_AsUTF8(name) : NULL;
+    if(!cname) {
+        PyErr_Clear();
+        return 0;
+    }
+    size_t n = sizeof(_native_truths) / sizeof(_native_truths[0]);
+    size_t t = 0;
+    while(t < n && strcmp(_native_truths[t].name, cname) != 0)
+        ++t;
+    if(t == n)
+        return 0;
+
+    int kind = _native_truths[t].kind;
+    const char *sub = NULL;
+    Py_ssize_t sublen = 0;
+    if(kind == TRUTH_PREDICATE) {
+        if(PyTuple_GET_SIZE(methargs) != 0)
+            return 0;
+    } else {
+        if(PyTuple_GET_SIZE(methargs) != 1)
+            return 0;
+        PyObject *subobj = PyTuple_GET_ITEM(methargs, 0);
+        if(!PyUnicode_Check(subobj) && !PyBytes_Check(subobj) && !PyObject_TypeCheck(subobj, CSTRING_STATE(self)->cstring_type))
+            return 0;
+        sub = _obj_as_string_and_size(CSTRING_STATE(self), subobj, &sublen);
+        if(!sub)
+            return -1;
+    }
+
+    for(Py_ssize_t i = 0; i < CSTRINGARRAY_COUNT(self); ++i) {
+        const char *s = CSTRINGARRAY_VALUE(self, i);
+        Py_ssize_t len = CSTRINGARRAY_LEN(self, i);
+        switch(kind) {
+        case TRUTH_PREDICATE:
+            out[i] = _native_truths[t].predicate(s, len);
+            break;
+        case TRUTH_STARTSWITH:
+            out[i] = len >= sublen && memcmp(s, sub, sublen) == 0;
+            break;
+        case TRUTH_ENDSWITH:
+            out[i] = len >= sublen && memcmp(s + len - sublen, sub, sublen) == 0;
+            break;
+        case TRUTH_FIND:
+            out[i] = _kernel_find(s, len, sub, sublen) != 0;
+            break;
+        case TRUTH_COUNT:
+            out[i] = sublen == 0 || _kernel_find(s, len, sub, sublen) >= 0;
+            break;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Evaluate cstring method `args[0]` with arguments `args[1:]` on each
+ * element of `self`, storing truth values in `out`. Supported methods run
+ * natively on the array's data; any other call (or argument form) falls
+ * back to calling the method on each element.
+ */
+static int _cstringarray_method_truths(PyObject *self, PyObject *args, unsigned char *out) {
+    Py_ssize_t nargs = PyTuple_GET_SIZE(args);
+    if(nargs < 1) {
+        PyErr_SetString(PyExc_TypeError, "method name required");
+        return -1;
+    }
+    PyObject *name = PyTuple_GET_ITEM(args, 0);
+    PyObject *methargs = PyTuple_GetSlice(args, 1, nargs);
+    if(!methargs)
+        return -1;
+
+    int rc = _cstringarray_native_truths(self, name, methargs, out);
+    if(rc != 0)
+        goto done;
+
+    /* generic fallback: call the method on each element */
+    for(Py_ssize_t i = 0; i < CSTRINGARRAY_COUNT(self); ++i) {
+        PyObject *item = cstringarray_item(self, i);
+        if(!item)
+            goto fail;
+        int truth = _cstring_method_truth(item, name, methargs);
+        Py_DECREF(item);
+        if(truth < 0)
+            goto fail;
+        out[i] = truth;
+    }
+    goto done;
+
+fail:
+    rc = -1;
+done:
+    Py_DECREF(methargs);
+    return rc < 0 ? -1 : 0;
+}
+
+PyDoc_STRVAR(mask__doc__, "");
+PyObject *cstringarray_mask(PyObject *self, PyObject *args) {
+    unsigned char *mask;
+    PyObject *result = _array_new("B", CSTRINGARRAY_COUNT(self), (void **)&mask);
+    if(!result)
+        return NULL;
+    if(_cstringarray_method_truths(self, args, mask) < 0)
+        Py_CLEAR(result);
+    return result;
+}
+
+/*
+ * Batch number formatting. `values` may be a numeric buffer (formatted
+ * without creating Python objects) or a sequence of numbers.
+ */
+static PyObject *_cstringarray_from_numbers(PyTypeObject *type, PyObject *values, int base, int is_float) {
+    Py_buffer view = {0};
+    PyObject *seq = NULL;
+    Py_ssize_t count;
+    char fmt = 0;
+
+    if(PyObject_CheckBuffer(values)) {
+        if(PyObject_GetBuffer(values, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0)
+            return NULL;
+        const char *f = view.format ? view.format : "B";
+        if(*f == '@' || *f == '=')
+            ++f;
+        fmt = f[0] && !f[1] && strchr("bBhHiIlLqQnNfd", f[0]) ? f[0] : 0;
+        if(!fmt || (!is_float && (fmt == 'f' || fmt == 'd'))) {
+            PyErr_Format(PyExc_TypeError, "Unsupported number buffer format: %s", view.format);
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+        count = view.len / view.itemsize;
+    } else {
+        seq = PySequence_Fast(values, "values must be a numeric buffer or a sequence");
+        if(!seq)
+            return NULL;
+        count = PySequence_Fast_GET_SIZE(seq);
+    }
+
+    /* room for every element written in place; big ints grow the buffer */
+    Py_ssize_t capacity = count * (is_float ? 26 : (base < 10 ? 66 : 22)) + 1;
+    struct cstringarray *new = _cstringarray_alloc(type, count, capacity);
+    if(!new)
+        goto fail;
+
+    Py_ssize_t pos = 0;
+    for(Py_ssize_t i = 0; i < count; ++i) {
+        struct _fmt_piece piece = {.owner = NULL};
+        int rc;
+        if(seq) {
+            PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+            if(is_float) {
+                double x = PyFloat_AsDouble(item);
+                rc = (x == -1.0 && PyErr_Occurred()) ? -1 : _float_piece(x, &piece);
+            } else {
+                PyObject *index = PyNumber_Index(item);
+                rc = index ? _int_piece(index, base, &piece) : -1;
+                Py_XDECREF(index);
+            }
+        } else {
+            const char *p = (const char *)view.buf + i * view.itemsize;
+            int is_signed = fmt == 'b' || fmt == 'h' || fmt == 'i' || fmt == 'l' || fmt == 'q' || fmt == 'n';
+            long long sv = 0;
+            unsigned long long uv = 0;
+            double dv = 0;
+            switch(fmt) {
+            case 'b': sv = *(const signed char *)p; break;
+            case 'B': uv = *(const unsigned char *)p; break;
+            case 'h': sv = *(const short *)p; break;
+            case 'H': uv = *(const unsigned short *)p; break;
+            case 'i': sv = *(const int *)p; break;
+            case 'I': uv = *(const unsigned int *)p; break;
+            case 'l': sv = *(const long *)p; break;
+            case 'L': uv = *(const unsigned long *)p; break;
+            case 'q': sv = *(const long long *)p; break;
+            case 'Q': uv = *(const unsigned long long *)p; break;
+            case 'n': sv = *(const Py_ssize_t *)p; break;
+            case 'N': uv = *(const size_t *)p; break;
+            case 'f': dv = *(const float *)p; break;
+            case 'd': dv = *(const double *)p; break;
+            }
+            if(is_float) {
+                if(fmt != 'f' && fmt != 'd')
+                    dv = is_signed ? (double)sv : (double)uv;
+                rc = _float_piece(dv, &piece);
+            } else {
+                char *end = piece.buf + sizeof(piece.buf);
+                char *d = _write_digits(end, is_signed && sv < 0 ? 0ULL - (unsigned long long)sv : is_signed ? (unsigned long long)sv : uv, base);
+                if(is_signed && sv < 0)
+                    *--d = '-';
+                piece.s = d;
+                piece.len = end - d;
+                rc = 0;
+            }
+        }
+        if(rc < 0) {
+            Py_XDECREF(piece.owner);
+            goto fail;
+        }
+
+        if(pos + piece.len + 1 > capacity) {
+            Py_ssize_t grown = Py_MAX(capacity * 2, pos + piece.len + 1);
+            char *data = PyMem_Realloc(new->data, grown);
+            if(!data) {
+                Py_XDECREF(piece.owner);
+                PyErr_NoMemory();
+                goto fail;
+            }
+            new->data = data;
+            capacity = grown;
+        }
+        memcpy(new->data + pos, piece.s, piece.len);
+        pos += piece.len;
+        new->data[pos++] = '\0';
+        new->offsets[i + 1] = pos;
+        Py_XDECREF(piece.owner);
+    }
+
+    /* give back the unused estimate */
+    char *data = PyMem_Realloc(new->data, pos ? pos : 1);
+    if(data)
+        new->data = data;
+
+    if(seq)
+        Py_DECREF(seq);
+    else
+        PyBuffer_Release(&view);
+    return (PyObject *)new;
+
+fail:
+    Py_XDECREF(new);
+    if(seq)
+        Py_DECREF(seq);
+    else
+        PyBuffer_Release(&view);
+    return NULL;
+}
+
+PyDoc_STRVAR(from_ints__doc__,
+"from_ints(values, base=10) -> cstringarray\n"
+"\n"
+"cstring.from_int applied to each element of an integer buffer or a\n"
+"sequence of ints.");
+static PyObject *cstringarray_from_ints(PyObject *cls, PyObject *args, PyObject *kwargs) {
+    PyObject *values;
+    int base = 10;
+    char *kwlist[] = {"", "base", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", kwlist, &values, &base))
+        return NULL;
+    if(_check_base(base) < 0)
+        return NULL;
+    return _cstringarray_from_numbers((PyTypeObject *)cls, values, base, 0);
+}
+
+PyDoc_STRVAR(from_floats__doc__,
+"from_floats(values) -> cstringarray\n"
+"\n"
+"cstring.from_float applied to each element of a numeric buffer or a\n"
+"sequence of numbers.");
+static PyObject *cstringarray_from_floats(PyObject *cls, PyObject *values) {
+    return _cstringarray_from_numbers((PyTypeObject *)cls, values, 10, 1);
+}
+
+PyDoc_STRVAR(cstringarray_sizeof__doc__, "");
+static PyObject *cstringarray_sizeof(PyObject *self, PyObject *Py_UNUSED(args)) {
+    Py_ssize_t count = CSTRINGARRAY_COUNT(self);
+    return PyLong_FromSsize_t(Py_TYPE(self)->tp_basicsize
+        + (count + 1) * sizeof(Py_ssize_t)
+        + CSTRINGARRAY_DATASIZE(self));
+}
+
+/* defined with the cstring sketches below */
+static PyObject *cstringarray_minhash(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *cstringarray_simhash(PyObject *self, PyObject *args, PyObject *kwargs);
+
+PyDoc_STRVAR(cstringarray_minhash__doc__,
+"minhash(num_perm=128, shingle=5, analyzer='word', seed=0, threads=0) -> array('I')\n"
+"\n"
+"MinHash signatures of all elements as a row-major len(self) x num_perm matrix.");
+PyDoc_STRVAR(cstringarray_simhash__doc__,
+"simhash(shingle=5, analyzer='word', seed=0, threads=0) -> array('Q')\n"
+"\n"
+"SimHash of each element.");
+
+static PyMethodDef cstringarray_methods[] = {
+    {"__sizeof__", cstringarray_sizeof, METH_NOARGS, cstringarray_sizeof__doc__},
+    {"filter", cstringarray_filter, METH_O, filter__doc__},
+    {"from_floats", cstringarray_from_floats, METH_O | METH_CLASS, from_floats__doc__},
+    {"from_ints", (PyCFunction)cstringarray_from_ints, METH_VARARGS | METH_KEYWORDS | METH_CLASS, from_ints__doc__},
+    {"mask", cstringarray_mask, METH_VARARGS, mask__doc__},
+    {"minhash", (PyCFunction)cstringarray_minhash, METH_VARARGS | METH_KEYWORDS, cstringarray_minhash__doc__},
+    {"simhash", (PyCFunction)cstringarray_simhash, METH_VARARGS | METH_KEYWORDS, cstringarray_simhash__doc__},
+    {"take", cstringarray_take, METH_O, take__doc__},
+    {0},
+};
+
+static PyType_Slot cstringarray_slots[] = {
+    {Py_tp_doc, ""},
+    {Py_tp_new, cstringarray_new},
+    {Py_tp_dealloc, cstringarray_dealloc},
+    {Py_tp_richcompare, cstringarray_richcompare},
+    {Py_tp_repr, cstringarray_repr},
+    {Py_sq_length, cstringarray_len},
+    {Py_sq_item, cstringarray_item},
+    {Py_mp_length, cstringarray_len},
+    {Py_mp_subscript, cstringarray_subscript},
+    {Py_tp_methods, cstringarray_methods},
+    {0},
+};
+
+static PyType_Spec cstringarray_spec = {
+    .name = "cstring.cstringarray",
+    .basicsize = sizeof(struct cstringarray),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots = cstringarray_slots,
+};
+
+PyDoc_STRVAR(concat_columns__doc__, "");
+PyObject *cstring_concat_columns(PyObject *module, PyObject *args, PyObject *kwargs) {
+    PyObject *columnsobj;
+    PyObject *sepobj = NULL;
+    int with_hash = 0;
+    char *kwlist[] = {"columns", "sep", "hash", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Op", kwlist, &columnsobj, &sepobj, &with_hash))
+        return NULL;
+
+    cstring_state *state = PyModule_GetState(module);
+    Py_ssize_t seplen = 0;
+    const char *sep = "";
+    if(sepobj && sepobj != Py_None) {
+        sep = _obj_as_string_and_size(state, sepobj, &seplen);
+        if(!sep)
+            return NULL;
+    }
+
+    PyObject *columns = PySequence_List(columnsobj);
+    if(!columns)
+        return NULL;
+
+    PyObject *result = NULL;
+    PyObject *hashes = NULL;
+    Py_ssize_t ncols = PyList_GET_SIZE(columns);
+    Py_ssize_t nrows = 0;
+
+    for(Py_ssize_t c = 0; c < ncols; ++c) {
+        PyObject *col = _as_cstringarray(state, PyList_GET_ITEM(columns, c));
+        if(!col)
+            goto done;
+        if(PyList_SetItem(columns, c, col) < 0)
+            goto done;
+    }
+    if(ncols > 0)
+        nrows = CSTRINGARRAY_COUNT(PyList_GET_ITEM(columns, 0));
+    for(Py_ssize_t c = 1; c < ncols; ++c) {
+        if(CSTRINGARRAY_COUNT(PyList_GET_ITEM(columns, c)) != nrows) {
+            PyErr_SetString(PyExc_ValueError, "columns must have equal length");
+            goto done;
+        }
+    }
+
+    /* first pass: row sizes, then prefix sum into offsets */
+    Py_ssize_t rowsep = ncols > 1 ? seplen * (ncols - 1) : 0;
+    Py_ssize_t datasize = 0;
+    for(Py_ssize_t c = 0; c < ncols; ++c)
+        datasize += CSTRINGARRAY_DATASIZE(PyList_GET_ITEM(columns, c)) - nrows;
+    datasize += (rowsep + 1) * nrows;
+
+    struct cstringarray *new = _cstringarray_alloc(state->cstringarray_type, nrows, datasize);
+    if(!new)
+        goto done;
+    result = (PyObject *)new;
+
+    for(Py_ssize_t r = 0; r < nrows; ++r) {
+        Py_ssize_t size = rowsep + 1;
+        for(Py_ssize_t c = 0; c < ncols; ++c)
+            size += CSTRINGARRAY_LEN(PyList_GET_ITEM(columns, c), r);
+        new->offsets[r + 1] = new->offsets[r] + size;
+    }
+
+    Py_hash_t *hashdata = NULL;
+    if(with_hash) {
+        hashes = _array_new("q", nrows, (void **)&hashdata);
+        if(!hashes)
+            goto fail;
+    }
+
+    /* second pass: fill the data buffer */
+    for(Py_ssize_t r = 0; r < nrows; ++r) {
+        char *row = &new->data[new->offsets[r]];
+        char *d = row;
+        for(Py_ssize_t c = 0; c < ncols; ++c) {
+            PyObject *col = PyList_GET_ITEM(columns, c);
+            if(c > 0) {
+                memcpy(d, sep, seplen);
+                d += seplen;
+            }
+            memcpy(d, CSTRINGARRAY_VALUE(col, r), CSTRINGARRAY_LEN(col, r));
+            d += CSTRINGARRAY_LEN(col, r);
+        }
+        *d = '\0';
+        if(hashdata) {
+            /* same value as hash(cstring(row)) */
+            hashdata[r] = _Py_HashBytes(row, d - row + 1);
+        }
+    }
+
+    if(with_hash) {
+        result = _tuple_steal_refs(2, result, hashes);
+        hashes = NULL;
+    }
+    goto done;
+
+fail:
+    Py_CLEAR(result);
+done:
+    Py_XDECREF(hashes);
+    Py_DECREF(columns);
+    return result;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define _PREFETCH(p)    __builtin_prefetch((p))
+#else
+#define _PREFETCH(p)    ((void)(p))
+#endif
+
+/* MurmurHash64A (Austin Appleby, public domain). */
+static uint64_t _fast_hash(const char *s, Py_ssize_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ ((uint64_t)len * m);
+
+    const char *end = s + (len & ~(Py_ssize_t)7);
+    for(; s < end; s += 8) {
+        uint64_t k;
+        memcpy(&k, s, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch(len & 7) {
+    case 7: h ^= (uint64_t)(unsigned char)s[6] << 48; /* fall through */
+    case 6: h ^= (uint64_t)(unsigned char)s[5] << 40; /* fall through */
+    case 5: h ^= (uint64_t)(unsigned char)s[4] << 32; /* fall through */
+    case 4: h ^= (uint64_t)(unsigned char)s[3] << 24; /* fall through */
+    case 3: h ^= (uint64_t)(unsigned char)s[2] << 16; /* fall through */
+    case 2: h ^= (uint64_t)(unsigned char)s[1] << 8; /* fall through */
+    case 1: h ^= (uint64_t)(unsigned char)s[0];
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+/*
+ * Seed for hash tables over untrusted keys, drawn from os.urandom when
+ * the module is first executed so colliding keys cannot be precomputed.
+ * Each table copies it, so a later re-seed cannot affect a table in use.
+ */
+static uint64_t _hash_seed;
+
+static int _hash_seed_init(void) {
+    if(_ATOMIC_LOAD(&_hash_seed))
+        return 0;
+    PyObject *os = PyImport_ImportModule("os");
+    if(!os)
+        return -1;
+    PyObject *bytes = PyObject_CallMethod(os, "urandom", "i", (int)sizeof(uint64_t));
+    Py_DECREF(os);
+    if(!bytes)
+        return -1;
+    uint64_t seed = 0;
+    if(PyBytes_Check(bytes) && PyBytes_GET_SIZE(bytes) == sizeof(seed))
+        memcpy(&seed, PyBytes_AS_STRING(bytes), sizeof(seed));
+    Py_DECREF(bytes);
+    _ATOMIC_CAS(&_hash_seed, 0, seed | 1);   /* another interpreter may have won */
+    return 0;
+}
+
+/*
+ * Open-addressing hash table of byte strings.
+ *
+ * The table does not own any keys: each slot holds an index into a
+ * cstringarray (`src`) which must outlive the table.
+ */
+struct _bytes_table {
+    PyObject *src;
+    uint64_t seed;
+    Py_ssize_t mask;
+    Py_ssize_t *slots;      /* -1 when empty */
+    uint64_t *hashes;
+};
+
+static int _bytes_table_init(struct _bytes_table *t, PyObject *src, Py_ssize_t expected) {
+    Py_ssize_t capacity = 8;
+    while(capacity < expected * 2)
+        capacity <<= 1;
+    t->src = src;
+    t->seed = _ATOMIC_LOAD(&_hash_seed);
+    t->mask = capacity - 1;
+    t->slots = PyMem_Malloc(capacity * sizeof(Py_ssize_t));
+    t->hashes = PyMem_Malloc(capacity * sizeof(uint64_t));
+    if(!t->slots || !t->hashes) {
+        PyMem_Free(t->slots);
+        PyMem_Free(t->hashes);
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset(t->slots, 0xff, capacity * sizeof(Py_ssize_t));
+    return 0;
+}
+
+static void _bytes_table_free(struct _bytes_table *t) {
+    PyMem_Free(t->slots);
+    PyMem_Free(t->hashes);
+}
+
+static uint64_t _bytes_table_hash(const struct _bytes_table *t, const char *s, Py_ssize_t len) {
+    return _fast_hash(s, len, t->seed);
+}
+
+static void _bytes_table_prefetch(const struct _bytes_table *t, uint64_t h) {
+    _PREFETCH(&t->slots[h & t->mask]);
+    _PREFETCH(&t->hashes[h & t->mask]);
+}
+
+/* Slot holding key `s` (or the empty slot where it would be inserted). */
+static Py_ssize_t _bytes_table_probe(const struct _bytes_table *t, const char *s, Py_ssize_t len, uint64_t h) {
+    Py_ssize_t slot = h & t->mask;
+    for(;;) {
+        Py_ssize_t i = t->slots[slot];
+        if(i < 0)
+            return slot;
+        if(t->hashes[slot] == h
+                && CSTRINGARRAY_LEN(t->src, i) == len
+                && memcmp(CSTRINGARRAY_VALUE(t->src, i), s, len) == 0)
+            return slot;
+        slot = (slot + 1) & t->mask;
+    }
+}
+
+/* Index of the element equal to `s`, or -1. */
+static Py_ssize_t _bytes_table_find(const struct _bytes_table *t, const char *s, Py_ssize_t len, uint64_t h) {
+    return t->slots[_bytes_table_probe(t, s, len, h)];
+}
+
+/*
+ * Insert element `i` of the source array unless an equal key is present.
+ * Returns the index of the first equal element (`i` if newly inserted).
+ * The table never grows: size it for every key with _bytes_table_init.
+ */
+static Py_ssize_t _bytes_table_insert(struct _bytes_table *t, Py_ssize_t i, uint64_t h) {
+    Py_ssize_t slot = _bytes_table_probe(t, CSTRINGARRAY_VALUE(t->src, i), CSTRINGARRAY_LEN(t->src, i), h);
+    if(t->slots[slot] < 0) {
+        t->slots[slot] = i;
+        t->hashes[slot] = h;
+    }
+    return t->slots[slot];
+}
+
+/* Build a table over every element of `src`. */
+static int _bytes_table_build(struct _bytes_table *t, PyObject *src) {
+    Py_ssize_t count = CSTRINGARRAY_COUNT(src);
+    if(_bytes_table_init(t, src, count) < 0)
+        return -1;
+    for(Py_ssize_t i = 0; i < count; ++i) {
+        uint64_t h = _bytes_table_hash(t, CSTRINGARRAY_VALUE(src, i), CSTRINGARRAY_LEN(src, i));
+        _bytes_table_insert(t, i, h);
+    }
+    return 0;
+}
+
+/* probes are hashed and prefetched in batches of this size */
+#define LOOKUP_BATCH    16
+
+PyDoc_STRVAR(lookup__doc__, "");
+PyObject *cstring_lookup(PyObject *module, PyObject *args) {
+    PyObject *keysobj;
+    PyObject *tableobj;
+    if(!PyArg_ParseTuple(args, "OO", &keysobj, &tableobj))
+        return NULL;
+
+    PyObject *result = NULL;
+    PyObject *table = NULL;
+    cstring_state *state = PyModule_GetState(module);
+    PyObject *keys = _as_cstringarray(state, keysobj);
+    if(!keys)
+        return NULL;
+    table = _as_cstringarray(state, tableobj);
+    if(!table)
+        goto done;
+
+    struct _bytes_table t;
+    if(_bytes_table_build(&t, table) < 0)
+        goto done;
+
+    Py_ssize_t count = CSTRINGARRAY_COUNT(keys);
+    int64_t *indexes;
+    result = _array_new("q", count, (void **)&indexes);
+    if(!result)
+        goto free_table;
+
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t hashes[LOOKUP_BATCH];
+    for(Py_ssize_t base = 0; base < count; base += LOOKUP_BATCH) {
+        Py_ssize_t n = count - base < LOOKUP_BATCH ? count - base : LOOKUP_BATCH;
+        for(Py_ssize_t j = 0; j < n; ++j) {
+            hashes[j] = _bytes_table_hash(&t, CSTRINGARRAY_VALUE(keys, base + j), CSTRINGARRAY_LEN(keys, base + j));
+            _bytes_table_prefetch(&t, hashes[j]);
+        }
+        for(Py_ssize_t j = 0; j < n; ++j) {
+            indexes[base + j] = _bytes_table_find(&t,
+                CSTRINGARRAY_VALUE(keys, base + j), CSTRINGARRAY_LEN(keys, base + j), hashes[j]);
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+free_table:
+    _bytes_table_free(&t);
+done:
+    Py_XDECREF(table);
+    Py_DECREF(keys);
+    return result;
+}
+
+/*
+ * cstringcategorical: dictionary-encoded column.
+ *
+ * Each distinct value is stored once in `categories`; rows are stored as
+ * codes (indexes into `categories`).
+ */
+
+struct cstringcategorical {
+    PyObject_HEAD
+    PyObject *categories;   /* cstringarray */
+    Py_ssize_t count;
+    int32_t *codes;
+};
+
+#define CATEGORICAL_CATEGORIES(self)    (((struct cstringcategorical *)self)->categories)
+#define CATEGORICAL_COUNT(self)         (((struct cstringcategorical *)self)->count)
+#define CATEGORICAL_CODES(self)         (((struct cstringcategorical *)self)->codes)
+
+/* Steals a reference to `categories`. */
+static struct cstringcategorical *_cstringcategorical_alloc(PyTypeObject *type, PyObject *categories, Py_ssize_t count) {
+    if(!categories)
+        return NULL;
+    struct cstringcategorical *new = (struct cstringcategorical *)type->tp_alloc(type, 0);
+    if(!new) {
+        Py_DECREF(categories);
+        return NULL;
+    }
+    new->categories = categories;
+    new->count = count;
+    new->codes = PyMem_Malloc((count ? count : 1) * sizeof(int32_t));
+    if(!new->codes) {
+        Py_DECREF(new);
+        return (struct cstringcategorical *)PyErr_NoMemory();
+    }
+    return new;
+}
+
+static void cstringcategorical_dealloc(PyObject *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    Py_XDECREF(CATEGORICAL_CATEGORIES(self));
+    PyMem_Free(CATEGORICAL_CODES(self));
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+/*
+ * Assign each element of `arr` the id of its distinct value, in order of
+ * first appearance. `codes` receives one id per element and `uniques` the
+ * index of each value's first occurrence. Returns the number of distinct
+ * values, or -1 on error.
+ */
+static Py_ssize_t _cstringarray_encode(PyObject *arr, Py_ssize_t *codes, Py_ssize_t *uniques) {
+    Py_ssize_t count = CSTRINGARRAY_COUNT(arr);
+    struct _bytes_table t;
+    if(_bytes_table_init(&t, arr, count) < 0)
+        return -1;
+
+    /* codes[first] holds the id of each first occurrence */
+    Py_ssize_t nuniques = 0;
+    for(Py_ssize_t i = 0; i < count; ++i) {
+        uint64_t h = _bytes_table_hash(&t, CSTRINGARRAY_VALUE(arr, i), CSTRINGARRAY_LEN(arr, i));
+        Py_ssize_t first = _bytes_table_insert(&t, i, h);
+        if(first == i) {
+            uniques[nuniques] = i;
+            codes[i] = nuniques++;
+        } else {
+            codes[i] = codes[first];
+        }
+    }
+
+    _bytes_table_free(&t);
+    return nuniques;
+}
+
+/* Dictionary-encode a cstringarray. */
+static PyObject *_cstringcategorical_encode(PyTypeObject *type, PyObject *arr) {
+    Py_ssize_t count = CSTRINGARRAY_COUNT(arr);
+    if(count > INT32_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "too many rows for cstringcategorical");
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    Py_ssize_t *codes = PyMem_Malloc((count ? count : 1) * sizeof(Py_ssize_t));
+    Py_ssize_t *uniques = PyMem_Malloc((count ? count : 1) * sizeof(Py_ssize_t));
+    if(!codes || !uniques) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    Py_ssize_t nuniques = _cstringarray_encode(arr, codes, uniques);
+    if(nuniques < 0)
+        goto done;
+
+    struct cstringcategorical *new = _cstringcategorical_alloc(type,
+        _cstringarray_gather(arr, uniques, nuniques), count);
+    if(!new)
+        goto done;
+    for(Py_ssize_t i = 0; i < count; ++i)
+        new->codes[i] = (int32_t)codes[i];
+    result = (PyObject *)new;
+
+done:
+    PyMem_Free(codes);
+    PyMem_Free(uniques);
+    return result;
+}
+
+static PyObject *cstringcategorical_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    PyObject *argobj = NULL;
+    if(!PyArg_ParseTuple(args, "|O", &argobj))
+        return NULL;
+
+    cstring_state *state = _state_from_type(type);
+    if(!argobj)
+        return (PyObject *)_cstringcategorical_alloc(type, (PyObject *)_cstringarray_alloc(state->cstringarray_type, 0, 0), 0);
+
+    PyObject *arr = _as_cstringarray(state, argobj);
+    if(!arr)
+        return NULL;
+    PyObject *result = _cstringcategorical_encode(type, arr);
+    Py_DECREF(arr);
+    return result;
+}
+
+static Py_ssize_t cstringcategorical_len(PyObject *self) {
+    return CATEGORICAL_COUNT(self);
+}
+
+static PyObject *cstringcategorical_item(PyObject *self, Py_ssize_t i) {
+    if(i < 0 || i >= CATEGORICAL_COUNT(self)) {
+        PyErr_SetString(PyExc_IndexError, "Index is out of bounds");
+        return NULL;
+    }
+    return cstringarray_item(CATEGORICAL_CATEGORIES(self), CATEGORICAL_CODES(self)[i]);
+}
+
+static PyObject *cstringcategorical_subscript(PyObject *self, PyObject *key) {
+    if(!PyIndex_Check(key)) {
+        PyErr_SetString(PyExc_TypeError, "Subscript must be int.");
+        return NULL;
+    }
+    Py_ssize_t i = PyNumber_AsSsize_t(key, PyExc_IndexError);
+    if(i == -1 && PyErr_Occurred())
+        return NULL;
+    if(i < 0)
+        i += CATEGORICAL_COUNT(self);
+    return cstringcategorical_item(self, i);
+}
+
+static PyObject *cstringcategorical_repr(PyObject *self) {
+    PyObject *list = PySequence_List(self);
+    if(!list)
+        return NULL;
+    PyObject *repr = PyUnicode_FromFormat("%s(%R)", Py_TYPE(self)->tp_name, list);
+    Py_DECREF(list);
+    return repr;
+}
+
+static PyObject *cstringcategorical_get_categories(PyObject *self, void *closure) {
+    Py_INCREF(CATEGORICAL_CATEGORIES(self));
+    return CATEGORICAL_CATEGORIES(self);
+}
+
+static PyObject *cstringcategorical_get_codes(PyObject *self, void *closure) {
+    int32_t *codes;
+    PyObject *result = _array_new("i", CATEGORICAL_COUNT(self), (void **)&codes);
+    if(!result)
+        return NULL;
+    memcpy(codes, CATEGORICAL_CODES(self), CATEGORICAL_COUNT(self) * sizeof(int32_t));
+    return result;
+}
+
+PyDoc_STRVAR(to_array__doc__, "");
+PyObject *cstringcategorical_to_array(PyObject *self, PyObject *args) {
+    Py_ssize_t count = CATEGORICAL_COUNT(self);
+    Py_ssize_t *indexes = PyMem_Malloc((count ? count : 1) * sizeof(Py_ssize_t));
+    if(!indexes)
+        return PyErr_NoMemory();
+    for(Py_ssize_t i = 0; i < count; ++i)
+        indexes[i] = CATEGORICAL_CODES(self)[i];
+    PyObject *result = _cstringarray_gather(CATEGORICAL_CATEGORIES(self), indexes, count);
+    PyMem_Free(indexes);
+    return result;
+}
+
+/* New categorical sharing the categories of `self`. */
+static struct cstringcategorical *_cstringcategorical_like(PyObject *self, Py_ssize_t count) {
+    Py_INCREF(CATEGORICAL_CATEGORIES(self));
+    return _cstringcategorical_alloc(Py_TYPE(self), CATEGORICAL_CATEGORIES(self), count);
+}
+
+PyDoc_STRVAR(categorical_take__doc__, "");
+PyObject *cstringcategorical_take(PyObject *self, PyObject *arg) {
+    Py_ssize_t count;
+    Py_ssize_t *indexes = _obj_as_indexes(arg, CATEGORICAL_COUNT(self), &count);
+    if(!indexes)
+        return NULL;
+    struct cstringcategorical *new = _cstringcategorical_like(self, count);
+    if(new) {
+        for(Py_ssize_t i = 0; i < count; ++i)
+            new->codes[i] = CATEGORICAL_CODES(self)[indexes[i]];
+    }
+    PyMem_Free(indexes);
+    return (PyObject *)new;
+}
+
+PyDoc_STRVAR(categorical_filter__doc__, "");
+PyObject *cstringcategorical_filter(PyObject *self, PyObject *arg) {
+    char *mask = _obj_as_mask(arg, CATEGORICAL_COUNT(self));
+    if(!mask)
+        return NULL;
+
+    Py_ssize_t count = 0;
+    for(Py_ssize_t i = 0; i < CATEGORICAL_COUNT(self); ++i)
+        count += mask[i] != 0;
+
+    struct cstringcategorical *new = _cstringcategorical_like(self, count);
+    if(new) {
+        Py_ssize_t j = 0;
+        for(Py_ssize_t i = 0; i < CATEGORICAL_COUNT(self); ++i) {
+            if(mask[i])
+                new->codes[j++] = CATEGORICAL_CODES(self)[i];
+        }
+    }
+    PyMem_Free(mask);
+    return (PyObject *)new;
+}
+
+PyDoc_STRVAR(categorical_mask__doc__, "");
+PyObject *cstringcategorical_mask(PyObject *self, PyObject *args) {
+    PyObject *categories = CATEGORICAL_CATEGORIES(self);
+    unsigned char *truths = PyMem_Malloc(CSTRINGARRAY_COUNT(categories) + 1);
+    if(!truths)
+        return PyErr_NoMemory();
+
+    unsigned char *mask;
+    PyObject *result = NULL;
+
+    /* evaluate once per category, then map over codes */
+    if(_cstringarray_method_truths(categories, args, truths) < 0)
+        goto done;
+
+    result = _array_new("B", CATEGORICAL_COUNT(self), (void **)&mask);
+    if(!result)
+        goto done;
+    for(Py_ssize_t i = 0; i < CATEGORICAL_COUNT(self); ++i)
+        mask[i] = truths[CATEGORICAL_CODES(self)[i]];
+
+done:
+    PyMem_Free(truths);
+    return result;
+}
+
+static PyGetSetDef cstringcategorical_getset[] = {
+    {"categories", cstringcategorical_get_categories, NULL, NULL, NULL},
+    {"codes", cstringcategorical_get_codes, NULL, NULL, NULL},
+    {0},
+};
+
+/* categories are a separate object, as for the elements of a list */
+PyDoc_STRVAR(categorical_sizeof__doc__, "");
+static PyObject *cstringcategorical_sizeof(PyObject *self, PyObject *Py_UNUSED(args)) {
+    struct cstringcategorical *cat = (struct cstringcategorical *)self;
+    return PyLong_FromSsize_t(Py_TYPE(self)->tp_basicsize + cat->count * sizeof(int32_t));
+}
+
+static PyMethodDef cstringcategorical_methods[] = {
+    {"__sizeof__", cstringcategorical_sizeof, METH_NOARGS, categorical_sizeof__doc__},
+    {"filter", cstringcategorical_filter, METH_O, categorical_filter__doc__},
+    {"mask", cstringcategorical_mask, METH_VARARGS, categorical_mask__doc__},
+    {"take", cstringcategorical_take, METH_O, categorical_take__doc__},
+    {"to_array", cstringcategorical_to_array, METH_NOARGS, to_array__doc__},
+    {0},
+};
+
+static PyType_Slot cstringcategorical_slots[] = {
+    {Py_tp_doc, ""},
+    {Py_tp_new, cstringcategorical_new},
+    {Py_tp_dealloc, cstringcategorical_dealloc},
+    {Py_tp_repr, cstringcategorical_repr},
+    {Py_sq_length, cstringcategorical_len},
+    {Py_sq_item, cstringcategorical_item},
+    {Py_mp_length, cstringcategorical_len},
+    {Py_mp_subscript, cstringcategorical_subscript},
+    {Py_tp_getset, cstringcategorical_getset},
+    {Py_tp_methods, cstringcategorical_methods},
+    {0},
+};
+
+static PyType_Spec cstringcategorical_spec = {
+    .name = "cstring.cstringcategorical",
+    .basicsize = sizeof(struct cstringcategorical),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots = cstringcategorical_slots,
+};
+
+/*
+ * Group the elements of `keysobj` by value. On success, `*groups` is a new
+ * cstringarray of the distinct keys (in order of first appearance),
+ * `*codes` (PyMem-allocated) holds each row's group id and `*count` the
+ * number of rows.
+ */
+static int _group_keys(cstring_state *state, PyObject *keysobj, PyObject **groups, Py_ssize_t **codes, Py_ssize_t *count) {
+    PyObject *keys = _as_cstringarray(state, keysobj);
+    if(!keys)
+        return -1;
+
+    int rc = -1;
+    *count = CSTRINGARRAY_COUNT(keys);
+    *codes = PyMem_Malloc((*count ? *count : 1) * sizeof(Py_ssize_t));
+    Py_ssize_t *uniques = PyMem_Malloc((*count ? *count : 1) * sizeof(Py_ssize_t));
+    if(!*codes || !uniques) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    Py_ssize_t ngroups = _cstringarray_encode(keys, *codes, uniques);
+    if(ngroups < 0)
+        goto done;
+    *groups = _cstringarray_gather(keys, uniques, ngroups);
+    if(*groups)
+        rc = 0;
+
+done:
+    if(rc < 0) {
+        PyMem_Free(*codes);
+        *codes = NULL;
+    }
+    PyMem_Free(uniques);
+    Py_DECREF(keys);
+    return rc;
+}
+
+PyDoc_STRVAR(group_indices__doc__, "");
+PyObject *cstring_group_indices(PyObject *module, PyObject *arg) {
+    PyObject *groups;
+    Py_ssize_t *codes;
+    Py_ssize_t count;
+    if(_group_keys(PyModule_GetState(module), arg, &groups, &codes, &count) < 0)
+        return NULL;
+
+    Py_ssize_t ngroups = CSTRINGARRAY_COUNT(groups);
+    int64_t *offsets;
+    int64_t *indices;
+    PyObject *indicesobj = NULL;
+    PyObject *offsetsobj = _array_new("q", ngroups + 1, (void **)&offsets);
+    if(!offsetsobj)
+        goto fail;
+    indicesobj = _array_new("q", count, (void **)&indices);
+    if(!indicesobj)
+        goto fail;
+
+    /* counting sort of row indexes by group id */
+    for(Py_ssize_t i = 0; i < count; ++i)
+        ++offsets[codes[i] + 1];
+    for(Py_ssize_t g = 0; g < ngroups; ++g)
+        offsets[g + 1] += offsets[g];
+    for(Py_ssize_t i = 0; i < count; ++i)
+        indices[offsets[codes[i]]++] = i;
+    /* each offset now holds its group's end: shift back into place */
+    for(Py_ssize_t g = ngroups; g > 0; --g)
+        offsets[g] = offsets[g - 1];
+    offsets[0] = 0;
+
+    PyMem_Free(codes);
+    return _tuple_steal_refs(3, groups, offsetsobj, indicesobj);
+
+fail:
+    Py_XDECREF(offsetsobj);
+    Py_XDECREF(indicesobj);
+    Py_DECREF(groups);
+    PyMem_Free(codes);
+    return NULL;
+}
+
+/*
+ * Numeric values for group_sum: either all integers (`ints`) or
+ * doubles (`floats`); exactly one is PyMem-allocated.
+ */
+struct _group_values {
+    int64_t *ints;
+    double *floats;
+};
+
+static int _obj_as_group_values(PyObject *o, Py_ssize_t count, struct _group_values *values) {
+    values->ints = NULL;
+    values->floats = NULL;
+
+    if(PyObject_CheckBuffer(o)) {
+        Py_buffer view;
+        if(PyObject_GetBuffer(o, &view, PyBUF_FORMAT | PyBUF_ND) < 0)
+            return -1;
+        const char *fmt = view.format ? view.format : "B";
+        if(*fmt == '@' || *fmt == '=')
+            ++fmt;
+        Py_ssize_t n = view.len / (view.itemsize ? view.itemsize : 1);
+        if(n != count) {
+            PyBuffer_Release(&view);
+            goto bad_length;
+        }
+        if(*fmt == 'd' || *fmt == 'f') {
+            values->floats = PyMem_Malloc((count ? count : 1) * sizeof(double));
+            if(!values->floats)
+                goto nomem_view;
+            for(Py_ssize_t i = 0; i < count; ++i) {
+                values->floats[i] = (*fmt == 'd')
+                    ? ((const double *)view.buf)[i]
+                    : ((const float *)view.buf)[i];
+            }
+        } else {
+            values->ints = PyMem_Malloc((count ? count : 1) * sizeof(int64_t));
+            if(!values->ints)
+                goto nomem_view;
+            for(Py_ssize_t i = 0; i < count; ++i) {
+                Py_ssize_t v;
+                if(_buffer_index_at(&view, i, &v) < 0) {
+                    PyBuffer_Release(&view);
+                    if(PyErr_ExceptionMatches(PyExc_IndexError)) {
+                        PyErr_Clear();
+                        PyErr_SetString(PyExc_OverflowError, "value too large to sum as a 64-bit integer");
+                    }
+                    goto fail;
+                }
+                values->ints[i] = v;
+            }
+        }
+        PyBuffer_Release(&view);
+        return 0;
+
+nomem_view:
+        PyBuffer_Release(&view);
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    PyObject *seq = PySequence_Fast(o, "values must be a numeric buffer or a sequence");
+    if(!seq)
+        return -1;
+    if(PySequence_Fast_GET_SIZE(seq) != count) {
+        Py_DECREF(seq);
+        goto bad_length;
+    }
+
+    int all_ints = 1;
+    for(Py_ssize_t i = 0; i < count && all_ints; ++i)
+        all_ints = PyLong_Check(PySequence_Fast_GET_ITEM(seq, i));
+
+    if(all_ints)
+        values->ints = PyMem_Malloc((count ? count : 1) * sizeof(int64_t));
+    else
+        values->floats = PyMem_Malloc((count ? count : 1) * sizeof(double));
+    if(!values->ints && !values->floats) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for(Py_ssize_t i = 0; i < count; ++i) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        if(all_ints)
+            values->ints[i] = PyLong_AsLongLong(item);
+        else
+            values->floats[i] = PyFloat_AsDouble(item);
+        if(PyErr_Occurred()) {
+            Py_DECREF(seq);
+            goto fail;
+        }
+    }
+    Py_DECREF(seq);
+    return 0;
+
+bad_length:
+    PyErr_SetString(PyExc_ValueError, "values length does not match keys length");
+fail:
+    PyMem_Free(values->ints);
+    PyMem_Free(values->floats);
+    return -1;
+}
+
+/* *acc += v; returns nonzero (leaving *acc undefined) if the sum overflows. */
+static inline int _add_overflow_int64(int64_t *acc, int64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_add_overflow(*acc, v, acc);
+#else
+    if((v > 0 && *acc > INT64_MAX - v) || (v < 0 && *acc < INT64_MIN - v))
+        return 1;
+    *acc += v;
+    return 0;
+#endif
+}
+
+PyDoc_STRVAR(group_sum__doc__, "");
+PyObject *cstring_group_sum(PyObject *module, PyObject *args) {
+    PyObject *keysobj;
+    PyObject *valuesobj;
+    if(!PyArg_ParseTuple(args, "OO", &keysobj, &valuesobj))
+        return NULL;
+
+    PyObject *groups;
+    Py_ssize_t *codes;
+    Py_ssize_t count;
+    if(_group_keys(PyModule_GetState(module), keysobj, &groups, &codes, &count) < 0)
+        return NULL;
+
+    struct _group_values values;
+    PyObject *sumsobj = NULL;
+    if(_obj_as_group_values(valuesobj, count, &values) < 0)
+        goto done;
+
+    Py_ssize_t ngroups = CSTRINGARRAY_COUNT(groups);
+    if(values.ints) {
+        int64_t *sums;
+        sumsobj = _array_new("q", ngroups, (void **)&sums);
+        for(Py_ssize_t i = 0; sumsobj && i < count; ++i) {
+            if(_add_overflow_int64(&sums[codes[i]], values.ints[i])) {
+                PyErr_SetString(PyExc_OverflowError, "group sum does not fit in a 64-bit integer");
+                Py_CLEAR(sumsobj);
+            }
+        }
+    } else {
+        double *sums;
+        sumsobj = _array_new("d", ngroups, (void **)&sums);
+        if(sumsobj) {
+            for(Py_ssize_t i = 0; i < count; ++i)
+                sums[codes[i]] += values.floats[i];
+        }
+    }
+    PyMem_Free(values.ints);
+    PyMem_Free(values.floats);
+
+done:
+    PyMem_Free(codes);
+    if(!sumsobj) {
+        Py_DECREF(groups);
+        return NULL;
+    }
+    return _tuple_steal_refs(2, groups, sumsobj);
+}
+
+/*
+ * Thread pool for GIL-free loops.
+ *
+ * Workers repeatedly claim the next chunk of [0, count) under `lock`, so
+ * threads that finish early keep taking work from the shared range. The
+ * calling thread participates as a worker. `fn` must not touch the
+ * Python C API.
+ */
+struct _pool {
+    PyThread_type_lock lock;    /* guards next and running */
+    PyThread_type_lock done;    /* released by the last worker to finish */
+    long refs;                  /* threads still using the pool; the last frees it */
+    Py_ssize_t next;
+    Py_ssize_t count;
+    Py_ssize_t chunk;
+    int running;
+    void (*fn)(void *ctx, Py_ssize_t start, Py_ssize_t end);
+    void *ctx;
+};
+
+static int _pool_claim(struct _pool *pool, Py_ssize_t *start, Py_ssize_t *end) {
+    PyThread_acquire_lock(pool->lock, WAIT_LOCK);
+    *start = pool->next;
+    *end = pool->next + pool->chunk < pool->count ? pool->next + pool->chunk : pool->count;
+    pool->next = *end;
+    PyThread_release_lock(pool->lock);
+    return *start < *end;
+}
+
+/*
+ * Drop n references to the pool, freeing it with the last. A thread may
+ * still be inside PyThread_release_lock after the lock changes hands, so
+ * the locks are only freed once every thread is done with them.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define _POOL_UNREF(pool, n)    (__atomic_sub_fetch(&(pool)->refs, (n), __ATOMIC_ACQ_REL) == 0)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define _POOL_UNREF(pool, n)    (_InterlockedExchangeAdd(&(pool)->refs, -(long)(n)) == (long)(n))
+#else
+#error "no atomic decrement for the thread pool on this compiler"
+#endif
+
+static void _pool_unref(struct _pool *pool, long n) {
+    if(_POOL_UNREF(pool, n)) {
+        PyThread_free_lock(pool->lock);
+        PyThread_free_lock(pool->done);
+        PyMem_RawFree(pool);
+    }
+}
+
+static void _pool_run(struct _pool *pool) {
+    Py_ssize_t start, end;
+    while(_pool_claim(pool, &start, &end))
+        pool->fn(pool->ctx, start, end);
+
+    PyThread_acquire_lock(pool->lock, WAIT_LOCK);
+    int last = --pool->running == 0;
+    PyThread_release_lock(pool->lock);
+    if(last)
+        PyThread_release_lock(pool->done);
+}
+
+static void _pool_worker(void *arg) {
+    struct _pool *pool = arg;
+    _pool_run(pool);
+    _pool_unref(pool, 1);
+}
+
+/* Default thread count: os.cpu_count(). */
+static int _default_threads(void) {
+    int result = 1;
+    PyObject *os = PyImport_ImportModule("os");
+    if(!os) {
+        PyErr_Clear();
+        return result;
+    }
+    PyObject *n = PyObject_CallMethod(os, "cpu_count", NULL);
+    Py_DECREF(os);
+    if(n && PyLong_Check(n))
+        result = PyLong_AsLong(n);
+    Py_XDECREF(n);
+    PyErr_Clear();
+    return result > 0 ? result : 1;
+}
+
+/* Run fn over [0, count) on `threads` threads with the GIL released. */
+static int _parallel_for(Py_ssize_t count, int threads, void (*fn)(void *, Py_ssize_t, Py_ssize_t), void *ctx) {
+    if(threads <= 0)
+        threads = _default_threads();
+    if(threads > count)
+        threads = count > 0 ? (int)count : 1;
+
+    if(threads == 1) {
+        Py_BEGIN_ALLOW_THREADS
+        fn(ctx, 0, count);
+        Py_END_ALLOW_THREADS
+        return 0;
+    }
+
+    struct _pool *pool = PyMem_RawCalloc(1, sizeof(struct _pool));
+    if(!pool)
+        goto nomem;
+    pool->count = count;
+    pool->chunk = count / ((Py_ssize_t)threads * 8) + 1;
+    pool->running = threads;
+    pool->refs = threads;
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->lock = PyThread_allocate_lock();
+    pool->done = PyThread_allocate_lock();
+    if(!pool->lock || !pool->done)
+        goto nomem;
+    PyThread_acquire_lock(pool->done, WAIT_LOCK);
+
+    for(int i = 1; i < threads; ++i) {
+        if(PyThread_start_new_thread(_pool_worker, pool) == PYTHREAD_INVALID_THREAD_ID) {
+            /* run with the threads we have */
+            PyThread_acquire_lock(pool->lock, WAIT_LOCK);
+            pool->running -= threads - i;
+            PyThread_release_lock(pool->lock);
+            _pool_unref(pool, threads - i);
+            break;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    _pool_run(pool);
+    PyThread_acquire_lock(pool->done, WAIT_LOCK);
+    _pool_unref(pool, 1);
+    Py_END_ALLOW_THREADS
+    return 0;
+
+nomem:
+    if(pool) {
+        if(pool->lock)
+            PyThread_free_lock(pool->lock);
+        if(pool->done)
+            PyThread_free_lock(pool->done);
+        PyMem_RawFree(pool);
+    }
+    PyErr_NoMemory();
+    return -1;
+}
+
+/*
+ * String data of a sequence of objects, pinned for reading without the
+ * GIL: the items are held in a tuple of strong references (so the caller
+ * may change its list meanwhile), and objects exporting a buffer keep
+ * their view until _pinned_release, so a bytearray cannot be resized
+ * under a worker.
+ */
+struct _pinned {
+    PyObject *items;        /* tuple of the items, or the cstringarray */
+    Py_buffer *views;       /* .obj is NULL where no view is held */
+    const char **src;
+    Py_ssize_t *len;
+    Py_ssize_t count;
+};
+
+/*
+ * Like _obj_as_string_and_size, but a buffer view is kept in *view (its
+ * .obj set, else NULL) until released by the caller. The caller also
+ * keeps `o` alive.
+ */
+static int _pin_string(cstring_state *state, PyObject *o, Py_buffer *view, const char **s, Py_ssize_t *len) {
+    view->obj = NULL;
+    if(PyUnicode_Check(o)) {
+        *s = PyUnicode_AsUTF8AndSize(o, len);
+        return *s ? 0 : -1;
+    }
+    if(PyObject_CheckBuffer(o)) {
+        if(PyObject_GetBuffer(o, view, PyBUF_SIMPLE) < 0)
+            return -1;
+        *s = view->buf;
+        *len = view->len;
+        return 0;
+    }
+    if(PyObject_TypeCheck(o, state->cstring_type)) {
+        *s = CSTRING_VALUE(o);
+        *len = Py_SIZE(o) - 1;
+        return 0;
+    }
+    _bad_argument_type(o);
+    return -1;
+}
+
+static void _pinned_release(struct _pinned *p) {
+    if(p->views) {
+        for(Py_ssize_t i = 0; i < p->count; ++i)
+            if(p->views[i].obj)
+                PyBuffer_Release(&p->views[i]);
+    }
+    PyMem_Free(p->views);
+    PyMem_Free(p->src);
+    PyMem_Free(p->len);
+    Py_CLEAR(p->items);
+}
+
+/* Pin a cstringarray or a sequence of string-like objects. Returns -1 with an exception set. */
+static int _pinned_init(cstring_state *state, struct _pinned *p, PyObject *seqobj, const char *errmsg) {
+    memset(p, 0, sizeof(*p));
+    int as_array = PyObject_TypeCheck(seqobj, state->cstringarray_type);
+    if(as_array) {
+        Py_INCREF(seqobj);
+        p->items = seqobj;
+        p->count = CSTRINGARRAY_COUNT(seqobj);
+    } else {
+        PyObject *fast = PySequence_Fast(seqobj, errmsg);
+        if(!fast)
+            return -1;
+        p->items = PySequence_Tuple(fast);
+        Py_DECREF(fast);
+        if(!p->items)
+            return -1;
+        p->count = PyTuple_GET_SIZE(p->items);
+        p->views = PyMem_Calloc(p->count ? p->count : 1, sizeof(Py_buffer));
+    }
+    p->src = PyMem_Malloc((p->count ? p->count : 1) * sizeof(const char *));
+    p->len = PyMem_Malloc((p->count ? p->count : 1) * sizeof(Py_ssize_t));
+    if(!p->src || !p->len || (!as_array && !p->views)) {
+        _pinned_release(p);
+        PyErr_NoMemory();
+        return -1;
+    }
+    for(Py_ssize_t i = 0; i < p->count; ++i) {
+        if(as_array) {
+            p->src[i] = CSTRINGARRAY_VALUE(seqobj, i);
+            p->len[i] = CSTRINGARRAY_LEN(seqobj, i);
+        } else if(_pin_string(state, PyTuple_GET_ITEM(p->items, i), &p->views[i], &p->src[i], &p->len[i]) < 0) {
+            _pinned_release(p);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Output kinds of parallel_map operations. */
+enum {
+    MAP_TRANSFORM,  /* same-size cstring output */
+    MAP_RANGE,      /* sub-range of the input */
+    MAP_BOOL,       /* array('B') */
+    MAP_INT,        /* array('q') */
+};
+
+struct _map_op {
+    const char *name;
+    int kind;
+    int takes_arg;
+    void (*transform)(const char *s, char *d, Py_ssize_t len);
+    int (*predicate)(const char *s, Py_ssize_t len);
+};
+
+static const struct _map_op _map_ops[] = {
+    {"lower", MAP_TRANSFORM, 0, _kernel_lower},
+    {"upper", MAP_TRANSFORM, 0, _kernel_upper},
+    {"swapcase", MAP_TRANSFORM, 0, _kernel_swapcase},
+    {"strip", MAP_RANGE, 1},
+    {"lstrip", MAP_RANGE, 1},
+    {"rstrip", MAP_RANGE, 1},
+    {"isalnum", MAP_BOOL, 0, NULL, _kernel_isalnum},
+    {"isalpha", MAP_BOOL, 0, NULL, _kernel_isalpha},
+    {"isdigit", MAP_BOOL, 0, NULL, _kernel_isdigit},
+    {"islower", MAP_BOOL, 0, NULL, _kernel_islower},
+    {"isprintable", MAP_BOOL, 0, NULL, _kernel_isprintable},
+    {"isspace", MAP_BOOL, 0, NULL, _kernel_isspace},
+    {"isupper", MAP_BOOL, 0, NULL, _kernel_isupper},
+    {"startswith", MAP_BOOL, 1},
+    {"endswith", MAP_BOOL, 1},
+    {"count", MAP_INT, 1},
+    {"find", MAP_INT, 1},
+    {"hash", MAP_INT, 0},
+    {0},
+};
+
+struct _map_job {
+    const struct _map_op *op;
+    const char **src;
+    Py_ssize_t *len;
+    const char *arg;
+    Py_ssize_t arglen;
+    char *out_data;             /* MAP_TRANSFORM, at out_offsets */
+    Py_ssize_t *out_offsets;
+    Py_ssize_t *out_start;      /* MAP_RANGE */
+    Py_ssize_t *out_end;
+    unsigned char *out_bool;    /* MAP_BOOL */
+    int64_t *out_int;           /* MAP_INT */
+    uint64_t seed;              /* hash */
+};
+
+static void _map_job_run(void *ctx, Py_ssize_t start, Py_ssize_t end) {
+    struct _map_job *job = ctx;
+    const char *name = job->op->name;
+
+    for(Py_ssize_t i = start; i < end; ++i) {
+        const char *s = job->src[i];
+        Py_ssize_t len = job->len[i];
+
+        switch(job->op->kind) {
+        case MAP_TRANSFORM:
+            job->op->transform(s, &job->out_data[job->out_offsets[i]], len + 1);
+            break;
+        case MAP_RANGE:
+            job->out_start[i] = 0;
+            job->out_end[i] = len;
+            _kernel_strip(s, job->arg, job->arglen, name[0] != 'r', name[0] != 'l',
+                &job->out_start[i], &job->out_end[i]);
+            break;
+        case MAP_BOOL:
+            if(job->op->predicate)
+                job->out_bool[i] = job->op->predicate(s, len);
+            else if(name[0] == 's')
+                job->out_bool[i] = len >= job->arglen && memcmp(s, job->arg, job->arglen) == 0;
+            else
+                job->out_bool[i] = len >= job->arglen && memcmp(s + len - job->arglen, job->arg, job->arglen) == 0;
+            break;
+        case MAP_INT:
+            if(name[0] == 'c')
+                job->out_int[i] = _kernel_count(s, len, job->arg, job->arglen);
+            else if(name[0] == 'f')
+                job->out_int[i] = _kernel_find(s, len, job->arg, job->arglen);
+            else
+                job->out_int[i] = (int64_t)_fast_hash(s, len, job->seed);
+            break;
+        }
+    }
+}
+
+/* Create the Python result of a finished job. */
+static PyObject *_map_job_result(cstring_state *state, struct _map_job *job, PyObject *result, Py_ssize_t count, int as_array) {
+    if(job->op->kind == MAP_TRANSFORM && as_array)
+        return result;  /* already a cstringarray */
+
+    if(job->op->kind == MAP_RANGE && as_array) {
+        Py_ssize_t datasize = count;
+        for(Py_ssize_t i = 0; i < count; ++i)
+            datasize += job->out_end[i] - job->out_start[i];
+        struct cstringarray *new = _cstringarray_alloc(state->cstringarray_type, count, datasize);
+        if(!new)
+            return NULL;
+        for(Py_ssize_t i = 0; i < count; ++i) {
+            Py_ssize_t len = job->out_end[i] - job->out_start[i];
+            char *d = &new->data[new->offsets[i]];
+            memcpy(d, job->src[i] + job->out_start[i], len);
+            d[len] = '\0';
+            new->offsets[i + 1] = new->offsets[i] + len + 1;
+        }
+        return (PyObject *)new;
+    }
+
+    PyObject *list = PyList_New(count);
+    if(!list)
+        return NULL;
+    for(Py_ssize_t i = 0; i < count; ++i) {
+        PyObject *item = (job->op->kind == MAP_TRANSFORM)
+            ? _cstring_new(state->cstring_type, &job->out_data[job->out_offsets[i]], job->len[i])
+            : _cstring_new(state->cstring_type, job->src[i] + job->out_start[i], job->out_end[i] - job->out_start[i]);
+        if(!item) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+PyDoc_STRVAR(parallel_map__doc__, "");
+PyObject *cstring_parallel_map(PyObject *module, PyObject *args, PyObject *kwargs) {
+    cstring_state *state = PyModule_GetState(module);
+    int threads = 0;
+
+    if(kwargs) {
+        PyObject *threadsobj = PyDict_GetItemString(kwargs, "threads");
+        if(PyDict_GET_SIZE(kwargs) != (threadsobj ? 1 : 0)) {
+            PyErr_SetString(PyExc_TypeError, "parallel_map() only accepts the keyword argument 'threads'");
+            return NULL;
+        }
+        if(threadsobj && threadsobj != Py_None) {
+            long n = PyLong_AsLong(threadsobj);
+            if(n == -1 && PyErr_Occurred())
+                return NULL;
+            threads = n > INT_MAX ? INT_MAX : (int)n;
+        }
+    }
+
+    const char *name;
+    PyObject *seqobj;
+    PyObject *argobj = NULL;
+    if(!PyArg_ParseTuple(args, "sO|O:parallel_map", &name, &seqobj, &argobj))
+        return NULL;
+
+    const struct _map_op *op = _map_ops;
+    while(op->name && strcmp(op->name, name) != 0)
+        ++op;
+    if(!op->name) {
+        PyErr_Format(PyExc_ValueError, "parallel_map() does not support method %s", name);
+        return NULL;
+    }
+
+    struct _map_job job = {.op = op, .arg = WHITESPACE_CHARS, .arglen = strlen(WHITESPACE_CHARS), .seed = _ATOMIC_LOAD(&_hash_seed)};
+    Py_buffer argview = {0};
+    if(argobj && argobj != Py_None) {
+        if(_pin_string(state, argobj, &argview, &job.arg, &job.arglen) < 0)
+            return NULL;
+    } else if(op->takes_arg && op->kind != MAP_RANGE) {
+        PyErr_Format(PyExc_TypeError, "parallel_map() method %s requires an argument", name);
+        return NULL;
+    }
+
+    /* pin the inputs while holding the GIL */
+    int as_array = PyObject_TypeCheck(seqobj, state->cstringarray_type);
+    struct _pinned pinned;
+    if(_pinned_init(state, &pinned, seqobj, "parallel_map() argument must be a sequence") < 0) {
+        if(argview.obj)
+            PyBuffer_Release(&argview);
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    PyObject *output = NULL;
+    Py_ssize_t count = pinned.count;
+    job.src = pinned.src;
+    job.len = pinned.len;
+
+    /* preallocate outputs */
+    switch(op->kind) {
+    case MAP_TRANSFORM: {
+        Py_ssize_t datasize = count;
+        for(Py_ssize_t i = 0; i < count; ++i)
+            datasize += job.len[i];
+        struct cstringarray *new = _cstringarray_alloc(state->cstringarray_type, count, datasize);
+        if(!new)
+            goto done;
+        for(Py_ssize_t i = 0; i < count; ++i)
+            new->offsets[i + 1] = new->offsets[i] + job.len[i] + 1;
+        job.out_data = new->data;
+        job.out_offsets = new->offsets;
+        output = (PyObject *)new;
+        break;
+    }
+    case MAP_RANGE:
+        job.out_start = PyMem_Malloc((count ? count : 1) * sizeof(Py_ssize_t));
+        job.out_end = PyMem_Malloc((count ? count : 1) * sizeof(Py_ssize_t));
+        if(!job.out_start || !job.out_end) {
+            PyErr_NoMemory();
+            goto done;
+        }
+        break;
+    case MAP_BOOL:
+        output = _array_new("B", count, (void **)&job.out_bool);
+        break;
+    case MAP_INT:
+        output = _array_new("q", count, (void **)&job.out_int);
+        break;
+    }
+    if(!output && PyErr_Occurred())
+        goto done;
+
+    if(_parallel_for(count, threads, _map_job_run, &job) < 0)
+        goto done;
+
+    /* create Python objects afterwards */
+    if(op->kind == MAP_BOOL || op->kind == MAP_INT) {
+        result = output;
+        output = NULL;
+    } else {
+        result = _map_job_result(state, &job, output, count, as_array);
+        if(result == output)
+            output = NULL;
+    }
+
+done:
+    Py_XDECREF(output);
+    PyMem_Free(job.out_start);
+    PyMem_Free(job.out_end);
+    _pinned_release(&pinned);
+    if(argview.obj)
+        PyBuffer_Release(&argview);
+    return result;
+}
+
+/*
+ * String metrics. Both strings become sequences of symbols: bytes, or in
+ * code-point mode UTF-8 sequences (lead byte plus continuation bytes,
+ * packed into a uint32; stray bytes stand alone). One string is the
+ * pattern: its symbols get dense ids and a bit mask of their positions
+ * (peq) for the bit-parallel kernels. Symbols of the other string that do
+ * not occur in the pattern share a sentinel id whose masks are empty.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define _POPCOUNT64(x)  __builtin_popcountll(x)
+#define _CTZ64(x)       __builtin_ctzll(x)
+#else
+static inline int _POPCOUNT64(uint64_t x) {
+    int n = 0;
+    for(; x; x &= x - 1)
+        ++n;
+    return n;
+}
+static inline int _CTZ64(uint64_t x) {
+    int n = 0;
+    for(; !(x & 1); x >>= 1)
+        ++n;
+    return n;
+}
+#endif
+
+#define METRIC_WORD         64
+#define METRIC_SMALL_PEQ    256
+
+struct _pattern {
+    Py_ssize_t len;         /* in symbols */
+    Py_ssize_t words;       /* 64-bit blocks covering len */
+    uint32_t sigma;         /* ids are 0..sigma-1 */
+    int codepoints;
+    uint32_t *sym;
+    uint64_t *peq;          /* peq[id * words + w] */
+    uint32_t *keys;         /* code-point mode: open-addressed map of packed + 1 ... */
+    uint32_t *ids;          /* ... to id */
+    size_t mask;
+    uint32_t small_sym[METRIC_WORD];
+    uint64_t small_peq[METRIC_SMALL_PEQ];
+};
+
+/* Length of the UTF-8 sequence at s (1 for a stray or truncated byte). */
+static inline Py_ssize_t _utf8_seqlen(const unsigned char *s, Py_ssize_t avail) {
+    unsigned c = s[0];
+    Py_ssize_t n = c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF8 ? 4 : 1;
+    if(n > avail)
+        return 1;
+    for(Py_ssize_t i = 1; i < n; ++i)
+        if((s[i] & 0xC0) != 0x80)
+            return 1;
+    return n;
+}
+
+static inline uint32_t _utf8_packed(const unsigned char *s, Py_ssize_t n) {
+    uint32_t v = 0;
+    for(Py_ssize_t i = 0; i < n; ++i)
+        v = (v << 8) | s[i];
+    return v;
+}
+
+static Py_ssize_t _symbol_count(const char *s, Py_ssize_t len, int codepoints) {
+    if(!codepoints)
+        return len;
+    Py_ssize_t n = 0;
+    for(Py_ssize_t i = 0; i < len; ++n)
+        i += _utf8_seqlen((const unsigned char *)s + i, len - i);
+    return n;
+}
+
+static inline size_t _pattern_slot(const struct _pattern *p, uint32_t key) {
+    size_t i = (key * (size_t)0x9E3779B1u) & p->mask;
+    while(p->keys[i] && p->keys[i] != key)
+        i = (i + 1) & p->mask;
+    return i;
+}
+
+/* Symbol ids of s[0:len] into out (room for len); returns their count. */
+static Py_ssize_t _pattern_text(const struct _pattern *p, const char *s, Py_ssize_t len, uint32_t *out) {
+    const unsigned char *u = (const unsigned char *)s;
+    if(!p->codepoints) {
+        for(Py_ssize_t i = 0; i < len; ++i)
+            out[i] = u[i];
+        return len;
+    }
+    Py_ssize_t n = 0;
+    for(Py_ssize_t i = 0; i < len; ) {
+        Py_ssize_t k = _utf8_seqlen(u + i, len - i);
+        size_t slot = _pattern_slot(p, _utf8_packed(u + i, k) + 1);
+        out[n++] = p->keys[slot] ? p->ids[slot] : p->sigma - 1;
+        i += k;
+    }
+    return n;
+}
+
+static void _pattern_free(struct _pattern *p) {
+    if(p->sym != p->small_sym)
+        PyMem_RawFree(p->sym);
+    if(p->peq != p->small_peq)
+        PyMem_RawFree(p->peq);
+    PyMem_RawFree(p->keys);
+    PyMem_RawFree(p->ids);
+}
+
+/* Returns -1 (without an exception set) if out of memory. */
+static int _pattern_init(struct _pattern *p, const char *s, Py_ssize_t len, int codepoints) {
+    const unsigned char *u = (const unsigned char *)s;
+    Py_ssize_t n = _symbol_count(s, len, codepoints);
+    p->len = n;
+    p->words = (n + METRIC_WORD - 1) / METRIC_WORD;
+    p->codepoints = codepoints;
+    p->keys = p->ids = NULL;
+    p->peq = p->small_peq;
+    p->sym = n <= METRIC_WORD ? p->small_sym : PyMem_RawMalloc(n * sizeof(uint32_t));
+    if(!p->sym)
+        goto fail;
+
+    if(codepoints) {
+        size_t cap = 8;
+        while(cap < 2 * (size_t)n)
+            cap <<= 1;
+        p->mask = cap - 1;
+        p->keys = PyMem_RawCalloc(cap, sizeof(uint32_t));
+        p->ids = PyMem_RawMalloc(cap * sizeof(uint32_t));
+        if(!p->keys || !p->ids)
+            goto fail;
+        uint32_t next = 0;
+        for(Py_ssize_t i = 0, j = 0; i < len; ++j) {
+            Py_ssize_t k = _utf8_seqlen(u + i, len - i);
+            uint32_t key = _utf8_packed(u + i, k) + 1;
+            size_t slot = _pattern_slot(p, key);
+            if(!p->keys[slot]) {
+                p->keys[slot] = key;
+                p->ids[slot] = next++;
+            }
+            p->sym[j] = p->ids[slot];
+            i += k;
+        }
+        p->sigma = next + 1;
+    } else {
+        for(Py_ssize_t i = 0; i < n; ++i)
+            p->sym[i] = u[i];
+        p->sigma = 256;
+    }
+
+    size_t npeq = (size_t)p->sigma * (p->words ? p->words : 1);
+    if(npeq > METRIC_SMALL_PEQ) {
+        p->peq = PyMem_RawCalloc(npeq, sizeof(uint64_t));
+        if(!p->peq)
+            goto fail;
+    } else {
+        memset(p->peq, 0, npeq * sizeof(uint64_t));
+    }
+    for(Py_ssize_t i = 0; i < n; ++i)
+        p->peq[p->sym[i] * p->words + i / METRIC_WORD] |= (uint64_t)1 << (i % METRIC_WORD);
+    return 0;
+
+fail:
+    if(!p->sym)
+        p->sym = p->small_sym;
+    _pattern_free(p);
+    return -1;
+}
+
+/* Mask of the pattern's top bit within its last block. */
+static inline uint64_t _pattern_high(const struct _pattern *p) {
+    return (uint64_t)1 << ((p->len - 1) % METRIC_WORD);
+}
+
+/* One 64-row block of Myers' algorithm; hin/return are the horizontal deltas entering/leaving it. */
+static inline int _myers_block(uint64_t *pv, uint64_t *mv, uint64_t eq, int hin, uint64_t high) {
+    uint64_t p = *pv, m = *mv;
+    uint64_t xv = eq | m;
+    if(hin < 0)
+        eq |= 1;
+    uint64_t xh = (((eq & p) + p) ^ p) | eq;
+    uint64_t ph = m | ~(xh | p);
+    uint64_t mh = p & xh;
+    int hout = (ph & high) ? 1 : (mh & high) ? -1 : 0;
+    ph <<= 1;
+    mh <<= 1;
+    if(hin < 0)
+        mh |= 1;
+    else if(hin > 0)
+        ph |= 1;
+    *pv = mh | ~(xv | ph);
+    *mv = ph & xv;
+    return hout;
+}
+
+/*
+ * Levenshtein distance between the pattern and t[0:n] (Myers/Hyyro), or
+ * max + 1 once it is known to exceed max. Returns -1 if out of memory.
+ */
+static Py_ssize_t _levenshtein_kernel(const struct _pattern *p, const uint32_t *t, Py_ssize_t n, Py_ssize_t max) {
+    Py_ssize_t m = p->len;
+    if((m > n ? m - n : n - m) > max)
+        return max + 1;
+    if(m == 0)
+        return n;
+
+    Py_ssize_t score = m;
+    uint64_t high = _pattern_high(p);
+    if(p->words == 1) {
+        uint64_t pv = ~(uint64_t)0, mv = 0;
+        for(Py_ssize_t j = 0; j < n; ++j) {
+            uint64_t eq = p->peq[t[j]];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            score += (ph & high) != 0;
+            score -= (mh & high) != 0;
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+            if(score - (n - 1 - j) > max)
+                return max + 1;
+        }
+        return score;
+    }
+
+    Py_ssize_t words = p->words;
+    uint64_t *pv = PyMem_RawMalloc(2 * words * sizeof(uint64_t));
+    if(!pv)
+        return -1;
+    uint64_t *mv = pv + words;
+    for(Py_ssize_t w = 0; w < words; ++w) {
+        pv[w] = ~(uint64_t)0;
+        mv[w] = 0;
+    }
+    for(Py_ssize_t j = 0; j < n; ++j) {
+        const uint64_t *eq = p->peq + t[j] * words;
+        int h = 1;
+        for(Py_ssize_t w = 0; w < words - 1; ++w)
+            h = _myers_block(&pv[w], &mv[w], eq[w], h, (uint64_t)1 << 63);
+        score += _myers_block(&pv[words - 1], &mv[words - 1], eq[words - 1], h, high);
+        if(score - (n - 1 - j) > max) {
+            score = max + 1;
+            break;
+        }
+    }
+    PyMem_RawFree(pv);
+    return score;
+}
+
+/*
+ * Optimal string alignment distance (Levenshtein plus transpositions of
+ * adjacent symbols; no substring is edited twice). Bit-parallel (Hyyro)
+ * for patterns of up to 64 symbols, a three-row DP beyond. Same
+ * contract as _levenshtein_kernel.
+ */
+static Py_ssize_t _osa_kernel(const struct _pattern *p, const uint32_t *t, Py_ssize_t n, Py_ssize_t max) {
+    Py_ssize_t m = p->len;
+    if((m > n ? m - n : n - m) > max)
+        return max + 1;
+    if(m == 0)
+        return n;
+
+    if(p->words == 1) {
+        Py_ssize_t score = m;
+        uint64_t high = _pattern_high(p);
+        uint64_t vp = ~(uint64_t)0, vn = 0, d0 = 0, pm_old = 0;
+        for(Py_ssize_t j = 0; j < n; ++j) {
+            uint64_t pm = p->peq[t[j]];
+            uint64_t tr = (((~d0) & pm) << 1) & pm_old;
+            d0 = (((pm & vp) + vp) ^ vp) | pm | vn | tr;
+            uint64_t hp = vn | ~(d0 | vp);
+            uint64_t hn = d0 & vp;
+            score += (hp & high) != 0;
+            score -= (hn & high) != 0;
+            hp = (hp << 1) | 1;
+            hn <<= 1;
+            vp = hn | ~(d0 | hp);
+            vn = hp & d0;
+            pm_old = pm;
+            if(score - (n - 1 - j) > max)
+                return max + 1;
+        }
+        return score;
+    }
+
+    /* rows over the pattern, one per symbol of t */
+    Py_ssize_t *rows = PyMem_RawMalloc(3 * (m + 1) * sizeof(Py_ssize_t));
+    if(!rows)
+        return -1;
+    Py_ssize_t *prev2 = rows, *prev = rows + m + 1, *cur = rows + 2 * (m + 1);
+    for(Py_ssize_t i = 0; i <= m; ++i)
+        prev[i] = i;
+    Py_ssize_t result = -1;
+    for(Py_ssize_t j = 1; j <= n; ++j) {
+        cur[0] = j;
+        Py_ssize_t best = j;
+        for(Py_ssize_t i = 1; i <= m; ++i) {
+            Py_ssize_t cost = p->sym[i - 1] != t[j - 1];
+            Py_ssize_t d = prev[i - 1] + cost;
+            if(prev[i] + 1 < d)
+                d = prev[i] + 1;
+            if(cur[i - 1] + 1 < d)
+                d = cur[i - 1] + 1;
+            if(i > 1 && j > 1 && p->sym[i - 1] == t[j - 2] && p->sym[i - 2] == t[j - 1] && prev2[i - 2] + 1 < d)
+                d = prev2[i - 2] + 1;
+            cur[i] = d;
+            if(d < best)
+                best = d;
+        }
+        /* a transposition can lower the next row by at most one below this one's minimum */
+        if(best - 1 > max) {
+            result = max + 1;
+            break;
+        }
+        Py_ssize_t *tmp = prev2;
+        prev2 = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    if(result < 0)
+        result = prev[m] > max ? max + 1 : prev[m];
+    PyMem_RawFree(rows);
+    return result;
+}
+
+/* Length of the longest common subsequence (Allison-Dix/Hyyro); -1 if out of memory. */
+static Py_ssize_t _lcs_kernel(const struct _pattern *p, const uint32_t *t, Py_ssize_t n) {
+    Py_ssize_t m = p->len;
+    if(m == 0 || n == 0)
+        return 0;
+
+    Py_ssize_t words = p->words;
+    uint64_t one = ~(uint64_t)0;
+    uint64_t *s = words == 1 ? &one : PyMem_RawMalloc(words * sizeof(uint64_t));
+    if(!s)
+        return -1;
+    for(Py_ssize_t w = 0; w < words; ++w)
+        s[w] = ~(uint64_t)0;
+    for(Py_ssize_t j = 0; j < n; ++j) {
+        const uint64_t *eq = p->peq + t[j] * words;
+        uint64_t carry = 0;
+        for(Py_ssize_t w = 0; w < words; ++w) {
+            uint64_t u = s[w] & eq[w];
+            uint64_t sum = s[w] + u;
+            uint64_t c = sum < u;
+            sum += carry;
+            carry = c | (sum < carry);
+            s[w] = sum | (s[w] - u);
+        }
+    }
+    Py_ssize_t result = 0;
+    for(Py_ssize_t w = 0; w < words - 1; ++w)
+        result += _POPCOUNT64(~s[w]);
+    result += _POPCOUNT64(~s[words - 1] & ((_pattern_high(p) << 1) - 1));
+    if(s != &one)
+        PyMem_RawFree(s);
+    return result;
+}
+
+/*
+ * Jaro-Winkler similarity: Jaro matches are found with the pattern's bit
+ * masks, a word at a time over the match window. The Winkler bonus of
+ * prefix_weight per common leading symbol (up to 4) applies above 0.7.
+ * Returns -1.0 if out of memory.
+ */
+static double _jaro_winkler_kernel(const struct _pattern *p, const uint32_t *t, Py_ssize_t n, double prefix_weight) {
+    Py_ssize_t m = p->len;
+    if(m == 0 || n == 0)
+        return m == n ? 1.0 : 0.0;
+
+    Py_ssize_t words = p->words;
+    Py_ssize_t window = (m > n ? m : n) / 2 - 1;
+    if(window < 0)
+        window = 0;
+    uint64_t *flags = PyMem_RawCalloc(words, sizeof(uint64_t));
+    uint32_t *matched = PyMem_RawMalloc((n < m ? n : m) * sizeof(uint32_t));
+    if(!flags || !matched) {
+        PyMem_RawFree(flags);
+        PyMem_RawFree(matched);
+        return -1.0;
+    }
+
+    Py_ssize_t nmatched = 0;
+    for(Py_ssize_t j = 0; j < n; ++j) {
+        Py_ssize_t lo = j > window ? j - window : 0;
+        Py_ssize_t hi = j + window < m - 1 ? j + window : m - 1;
+        const uint64_t *eq = p->peq + t[j] * words;
+        for(Py_ssize_t w = lo / METRIC_WORD; w <= hi / METRIC_WORD; ++w) {
+            uint64_t bits = eq[w] & ~flags[w];
+            if(w == lo / METRIC_WORD)
+                bits &= ~(uint64_t)0 << (lo % METRIC_WORD);
+            if(w == hi / METRIC_WORD && hi % METRIC_WORD != METRIC_WORD - 1)
+                bits &= ((uint64_t)1 << (hi % METRIC_WORD + 1)) - 1;
+            if(bits) {
+                flags[w] |= bits & -bits;
+                matched[nmatched++] = t[j];
+                break;
+            }
+        }
+    }
+
+    double sim = 0.0;
+    if(nmatched) {
+        Py_ssize_t k = 0, transposed = 0;
+        for(Py_ssize_t w = 0; w < words; ++w)
+            for(uint64_t bits = flags[w]; bits; bits &= bits - 1)
+                transposed += p->sym[w * METRIC_WORD + _CTZ64(bits)] != matched[k++];
+        double c = (double)nmatched;
+        sim = (c / m + c / n + (c - transposed / 2) / c) / 3.0;
+    }
+    PyMem_RawFree(flags);
+    PyMem_RawFree(matched);
+
+    if(sim > 0.7) {
+        Py_ssize_t prefix = 0;
+        while(prefix < 4 && prefix < m && prefix < n && p->sym[prefix] == t[prefix])
+            ++prefix;
+        sim += prefix * prefix_weight * (1.0 - sim);
+    }
+    return sim;
+}
+
+enum metric {
+    METRIC_LEVENSHTEIN,
+    METRIC_DAMERAU,
+    METRIC_LCS,
+    METRIC_JARO_WINKLER,
+};
+
+/*
+ * Shared body of the metric functions. For the distances and lcs_len the
+ * common prefix and suffix (whole symbols) are removed first and the
+ * shorter remainder becomes the pattern. Returns an int or float.
+ */
+static PyObject *_metric_call(PyObject *module, enum metric metric, PyObject *aobj, PyObject *bobj, Py_ssize_t max, double prefix_weight, int codepoints) {
+    cstring_state *state = PyModule_GetState(module);
+    Py_ssize_t alen, blen;
+    const char *a = _obj_as_string_and_size(state, aobj, &alen);
+    if(!a)
+        return NULL;
+    const char *b = _obj_as_string_and_size(state, bobj, &blen);
+    if(!b)
+        return NULL;
+
+    Py_ssize_t affix = 0;
+    if(metric != METRIC_JARO_WINKLER) {
+        Py_ssize_t prefix = 0, suffix = 0;
+        while(prefix < alen && prefix < blen && a[prefix] == b[prefix])
+            ++prefix;
+        while(suffix < alen - prefix && suffix < blen - prefix && a[alen - 1 - suffix] == b[blen - 1 - suffix])
+            ++suffix;
+        if(codepoints) {
+            /* only strip whole UTF-8 sequences */
+            while(prefix > 0 && prefix < alen && ((unsigned char)a[prefix] & 0xC0) == 0x80)
+                --prefix;
+            while(prefix > 0 && prefix < blen && ((unsigned char)b[prefix] & 0xC0) == 0x80)
+                --prefix;
+            while(suffix > 0 && ((unsigned char)a[alen - suffix] & 0xC0) == 0x80)
+                --suffix;
+            if(metric == METRIC_LCS)
+                affix = _symbol_count(a, prefix, 1) + _symbol_count(a + alen - suffix, suffix, 1);
+        } else {
+            affix = prefix + suffix;
+        }
+        a += prefix;
+        b += prefix;
+        alen -= prefix + suffix;
+        blen -= prefix + suffix;
+        if(alen > blen) {
+            const char *s = a;
+            a = b;
+            b = s;
+            Py_ssize_t len = alen;
+            alen = blen;
+            blen = len;
+        }
+    }
+
+    struct _pattern pattern;
+    if(_pattern_init(&pattern, a, alen, codepoints) < 0)
+        return PyErr_NoMemory();
+    uint32_t small[METRIC_SMALL_PEQ];
+    uint32_t *text = blen <= METRIC_SMALL_PEQ ? small : PyMem_RawMalloc(blen * sizeof(uint32_t));
+    if(!text) {
+        _pattern_free(&pattern);
+        return PyErr_NoMemory();
+    }
+    Py_ssize_t n = _pattern_text(&pattern, b, blen, text);
+
+    PyObject *result = NULL;
+    if(metric == METRIC_JARO_WINKLER) {
+        double sim = _jaro_winkler_kernel(&pattern, text, n, prefix_weight);
+        result = sim < 0 ? PyErr_NoMemory() : PyFloat_FromDouble(sim);
+    } else {
+        Py_ssize_t d;
+        if(metric == METRIC_LCS)
+            d = _lcs_kernel(&pattern, text, n);
+        else if(metric == METRIC_DAMERAU)
+            d = _osa_kernel(&pattern, text, n, max);
+        else
+            d = _levenshtein_kernel(&pattern, text, n, max);
+        result = d < 0 ? PyErr_NoMemory() : PyLong_FromSsize_t(metric == METRIC_LCS ? d + affix : d);
+    }
+
+    if(text != small)
+        PyMem_RawFree(text);
+    _pattern_free(&pattern);
+    return result;
+}
+
+static PyObject *_distance_call(PyObject *module, enum metric metric, PyObject *args, PyObject *kwargs) {
+    PyObject *aobj, *bobj;
+    PyObject *maxobj = Py_None;
+    int codepoints = 0;
+    char *kwlist[] = {"a", "b", "max", "codepoints", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|Op", kwlist, &aobj, &bobj, &maxobj, &codepoints))
+        return NULL;
+    Py_ssize_t max = PY_SSIZE_T_MAX - 1;
+    if(maxobj != Py_None) {
+        max = PyLong_AsSsize_t(maxobj);
+        if(max == -1 && PyErr_Occurred())
+            return NULL;
+        if(max < 0) {
+            PyErr_SetString(PyExc_ValueError, "max must be non-negative");
+            return NULL;
+        }
+        if(max > PY_SSIZE_T_MAX - 1)
+            max = PY_SSIZE_T_MAX - 1;
+    }
+    return _metric_call(module, metric, aobj, bobj, max, 0.0, codepoints);
+}
+
+PyDoc_STRVAR(levenshtein__doc__,
+"levenshtein(a, b, max=None, codepoints=False) -> int\n"
+"\n"
+"Edit distance between a and b in bytes (or code points). If max is\n"
+"given, returns max + 1 as soon as the distance is known to exceed it.");
+static PyObject *cstring_levenshtein(PyObject *module, PyObject *args, PyObject *kwargs) {
+    return _distance_call(module, METRIC_LEVENSHTEIN, args, kwargs);
+}
+
+PyDoc_STRVAR(damerau__doc__,
+"damerau(a, b, max=None, codepoints=False) -> int\n"
+"\n"
+"Like levenshtein, also counting a transposition of adjacent symbols as\n"
+"one edit (optimal string alignment distance).");
+static PyObject *cstring_damerau(PyObject *module, PyObject *args, PyObject *kwargs) {
+    return _distance_call(module, METRIC_DAMERAU, args, kwargs);
+}
+
+PyDoc_STRVAR(lcs_len__doc__,
+"lcs_len(a, b, codepoints=False) -> int\n"
+"\n"
+"Length of the longest common subsequence of a and b.");
+static PyObject *cstring_lcs_len(PyObject *module, PyObject *args, PyObject *kwargs) {
+    PyObject *aobj, *bobj;
+    int codepoints = 0;
+    char *kwlist[] = {"a", "b", "codepoints", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|p", kwlist, &aobj, &bobj, &codepoints))
+        return NULL;
+    return _metric_call(module, METRIC_LCS, aobj, bobj, 0, 0.0, codepoints);
+}
+
+PyDoc_STRVAR(jaro_winkler__doc__,
+"jaro_winkler(a, b, prefix_weight=0.1, codepoints=False) -> float\n"
+"\n"
+"Jaro-Winkler similarity of a and b, from 0.0 to 1.0. prefix_weight=0\n"
+"gives the plain Jaro similarity.");
+static PyObject *cstring_jaro_winkler(PyObject *module, PyObject *args, PyObject *kwargs) {
+    PyObject *aobj, *bobj;
+    double prefix_weight = 0.1;
+    int codepoints = 0;
+    char *kwlist[] = {"a", "b", "prefix_weight", "codepoints", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|dp", kwlist, &aobj, &bobj, &prefix_weight, &codepoints))
+        return NULL;
+    if(!(prefix_weight >= 0.0 && prefix_weight <= 0.25)) {
+        PyErr_SetString(PyExc_ValueError, "prefix_weight must be between 0 and 0.25");
+        return NULL;
+    }
+    return _metric_call(module, METRIC_JARO_WINKLER, aobj, bobj, 0, prefix_weight, codepoints);
+}
+
+/* A scored candidate; lower keys are better (distances, or negated similarities). */
+struct _match {
+    double key;
+    Py_ssize_t index;
+};
+
+static inline int _match_worse(const struct _match *a, const struct _match *b) {
+    return a->key > b->key || (a->key == b->key && a->index > b->index);
+}
+
+static int _match_cmp(const void *a, const void *b) {
+    return _match_worse(a, b) ? 1 : _match_worse(b, a) ? -1 : 0;
+}
+
+/* Offer m to the heap of the k best matches so far (worst on top). */
+static void _match_push(struct _match *heap, Py_ssize_t *size, Py_ssize_t k, struct _match m) {
+    Py_ssize_t i;
+    if(*size < k) {
+        i = (*size)++;
+        while(i > 0 && _match_worse(&m, &heap[(i - 1) / 2])) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    } else if(_match_worse(&heap[0], &m)) {
+        i = 0;
+        for(;;) {
+            Py_ssize_t child = 2 * i + 1;
+            if(child >= k)
+                break;
+            if(child + 1 < k && _match_worse(&heap[child + 1], &heap[child]))
+                ++child;
+            if(!_match_worse(&heap[child], &m))
+                break;
+            heap[i] = heap[child];
+            i = child;
+        }
+    } else {
+        return;
+    }
+    heap[i] = m;
+}
+
+/* jaro_winkler's default, used by best_matches */
+#define BEST_PREFIX_WEIGHT  0.1
+
+struct _best_job {
+    const struct _pattern *pattern;
+    enum metric metric;
+    const char **src;
+    Py_ssize_t *len;
+    Py_ssize_t k;
+    double limit;               /* threshold as a key */
+    const int32_t *hist;        /* query symbol counts, by id */
+    PyThread_type_lock lock;
+    struct _match *heap;        /* merged results of all chunks */
+    Py_ssize_t size;
+    int nomem;
+};
+
+/*
+ * Lower bound of the key of a candidate of n symbols, of which `common`
+ * can be matched one-to-one with query symbols.
+ */
+static double _best_bound(const struct _best_job *job, Py_ssize_t n, Py_ssize_t common) {
+    Py_ssize_t m = job->pattern->len;
+    switch(job->metric) {
+    case METRIC_LEVENSHTEIN:
+    case METRIC_DAMERAU:
+        /* each edit fixes at most one surplus symbol on either side */
+        return (double)((m - common) > (n - common) ? m - common : n - common);
+    case METRIC_LCS:
+        return -(double)common;
+    case METRIC_JARO_WINKLER:
+        if(common == 0)
+            return m == 0 && n == 0 ? -1.0 : 0.0;
+        double sim = ((double)common / m + (double)common / n + 1.0) / 3.0;
+        if(sim > 0.7)
+            sim += 4 * BEST_PREFIX_WEIGHT * (1.0 - sim);
+        return -(sim + 1e-12);
+    }
+    return 0.0;
+}
+
+static void _best_job_run(void *arg, Py_ssize_t start, Py_ssize_t end) {
+    struct _best_job *job = arg;
+    const struct _pattern *p = job->pattern;
+    Py_ssize_t m = p->len;
+    Py_ssize_t maxlen = 1;
+    for(Py_ssize_t i = start; i < end; ++i)
+        if(job->len[i] > maxlen)
+            maxlen = job->len[i];
+
+    uint32_t *text = PyMem_RawMalloc(maxlen * sizeof(uint32_t));
+    int32_t *diff = PyMem_RawMalloc(p->sigma * sizeof(int32_t));
+    struct _match *heap = PyMem_RawMalloc(job->k * sizeof(struct _match));
+    Py_ssize_t size = 0;
+    int nomem = !text || !diff || !heap;
+    if(nomem)
+        goto done;
+    memcpy(diff, job->hist, p->sigma * sizeof(int32_t));
+
+    PyThread_acquire_lock(job->lock, WAIT_LOCK);
+    double limit = job->limit;
+    if(job->size == job->k && job->heap[0].key < limit)
+        limit = job->heap[0].key;
+    PyThread_release_lock(job->lock);
+
+    for(Py_ssize_t i = start; i < end; ++i) {
+        double lim = size == job->k && heap[0].key < limit ? heap[0].key : limit;
+        if(!p->codepoints && _best_bound(job, job->len[i], m < job->len[i] ? m : job->len[i]) > lim)
+            continue;
+        Py_ssize_t n = _pattern_text(p, job->src[i], job->len[i], text);
+
+        /* character histogram: symbols of the candidate in excess of the query's */
+        Py_ssize_t excess = 0;
+        for(Py_ssize_t j = 0; j < n; ++j)
+            excess += diff[text[j]]-- <= 0;
+        for(Py_ssize_t j = 0; j < n; ++j)
+            ++diff[text[j]];
+        if(_best_bound(job, n, n - excess) > lim)
+            continue;
+
+        double key = 0.0;
+        Py_ssize_t max = lim >= (double)(PY_SSIZE_T_MAX / 2) ? PY_SSIZE_T_MAX / 2 : (Py_ssize_t)lim;
+        Py_ssize_t d = 0;
+        switch(job->metric) {
+        case METRIC_LEVENSHTEIN:
+            d = _levenshtein_kernel(p, text, n, max);
+            key = (double)d;
+            break;
+        case METRIC_DAMERAU:
+            d = _osa_kernel(p, text, n, max);
+            key = (double)d;
+            break;
+        case METRIC_LCS:
+            d = _lcs_kernel(p, text, n);
+            key = -(double)d;
+            break;
+        case METRIC_JARO_WINKLER: {
+            double sim = _jaro_winkler_kernel(p, text, n, BEST_PREFIX_WEIGHT);
+            d = sim < 0 ? -1 : 0;
+            key = -sim;
+            break;
+        }
+        }
+        if(d < 0) {
+            nomem = 1;
+            break;
+        }
+        if(key <= lim)
+            _match_push(heap, &size, job->k, (struct _match){key, i});
+    }
+
+done:
+    PyThread_acquire_lock(job->lock, WAIT_LOCK);
+    for(Py_ssize_t i = 0; i < size; ++i)
+        _match_push(job->heap, &job->size, job->k, heap[i]);
+    job->nomem |= nomem;
+    PyThread_release_lock(job->lock);
+    PyMem_RawFree(text);
+    PyMem_RawFree(diff);
+    PyMem_RawFree(heap);
+}
+
+static const struct {
+    const char *name;
+    enum metric metric;
+} _metric_names[] = {
+    {"levenshtein", METRIC_LEVENSHTEIN},
+    {"damerau", METRIC_DAMERAU},
+    {"lcs_len", METRIC_LCS},
+    {"jaro_winkler", METRIC_JARO_WINKLER},
+};
+
+PyDoc_STRVAR(best_matches__doc__,
+"best_matches(query, candidates, metric='levenshtein', k=1, threshold=None,\n"
+"             codepoints=False, threads=0) -> (indices, scores)\n"
+"\n"
+"The k candidates closest to query under metric (levenshtein, damerau,\n"
+"lcs_len or jaro_winkler), best first, scoring no worse than threshold.\n"
+"Candidates are scored on `threads` threads (0: os.cpu_count()) with the\n"
+"GIL released.");
+static PyObject *cstring_best_matches(PyObject *module, PyObject *args, PyObject *kwargs) {
+    PyObject *queryobj, *candidatesobj;
+    const char *metricname = "levenshtein";
+    Py_ssize_t k = 1;
+    PyObject *thresholdobj = Py_None;
+    int codepoints = 0;
+    int threads = 0;
+    char *kwlist[] = {"query", "candidates", "metric", "k", "threshold", "codepoints", "threads", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|snOpi", kwlist,
+            &queryobj, &candidatesobj, &metricname, &k, &thresholdobj, &codepoints, &threads))
+        return NULL;
+
+    struct _best_job job = {.k = k, .limit = Py_HUGE_VAL};
+    size_t nmetrics = sizeof(_metric_names) / sizeof(_metric_names[0]);
+    size_t mi = 0;
+    while(mi < nmetrics && strcmp(_metric_names[mi].name, metricname) != 0)
+        ++mi;
+    if(mi == nmetrics) {
+        PyErr_Format(PyExc_ValueError, "unknown metric %s", metricname);
+        return NULL;
+    }
+    job.metric = _metric_names[mi].metric;
+    int similarity = job.metric == METRIC_LCS || job.metric == METRIC_JARO_WINKLER;
+    if(k < 1) {
+        PyErr_SetString(PyExc_ValueError, "k must be positive");
+        return NULL;
+    }
+    if(thresholdobj != Py_None) {
+        double threshold = PyFloat_AsDouble(thresholdobj);
+        if(threshold == -1.0 && PyErr_Occurred())
+            return NULL;
+        if(Py_IS_NAN(threshold)) {
+            PyErr_SetString(PyExc_ValueError, "threshold must not be NaN");
+            return NULL;
+        }
+        job.limit = similarity ? -threshold : threshold;
+    }
+
+    cstring_state *state = PyModule_GetState(module);
+    Py_buffer queryview;
+    Py_ssize_t querylen;
+    const char *query;
+    if(_pin_string(state, queryobj, &queryview, &query, &querylen) < 0)
+        return NULL;
+
+    /* pin the candidates while holding the GIL */
+    struct _pinned pinned;
+    if(_pinned_init(state, &pinned, candidatesobj, "best_matches() candidates must be a sequence") < 0) {
+        if(queryview.obj)
+            PyBuffer_Release(&queryview);
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    PyObject *indices = NULL, *scores = NULL;
+    struct _pattern pattern;
+    int have_pattern = 0;
+    Py_ssize_t count = pinned.count;
+    if(job.k > count)
+        job.k = count ? count : 1;
+    job.src = pinned.src;
+    job.len = pinned.len;
+    job.heap = PyMem_Malloc(job.k * sizeof(struct _match));
+    if(!job.heap) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    if(_pattern_init(&pattern, query, querylen, codepoints) < 0) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    have_pattern = 1;
+    int32_t *hist = PyMem_Calloc(pattern.sigma, sizeof(int32_t));
+    job.lock = PyThread_allocate_lock();
+    if(!hist || !job.lock) {
+        PyMem_Free(hist);
+        PyErr_NoMemory();
+        goto done;
+    }
+    for(Py_ssize_t i = 0; i < pattern.len; ++i)
+        ++hist[pattern.sym[i]];
+    job.pattern = &pattern;
+    job.hist = hist;
+
+    int rc = _parallel_for(count, threads, _best_job_run, &job);
+    PyMem_Free(hist);
+    if(rc < 0)
+        goto done;
+    if(job.nomem) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    qsort(job.heap, job.size, sizeof(struct _match), _match_cmp);
+    long long *outindex;
+    indices = _array_new("q", job.size, (void **)&outindex);
+    if(!indices)
+        goto done;
+    if(job.metric == METRIC_JARO_WINKLER) {
+        double *out;
+        scores = _array_new("d", job.size, (void **)&out);
+        for(Py_ssize_t i = 0; scores && i < job.size; ++i)
+            out[i] = -job.heap[i].key;
+    } else {
+        long long *out;
+        scores = _array_new("q", job.size, (void **)&out);
+        for(Py_ssize_t i = 0; scores && i < job.size; ++i)
+            out[i] = (long long)(similarity ? -job.heap[i].key : job.heap[i].key);
+    }
+    if(!scores)
+        goto done;
+    for(Py_ssize_t i = 0; i < job.size; ++i)
+        outindex[i] = job.heap[i].index;
+    result = PyTuple_Pack(2, indices, scores);
+
+done:
+    Py_XDECREF(indices);
+    Py_XDECREF(scores);
+    if(have_pattern)
+        _pattern_free(&pattern);
+    if(job.lock)
+        PyThread_free_lock(job.lock);
+    PyMem_Free(job.heap);
+    _pinned_release(&pinned);
+    if(queryview.obj)
+        PyBuffer_Release(&queryview);
+    return result;
+}
+
+/* Sort a[0:n], using tmp[0:n] as scratch: LSD radix sort on bytes, insertion sort when short. */
+static void _sort_u32(uint32_t *a, uint32_t *tmp, Py_ssize_t n) {
+    if(n <= 32) {
+        for(Py_ssize_t i = 1; i < n; ++i) {
+            uint32_t v = a[i];
+            Py_ssize_t j = i;
+            for(; j > 0 && a[j - 1] > v; --j)
+                a[j] = a[j - 1];
+            a[j] = v;
+        }
+        return;
+    }
+    uint32_t *src = a, *dst = tmp;
+    for(int shift = 0; shift < 32; shift += 8) {
+        Py_ssize_t count[256] = {0};
+        for(Py_ssize_t i = 0; i < n; ++i)
+            ++count[(src[i] >> shift) & 0xFF];
+        if(count[(src[0] >> shift) & 0xFF] == n)
+            continue;       /* all share this byte */
+        Py_ssize_t pos = 0;
+        for(int b = 0; b < 256; ++b) {
+            Py_ssize_t c = count[b];
+            count[b] = pos;
+            pos += c;
+        }
+        for(Py_ssize_t i = 0; i < n; ++i)
+            dst[count[(src[i] >> shift) & 0xFF]++] = src[i];
+        uint32_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if(src != a)
+        memcpy(a, src, n * sizeof(uint32_t));
+}
+
+/* Units n-grams are made of. */
+enum {
+    ANALYZER_WORD,  /* runs of non-whitespace bytes */
+    ANALYZER_CHAR,  /* UTF-8 sequences */
+};
+
+/* ANALYZER_* named `name`, or -1 with ValueError set. */
+static int _analyzer_from_name(const char *name) {
+    if(strcmp(name, "word") == 0)
+        return ANALYZER_WORD;
+    if(strcmp(name, "char") == 0)
+        return ANALYZER_CHAR;
+    PyErr_Format(PyExc_ValueError, "unknown analyzer %s", name);
+    return -1;
+}
+
+/* Feature counts of one document: indices in buf[0:nnz], counts in buf[cap:cap + nnz]. */
+struct _doc_features {
+    uint32_t *buf;
+    Py_ssize_t cap;
+    Py_ssize_t nnz;
+};
+
+struct _vectorize_job {
+    int analyzer;
+    Py_ssize_t nmin, nmax;
+    uint64_t n_features;
+    uint64_t seed;
+    const char **src;
+    Py_ssize_t *len;
+    struct _doc_features *docs;
+    PyThread_type_lock lock;    /* guards nomem */
+    int nomem;
+};
+
+/* Units of a document that n-grams are made of, and (words) their hashes. */
+struct _ngram_units {
+    int analyzer;
+    Py_ssize_t count;
+    Py_ssize_t *start;      /* unit i is s[start[i]:end[i]] */
+    Py_ssize_t *end;
+    uint64_t *tokens;
+};
+
+/* Returns -1 if out of memory. */
+static int _ngram_units_init(struct _ngram_units *u, int analyzer, const char *s, Py_ssize_t len, uint64_t seed) {
+    Py_ssize_t cap = len ? len : 1;
+    u->analyzer = analyzer;
+    u->count = 0;
+    u->start = PyMem_RawMalloc(cap * (2 * sizeof(Py_ssize_t) + sizeof(uint64_t)));
+    if(!u->start)
+        return -1;
+    u->end = u->start + cap;
+    u->tokens = (uint64_t *)(u->end + cap);
+
+    if(analyzer == ANALYZER_WORD) {
+        for(Py_ssize_t i = 0; i < len; ) {
+            while(i < len && Py_ISSPACE(s[i]))
+                ++i;
+            if(i == len)
+                break;
+            u->start[u->count] = i;
+            while(i < len && !Py_ISSPACE(s[i]))
+                ++i;
+            u->end[u->count] = i;
+            u->tokens[u->count] = _fast_hash(s + u->start[u->count], i - u->start[u->count], seed);
+            ++u->count;
+        }
+    } else {
+        for(Py_ssize_t i = 0; i < len; ++u->count) {
+            u->start[u->count] = i;
+            i += _utf8_seqlen((const unsigned char *)s + i, len - i);
+            u->end[u->count] = i;
+        }
+    }
+    return 0;
+}
+
+static void _ngram_units_free(struct _ngram_units *u) {
+    PyMem_RawFree(u->start);
+}
+
+/*
+ * Hash of the n-gram of units i..i+n-1, straight from its byte range; for
+ * words, from the hashes of its tokens (so the whitespace between them
+ * does not matter).
+ */
+static inline uint64_t _ngram_hash(const struct _ngram_units *u, const char *s, Py_ssize_t i, Py_ssize_t n, uint64_t seed) {
+    if(u->analyzer == ANALYZER_WORD)
+        return n == 1 ? u->tokens[i] : _fast_hash((const char *)(u->tokens + i), n * sizeof(uint64_t), seed + n);
+    return _fast_hash(s + u->start[i], u->end[i + n - 1] - u->start[i], seed);
+}
+
+/* Count the hashed n-grams of s[0:len]. Returns -1 if out of memory. */
+static int _vectorize_doc(const struct _vectorize_job *job, const char *s, Py_ssize_t len, struct _doc_features *out) {
+    out->buf = NULL;
+    out->cap = out->nnz = 0;
+
+    struct _ngram_units units;
+    if(_ngram_units_init(&units, job->analyzer, s, len, job->seed) < 0)
+        return -1;
+    Py_ssize_t total = 0;
+    for(Py_ssize_t n = job->nmin; n <= job->nmax && n <= units.count; ++n)
+        total += units.count - n + 1;
+    uint32_t *features = total ? PyMem_RawMalloc(2 * total * sizeof(uint32_t)) : NULL;
+    if(total && !features) {
+        _ngram_units_free(&units);
+        return -1;
+    }
+    Py_ssize_t k = 0;
+    for(Py_ssize_t n = job->nmin; n <= job->nmax && n <= units.count; ++n)
+        for(Py_ssize_t i = 0; i + n <= units.count; ++i)
+            features[k++] = (uint32_t)(_ngram_hash(&units, s, i, n, job->seed) % job->n_features);
+    _ngram_units_free(&units);
+    if(total == 0)
+        return 0;
+
+    /* sort, then collapse runs into (index, count) */
+    uint32_t *counts = features + total;
+    _sort_u32(features, counts, total);
+    Py_ssize_t nnz = 0;
+    for(Py_ssize_t i = 0; i < total; ) {
+        Py_ssize_t j = i + 1;
+        while(j < total && features[j] == features[i])
+            ++j;
+        features[nnz] = features[i];
+        counts[nnz++] = (uint32_t)(j - i);
+        i = j;
+    }
+    out->buf = features;
+    out->cap = total;
+    out->nnz = nnz;
+    return 0;
+}
+
+static void _vectorize_job_run(void *arg, Py_ssize_t start, Py_ssize_t end) {
+    struct _vectorize_job *job = arg;
+    for(Py_ssize_t i = start; i < end; ++i) {
+        if(_vectorize_doc(job, job->src[i], job->len[i], &job->docs[i]) < 0) {
+            PyThread_acquire_lock(job->lock, WAIT_LOCK);
+            job->nomem = 1;
+            PyThread_release_lock(job->lock);
+            return;
+        }
+    }
+}
+
+PyDoc_STRVAR(hash_vectorize__doc__,
+"hash_vectorize(docs, n_features=1048576, analyzer='word', ngram_range=(1, 1),\n"
+"               seed=0, threads=0) -> (indptr, indices, counts)\n"
+"\n"
+"Hashed bag-of-n-grams counts of docs (one document, or a sequence of\n"
+"them) in CSR form. n-grams are hashed from their byte ranges without\n"
+"creating strings; documents are processed on `threads` threads\n"
+"(0: os.cpu_count()) with the GIL released.");
+static PyObject *cstring_hash_vectorize(PyObject *module, PyObject *args, PyObject *kwargs) {
+    PyObject *docsobj;
+    Py_ssize_t n_features = 1 << 20;
+    const char *analyzer = "word";
+    PyObject *rangeobj = NULL;
+    unsigned long long seed = 0;
+    int threads = 0;
+    char *kwlist[] = {"docs", "n_features", "analyzer", "ngram_range", "seed", "threads", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|nsOKi", kwlist,
+            &docsobj, &n_features, &analyzer, &rangeobj, &seed, &threads))
+        return NULL;
+
+    struct _vectorize_job job = {.nmin = 1, .nmax = 1, .seed = seed};
+    if(n_features < 1 || n_features > INT32_MAX) {
+        PyErr_SetString(PyExc_ValueError, "n_features must be between 1 and 2**31 - 1");
+        return NULL;
+    }
+    job.n_features = (uint64_t)n_features;
+    job.analyzer = _analyzer_from_name(analyzer);
+    if(job.analyzer < 0)
+        return NULL;
+    if(rangeobj) {
+        if(!PyTuple_Check(rangeobj)) {
+            PyErr_SetString(PyExc_TypeError, "ngram_range must be a tuple (min, max)");
+            return NULL;
+        }
+        if(!PyArg_ParseTuple(rangeobj, "nn;ngram_range must be a tuple (min, max)", &job.nmin, &job.nmax))
+            return NULL;
+    }
+    if(job.nmin < 1 || job.nmax < job.nmin) {
+        PyErr_SetString(PyExc_ValueError, "ngram_range must satisfy 1 <= min <= max");
+        return NULL;
+    }
+
+    cstring_state *state = PyModule_GetState(module);
+    int single = PyUnicode_Check(docsobj) || PyBytes_Check(docsobj) || PyObject_TypeCheck(docsobj, state->cstring_type);
+    PyObject *seq = single ? PyTuple_Pack(1, docsobj) : (Py_INCREF(docsobj), docsobj);
+    if(!seq)
+        return NULL;
+
+    /* pin the documents while holding the GIL */
+    struct _pinned pinned;
+    int rc = _pinned_init(state, &pinned, seq, "hash_vectorize() docs must be a string or a sequence");
+    Py_DECREF(seq);
+    if(rc < 0)
+        return NULL;
+
+    PyObject *result = NULL;
+    PyObject *indptr = NULL, *indices = NULL, *counts = NULL;
+    Py_ssize_t count = pinned.count;
+    job.src = pinned.src;
+    job.len = pinned.len;
+    job.docs = PyMem_Calloc(count ? count : 1, sizeof(struct _doc_features));
+    job.lock = PyThread_allocate_lock();
+    if(!job.docs || !job.lock) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    if(_parallel_for(count, threads, _vectorize_job_run, &job) < 0)
+        goto done;
+    if(job.nomem) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    Py_ssize_t nnz = 0;
+    for(Py_ssize_t i = 0; i < count; ++i)
+        nnz += job.docs[i].nnz;
+    long long *outptr;
+    int *outindex, *outcount;
+    indptr = _array_new("q", count + 1, (void **)&outptr);
+    if(!indptr)
+        goto done;
+    indices = _array_new("i", nnz, (void **)&outindex);
+    if(!indices)
+        goto done;
+    counts = _array_new("i", nnz, (void **)&outcount);
+    if(!counts)
+        goto done;
+    outptr[0] = 0;
+    for(Py_ssize_t i = 0, pos = 0; i < count; ++i) {
+        const struct _doc_features *doc = &job.docs[i];
+        for(Py_ssize_t j = 0; j < doc->nnz; ++j) {
+            outindex[pos + j] = (int)doc->buf[j];
+            outcount[pos + j] = (int)doc->buf[doc->cap + j];
+        }
+        pos += doc->nnz;
+        outptr[i + 1] = pos;
+    }
+    result = PyTuple_Pack(3, indptr, indices, counts);
+
+done:
+    Py_XDECREF(indptr);
+    Py_XDECREF(indices);
+    Py_XDECREF(counts);
+    if(job.docs)
+        for(Py_ssize_t i = 0; i < count; ++i)
+            PyMem_RawFree(job.docs[i].buf);
+    PyMem_Free(job.docs);
+    if(job.lock)
+        PyThread_free_lock(job.lock);
+    _pinned_release(&pinned);
+    return result;
+}
+
+/*
+ * Sketches for near-duplicate detection, computed over shingles: n-grams
+ * of `shingle` units (a shorter document is a single shingle).
+ */
+struct _sketch_job {
+    int analyzer;
+    Py_ssize_t shingle;
+    uint64_t seed;
+    Py_ssize_t nperm;
+    const uint64_t *perm;       /* minhash: a[0:nperm], then b[0:nperm] */
+    PyObject *array;            /* batch input (a cstringarray) */
+    uint32_t *out_minhash;      /* nperm per document */
+    uint64_t *out_simhash;
+    PyThread_type_lock lock;    /* batches: guards nomem */
+    int nomem;
+};
+
+static uint64_t _splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Upper bound on num_perm, far beyond any useful signature length. */
+#define MINHASH_MAX_PERM    (1 << 20)
+
+/* Random multiply-add-shift parameters of nperm permutations, a then b. */
+static uint64_t *_minhash_perms(Py_ssize_t nperm, uint64_t seed) {
+    uint64_t *perm = PyMem_Malloc(2 * nperm * sizeof(uint64_t));
+    if(!perm)
+        return (uint64_t *)PyErr_NoMemory();
+    for(Py_ssize_t i = 0; i < 2 * nperm; ++i)
+        perm[i] = _splitmix64(&seed);
+    for(Py_ssize_t i = 0; i < nperm; ++i)
+        perm[i] |= 1;  /* multiply-shift needs an odd multiplier */
+    return perm;
+}
+
+/* Hashes of the shingles of s[0:len] into *hashes (PyMem_Raw); returns their count, or -1 if out of memory. */
+static Py_ssize_t _shingle_hashes(const struct _sketch_job *job, const char *s, Py_ssize_t len, uint64_t **hashes) {
+    struct _ngram_units units;
+    if(_ngram_units_init(&units, job->analyzer, s, len, job->seed) < 0)
+        return -1;
+    Py_ssize_t n = units.count < job->shingle ? units.count : job->shingle;
+    Py_ssize_t count = n ? units.count - n + 1 : 0;
+    uint64_t *out = PyMem_RawMalloc((count ? count : 1) * sizeof(uint64_t));
+    if(out)
+        for(Py_ssize_t i = 0; i < count; ++i)
+            out[i] = _ngram_hash(&units, s, i, n, job->seed);
+    _ngram_units_free(&units);
+    *hashes = out;
+    return out ? count : -1;
+}
+
+/* MinHash signature of s[0:len] into out[0:nperm]. Returns -1 if out of memory. */
+static int _minhash_doc(const struct _sketch_job *job, const char *s, Py_ssize_t len, uint32_t *out) {
+    uint64_t *x;
+    Py_ssize_t n = _shingle_hashes(job, s, len, &x);
+    if(n < 0)
+        return -1;
+    uint64_t small[256];
+    uint64_t *sig = job->nperm <= 256 ? small : PyMem_RawMalloc(job->nperm * sizeof(uint64_t));
+    if(!sig) {
+        PyMem_RawFree(x);
+        return -1;
+    }
+    for(Py_ssize_t j = 0; j < n; ++j)
+        x[j] = (uint32_t)(x[j] ^ (x[j] >> 32));
+    for(Py_ssize_t i = 0; i < job->nperm; ++i)
+        sig[i] = UINT32_MAX;
+    _kernel_minhash(sig, job->perm, job->perm + job->nperm, job->nperm, x, n);
+    for(Py_ssize_t i = 0; i < job->nperm; ++i)
+        out[i] = (uint32_t)sig[i];
+    if(sig != small)
+        PyMem_RawFree(sig);
+    PyMem_RawFree(x);
+    return 0;
+}
+
+/* SimHash of s[0:len]: bit b is set if most shingle hashes have it set. Returns -1 if out of memory. */
+static int _simhash_doc(const struct _sketch_job *job, const char *s, Py_ssize_t len, uint64_t *out) {
+    uint64_t *x;
+    Py_ssize_t n = _shingle_hashes(job, s, len, &x);
+    if(n < 0)
+        return -1;
+    int64_t votes[64] = {0};
+    for(Py_ssize_t j = 0; j < n; ++j)
+        for(int b = 0; b < 64; ++b)
+            votes[b] += (int64_t)((x[j] >> b) & 1) * 2 - 1;
+    uint64_t result = 0;
+    for(int b = 0; b < 64; ++b)
+        if(votes[b] > 0)
+            result |= (uint64_t)1 << b;
+    *out = result;
+    PyMem_RawFree(x);
+    return 0;
+}
+
+static void _sketch_job_run(void *arg, Py_ssize_t start, Py_ssize_t end) {
+    struct _sketch_job *job = arg;
+    for(Py_ssize_t i = start; i < end; ++i) {
+        const char *s = CSTRINGARRAY_VALUE(job->array, i);
+        Py_ssize_t len = CSTRINGARRAY_LEN(job->array, i);
+        int rc = job->out_minhash
+            ? _minhash_doc(job, s, len, job->out_minhash + i * job->nperm)
+            : _simhash_doc(job, s, len, &job->out_simhash[i]);
+        if(rc < 0) {
+            PyThread_acquire_lock(job->lock, WAIT_LOCK);
+            job->nomem = 1;
+            PyThread_release_lock(job->lock);
+            return;
+        }
+    }
+}
+
+/* Parse the sketch arguments into job (and *threads for batches). Returns -1 on error. */
+static int _sketch_args(PyObject *args, PyObject *kwargs, struct _sketch_job *job, int minhash, int *threads) {
+    const char *analyzer = "word";
+    unsigned long long seed = 0;
+    job->nperm = 128;
+    job->shingle = 5;
+    if(minhash) {
+        char *kwlist[] = {"num_perm", "shingle", "analyzer", "seed", "threads", NULL};
+        if(!threads)
+            kwlist[4] = NULL;
+        if(!PyArg_ParseTupleAndKeywords(args, kwargs, threads ? "|nnsKi" : "|nnsK", kwlist,
+                &job->nperm, &job->shingle, &analyzer, &seed, threads))
+            return -1;
+        if(job->nperm < 1) {
+            PyErr_SetString(PyExc_ValueError, "num_perm must be positive");
+            return -1;
+        }
+        if(job->nperm > MINHASH_MAX_PERM) {
+            PyErr_Format(PyExc_ValueError, "num_perm must be at most %d", MINHASH_MAX_PERM);
+            return -1;
+        }
+    } else {
+        char *kwlist[] = {"shingle", "analyzer", "seed", "threads", NULL};
+        if(!threads)
+            kwlist[3] = NULL;
+        if(!PyArg_ParseTupleAndKeywords(args, kwargs, threads ? "|nsKi" : "|nsK", kwlist,
+                &job->shingle, &analyzer, &seed, threads))
+            return -1;
+    }
+    if(job->shingle < 1) {
+        PyErr_SetString(PyExc_ValueError, "shingle must be positive");
+        return -1;
+    }
+    job->seed = seed;
+    job->analyzer = _analyzer_from_name(analyzer);
+    return job->analyzer < 0 ? -1 : 0;
+}
+
+static PyObject *cstring_minhash(PyObject *self, PyObject *args, PyObject *kwargs) {
+    struct _sketch_job job = {0};
+    if(_sketch_args(args, kwargs, &job, 1, NULL) < 0)
+        return NULL;
+    uint64_t *perm = _minhash_perms(job.nperm, job.seed);
+    if(!perm)
+        return NULL;
+    job.perm = perm;
+    uint32_t *out;
+    PyObject *result = _array_new("I", job.nperm, (void **)&out);
+    if(result && _minhash_doc(&job, CSTRING_VALUE(self), cstring_len(self), out) < 0)
+        Py_SETREF(result, PyErr_NoMemory());
+    PyMem_Free(perm);
+    return result;
+}
+
+static PyObject *cstring_simhash(PyObject *self, PyObject *args, PyObject *kwargs) {
+    struct _sketch_job job = {0};
+    if(_sketch_args(args, kwargs, &job, 0, NULL) < 0)
+        return NULL;
+    uint64_t result;
+    if(_simhash_doc(&job, CSTRING_VALUE(self), cstring_len(self), &result) < 0)
+        return PyErr_NoMemory();
+    return PyLong_FromUnsignedLongLong(result);
+}
+
+static PyObject *_cstringarray_sketch(PyObject *self, PyObject *args, PyObject *kwargs, int minhash) {
+    struct _sketch_job job = {.array = self};
+    int threads = 0;
+    if(_sketch_args(args, kwargs, &job, minhash, &threads) < 0)
+        return NULL;
+    Py_ssize_t count = CSTRINGARRAY_COUNT(self);
+    uint64_t *perm = NULL;
+    PyObject *result;
+    if(minhash) {
+        perm = _minhash_perms(job.nperm, job.seed);
+        if(!perm)
+            return NULL;
+        job.perm = perm;
+        if(count > PY_SSIZE_T_MAX / job.nperm) {
+            PyMem_Free(perm);
+            return PyErr_NoMemory();
+        }
+        result = _array_new("I", count * job.nperm, (void **)&job.out_minhash);
+    } else {
+        result = _array_new("Q", count, (void **)&job.out_simhash);
+    }
+    job.lock = result ? PyThread_allocate_lock() : NULL;
+    if(result && !job.lock)
+        Py_SETREF(result, PyErr_NoMemory());
+    if(result && _parallel_for(count, threads, _sketch_job_run, &job) < 0)
+        Py_CLEAR(result);
+    if(result && job.nomem)
+        Py_SETREF(result, PyErr_NoMemory());
+    if(job.lock)
+        PyThread_free_lock(job.lock);
+    PyMem_Free(perm);
+    return result;
+}
+
+static PyObject *cstringarray_minhash(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return _cstringarray_sketch(self, args, kwargs, 1);
+}
+
+static PyObject *cstringarray_simhash(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return _cstringarray_sketch(self, args, kwargs, 0);
+}
+
+PyDoc_STRVAR(stats__doc__,
+"stats() -> dict\n"
+"\n"
+"Process-wide operation counters. All zero unless enable_stats() was called.");
+static PyObject *cstring_stats(PyObject *module, PyObject *Py_UNUSED(args)) {
+    PyObject *result = PyDict_New();
+    if(!result)
+        return NULL;
+#ifndef CSTRING_NO_STATS
+#define X(name) \
+    do { \
+        PyObject *v = PyLong_FromSsize_t(_ATOMIC_LOAD(&_stats.name)); \
+        if(!v || PyDict_SetItemString(result, #name, v) < 0) { \
+            Py_XDECREF(v); \
+            Py_DECREF(result); \
+            return NULL; \
+        } \
+        Py_DECREF(v); \
+    } while(0);
+    CSTRING_STATS_FIELDS(X)
+#undef X
+#endif
+    return result;
+}
+
+PyDoc_STRVAR(reset_stats__doc__,
+"reset_stats()\n"
+"\n"
+"Zero all counters reported by stats().");
+static PyObject *cstring_reset_stats(PyObject *module, PyObject *Py_UNUSED(args)) {
+#ifndef CSTRING_NO_STATS
+#define X(name) _ATOMIC_STORE(&_stats.name, 0);
+    CSTRING_STATS_FIELDS(X)
+#undef X
+#endif
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(enable_stats__doc__,
+"enable_stats(enabled=True) -> bool\n"
+"\n"
+"Turn counter collection on or off; returns the previous setting.\n"
+"Always returns False if counters were compiled out.");
+static PyObject *cstring_enable_stats(PyObject *module, PyObject *args) {
+    int enabled = 1;
+    if(!PyArg_ParseTuple(args, "|p", &enabled))
+        return NULL;
+#ifndef CSTRING_NO_STATS
+    int previous = _ATOMIC_LOAD(&_stats_enabled);
+    _ATOMIC_STORE(&_stats_enabled, enabled);
+    return PyBool_FromLong(previous);
+#else
+    Py_RETURN_FALSE;
+#endif
+}
+
+/*
+ * Memory accounting: sum sys.getsizeof() over every object reachable from
+ * the argument through lists, tuples, dicts, sets and categorical
+ * categories, counting each object (and so each shared buffer) once.
+ */
+struct _memwalk {
+    PyObject *seen;         /* set of ids */
+    PyObject *getsizeof;
+    cstring_state *state;
+    Py_ssize_t total;
+};
+
+static int _memwalk_visit(struct _memwalk *w, PyObject *o);
+
+static int _memwalk_visit_iterable(struct _memwalk *w, PyObject *o) {
+    PyObject *it = PyObject_GetIter(o);
+    if(!it)
+        return -1;
+    PyObject *item;
+    while((item = PyIter_Next(it))) {
+        int rc = _memwalk_visit(w, item);
+        Py_DECREF(item);
+        if(rc < 0) {
+            Py_DECREF(it);
+            return -1;
+        }
+    }
+    Py_DECREF(it);
+    return PyErr_Occurred() ? -1 : 0;
+}
+
+static int _memwalk_visit(struct _memwalk *w, PyObject *o) {
+    PyObject *id = PyLong_FromVoidPtr(o);
+    if(!id)
+        return -1;
+    int seen = PySet_Contains(w->seen, id);
+    if(seen == 0)
+        seen = PySet_Add(w->seen, id);
+    else if(seen > 0)
+        seen = 1;
+    Py_DECREF(id);
+    if(seen != 0)
+        return seen < 0 ? -1 : 0;
+
+    PyObject *size = PyObject_CallOneArg(w->getsizeof, o);
+    if(!size)
+        return -1;
+    w->total += PyLong_AsSsize_t(size);
+    Py_DECREF(size);
+    if(PyErr_Occurred())
+        return -1;
+
+    if(Py_EnterRecursiveCall(" in total_memory"))
+        return -1;
+    int rc = 0;
+    if(PyObject_TypeCheck(o, w->state->cstring_type)) {
+        if(((struct cstring *)o)->base)
+            rc = _memwalk_visit(w, ((struct cstring *)o)->base);
+    } else if(PyObject_TypeCheck(o, w->state->cstringcategorical_type)) {
+        rc = _memwalk_visit(w, ((struct cstringcategorical *)o)->categories);
+    } else if(PyList_Check(o) || PyTuple_Check(o) || PyAnySet_Check(o)) {
+        rc = _memwalk_visit_iterable(w, o);
+    } else if(PyDict_Check(o)) {
+        PyObject *key, *value;
+        Py_ssize_t pos = 0;
+        while(rc == 0 && PyDict_Next(o, &pos, &key, &value)) {
+            rc = _memwalk_visit(w, key);
+            if(rc == 0)
+                rc = _memwalk_visit(w, value);
+        }
+    }
+    Py_LeaveRecursiveCall();
+    return rc;
+}
+
+PyDoc_STRVAR(total_memory__doc__,
+"total_memory(objs) -> int\n"
+"\n"
+"Bytes used by objs and everything reachable from it through lists,\n"
+"tuples, dicts, sets and categoricals, counting shared objects once.");
+static PyObject *cstring_total_memory(PyObject *module, PyObject *objs) {
+    struct _memwalk w = {.state = PyModule_GetState(module)};
+    PyObject *sys = PyImport_ImportModule("sys");
+    if(!sys)
+        return NULL;
+    w.getsizeof = PyObject_GetAttrString(sys, "getsizeof");
+    Py_DECREF(sys);
+    if(!w.getsizeof)
+        return NULL;
+    w.seen = PySet_New(NULL);
+    if(!w.seen) {
+        Py_DECREF(w.getsizeof);
+        return NULL;
+    }
+
+    int rc = _memwalk_visit(&w, objs);
+    Py_DECREF(w.seen);
+    Py_DECREF(w.getsizeof);
+    return rc < 0 ? NULL : PyLong_FromSsize_t(w.total);
+}
+
+PyDoc_STRVAR(cpu_features__doc__,
+"cpu_features() -> dict\n"
+"\n"
+"The kernel variant in use ('kernels'), the variants compiled in\n"
+"('available') and whether this CPU supports each of them.");
+static PyObject *cstring_cpu_features(PyObject *module, PyObject *Py_UNUSED(args)) {
+    PyObject *available = PyTuple_New(NKERNEL_TABLES);
+    if(!available)
+        return NULL;
+    PyObject *result = PyDict_New();
+    if(!result) {
+        Py_DECREF(available);
+        return NULL;
+    }
+    for(int i = 0; i < NKERNEL_TABLES; ++i) {
+        PyObject *name = PyUnicode_FromString(_kernel_tables[i].name);
+        if(!name)
+            goto fail;
+        PyTuple_SET_ITEM(available, i, name);
+        if(PyDict_SetItem(result, name, _kernel_table_supported(&_kernel_tables[i]) ? Py_True : Py_False) < 0)
+            goto fail;
+    }
+    if(PyDict_SetItemString(result, "available", available) < 0)
+        goto fail;
+    Py_DECREF(available);
+
+    PyObject *name = PyUnicode_FromString(_ATOMIC_LOAD(&_kernels)->name);
+    if(!name || PyDict_SetItemString(result, "kernels", name) < 0) {
+        Py_XDECREF(name);
+        Py_DECREF(result);
+        return NULL;
+    }
+    Py_DECREF(name);
+    return result;
+
+fail:
+    Py_DECREF(available);
+    Py_DECREF(result);
+    return NULL;
+}
+
+PyDoc_STRVAR(set_hugepage_threshold__doc__,
+"set_hugepage_threshold(nbytes) -> int\n"
+"\n"
+"Store new cstrings of at least nbytes in huge-page-backed mappings; 0\n"
+"disables this. Returns the previous threshold.");
+static PyObject *cstring_set_hugepage_threshold(PyObject *module, PyObject *arg) {
+    Py_ssize_t threshold = PyLong_AsSsize_t(arg);
+    if(threshold == -1 && PyErr_Occurred())
+        return NULL;
+    if(threshold < 0) {
+        PyErr_SetString(PyExc_ValueError, "threshold must be non-negative");
+        return NULL;
+    }
+#ifndef CSTRING_HAVE_MMAP
+    if(threshold > 0) {
+        PyErr_SetString(PyExc_NotImplementedError, "huge-page storage is not available on this platform");
+        return NULL;
+    }
+#endif
+    Py_ssize_t previous = _ATOMIC_LOAD(&_hugepage_threshold);
+    _ATOMIC_STORE(&_hugepage_threshold, threshold);
+    return PyLong_FromSsize_t(previous);
+}
+
+static PyMethodDef module_methods[] = {
+    {"best_matches", (PyCFunction)cstring_best_matches, METH_VARARGS | METH_KEYWORDS, best_matches__doc__},
+    {"concat_columns", (PyCFunction)cstring_concat_columns, METH_VARARGS | METH_KEYWORDS, concat_columns__doc__},
+    {"cpu_features", cstring_cpu_features, METH_NOARGS, cpu_features__doc__},
+    {"damerau", (PyCFunction)cstring_damerau, METH_VARARGS | METH_KEYWORDS, damerau__doc__},
+    {"enable_stats", cstring_enable_stats, METH_VARARGS, enable_stats__doc__},
+    {"group_indices", cstring_group_indices, METH_O, group_indices__doc__},
+    {"group_sum", cstring_group_sum, METH_VARARGS, group_sum__doc__},
+    {"hash_vectorize", (PyCFunction)cstring_hash_vectorize, METH_VARARGS | METH_KEYWORDS, hash_vectorize__doc__},
+    {"jaro_winkler", (PyCFunction)cstring_jaro_winkler, METH_VARARGS | METH_KEYWORDS, jaro_winkler__doc__},
+    {"lcs_len", (PyCFunction)cstring_lcs_len, METH_VARARGS | METH_KEYWORDS, lcs_len__doc__},
+    {"levenshtein", (PyCFunction)cstring_levenshtein, METH_VARARGS | METH_KEYWORDS, levenshtein__doc__},
+    {"lookup", cstring_lookup, METH_VARARGS, lookup__doc__},
+    {"parallel_map", (PyCFunction)cstring_parallel_map, METH_VARARGS | METH_KEYWORDS, parallel_map__doc__},
+    {"reset_stats", cstring_reset_stats, METH_NOARGS, reset_stats__doc__},
+    {"set_hugepage_threshold", cstring_set_hugepage_threshold, METH_O, set_hugepage_threshold__doc__},
+    {"stats", cstring_stats, METH_NOARGS, stats__doc__},
+    {"total_memory", cstring_total_memory, METH_O, total_memory__doc__},
+    {0},
+};
+
+static int module_traverse(PyObject *m, visitproc visit, void *arg) {
+    cstring_state *state = PyModule_GetState(m);
+    Py_VISIT(state->cstring_type);
+    Py_VISIT(state->cstringarray_type);
+    Py_VISIT(state->cstringcategorical_type);
+    Py_VISIT(state->asplit_type);
+    Py_VISIT(state->template_type);
+    Py_VISIT(state->empty);
+    Py_VISIT(state->format_cache);
+    return 0;
+}
+
+static int module_clear(PyObject *m) {
+    cstring_state *state = PyModule_GetState(m);
+    Py_CLEAR(state->cstring_type);
+    Py_CLEAR(state->cstringarray_type);
+    Py_CLEAR(state->cstringcategorical_type);
+    Py_CLEAR(state->asplit_type);
+    Py_CLEAR(state->template_type);
+    Py_CLEAR(state->empty);
+    Py_CLEAR(state->format_cache);
+    return 0;
+}
+
+static void module_free(void *m) {
+    module_clear((PyObject *)m);
+}
+
+static PyTypeObject *_add_type(PyObject *m, PyType_Spec *spec) {
+    PyTypeObject *type = (PyTypeObject *)PyType_FromModuleAndSpec(m, spec, NULL);
+    if(!type)
+        return NULL;
+    if(PyModule_AddType(m, type) < 0) {
+        Py_DECREF(type);
+        return NULL;
+    }
+    return type;
+}
+
+static int module_exec(PyObject *m) {
+    cstring_state *state = PyModule_GetState(m);
+
+    if(_hash_seed_init() < 0)
+        return -1;
+
+    if(_kernels_init() < 0) {
+        if(PyErr_WarnFormat(PyExc_RuntimeWarning, 1,
+                "CSTRING_KERNELS=%s is unknown or unsupported on this CPU; using %s",
+                getenv("CSTRING_KERNELS"), _ATOMIC_LOAD(&_kernels)->name) < 0)
+            return -1;
+    }
+
+    state->cstring_type = _add_type(m, &cstring_spec);
+    if(!state->cstring_type)
+        return -1;
+    state->cstringarray_type = _add_type(m, &cstringarray_spec);
+    if(!state->cstringarray_type)
+        return -1;
+    state->cstringcategorical_type = _add_type(m, &cstringcategorical_spec);
+    if(!state->cstringcategorical_type)
+        return -1;
+    state->asplit_type = (PyTypeObject *)PyType_FromModuleAndSpec(m, &cstring_asplit_spec, NULL);
+    if(!state->asplit_type)
+        return -1;
+
+    state->template_type = _add_type(m, &cstring_template_spec);
+    if(!state->template_type)
+        return -1;
+
+    state->empty = _cstring_new(state->cstring_type, "", 0);
+    if(!state->empty)
+        return -1;
+    state->format_cache = PyDict_New();
+    if(!state->format_cache)
+        return -1;
+
+    return 0;
+}
+
+static PyModuleDef_Slot module_slots[] = {
+    {Py_mod_exec, module_exec},
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL},
+};
+
+static struct PyModuleDef module = {
+    .m_base = PyModuleDef_HEAD_INIT,
+    .m_name = "cstring",
+    .m_doc = "",
+    .m_size = sizeof(cstring_state),
+    .m_methods = module_methods,
+    .m_slots = module_slots,
+    .m_traverse = module_traverse,
+    .m_clear = module_clear,
+    .m_free = module_free,
+};
+
+PyMODINIT_FUNC PyInit_cstring(void) {
+    return PyModuleDef_Init(&module);
 }
@@ -0,0 +1,92 @@
+import array
+import pytest
+from cstring import cstring, cstringarray, concat_columns, lookup
+
+
+def test_new():
+    target = cstringarray(['hello', b'world', cstring('!')])
+    assert len(target) == 3
+    assert list(target) == [cstring('hello'), cstring('world'), cstring('!')]
+
+
+def test_new_empty():
+    assert len(cstringarray()) == 0
+
+
+def test_subscript():
+    target = cstringarray(['a', 'bb', 'ccc'])
+    assert target[1] == cstring('bb')
+    assert target[-1] == cstring('ccc')
+
+
+def test_subscript_out_of_bounds():
+    with pytest.raises(IndexError):
+        cstringarray(['a'])[1]
+
+
+def test_eq():
+    assert cstringarray(['a', 'b']) == cstringarray(['a', 'b'])
+    assert cstringarray(['a', 'b']) != cstringarray(['ab'])
+
+
+def test_take():
+    target = cstringarray(['zero', 'one', 'two', 'three'])
+    assert target.take([3, 0, 0, -2]) == cstringarray(['three', 'zero', 'zero', 'two'])
+
+
+def test_take_buffer():
+    target = cstringarray(['zero', 'one', 'two', 'three'])
+    assert target.take(array.array('q', [1, 2])) == cstringarray(['one', 'two'])
+
+
+def test_take_out_of_bounds():
+    with pytest.raises(IndexError):
+        cstringarray(['zero']).take([1])
+    with pytest.raises(IndexError):
+        cstringarray(['zero']).take(array.array('Q', [2**64 - 1]))
+
+
+def test_filter():
+    target = cstringarray(['zero', 'one', 'two', 'three'])
+    assert target.filter([True, False, False, True]) == cstringarray(['zero', 'three'])
+
+
+def test_filter_buffer():
+    target = cstringarray(['zero', 'one', 'two', 'three'])
+    assert target.filter(b'\x00\x01\x01\x00') == cstringarray(['one', 'two'])
+
+
+def test_filter_bad_length():
+    with pytest.raises(ValueError):
+        cstringarray(['zero']).filter([True, False])
+
+
+def test_concat_columns():
+    a = cstringarray(['GET', 'POST'])
+    b = ['/index', '/form']
+    c = cstringarray(['200', '302'])
+    result = concat_columns([a, b, c], sep=b'|')
+    assert result == cstringarray(['GET|/index|200', 'POST|/form|302'])
+
+
+def test_concat_columns_hash():
+    result, hashes = concat_columns([['a', 'b'], ['x', '']], sep=':', hash=True)
+    assert result == cstringarray(['a:x', 'b:'])
+    assert list(hashes) == [hash(cstring('a:x')), hash(cstring('b:'))]
+
+
+def test_concat_columns_unequal():
+    with pytest.raises(ValueError):
+        concat_columns([['a', 'b'], ['x']])
+
+
+def test_lookup():
+    table = cstringarray(['red', 'green', 'blue', 'green'])
+    keys = ['blue', 'purple', 'green', 'red', '']
+    assert list(lookup(keys, table)) == [2, -1, 1, 0, -1]
+
+
+def test_lookup_many():
+    table = [str(i) for i in range(1000)]
+    keys = cstringarray(str(i) for i in range(0, 2000, 7))
+    assert list(lookup(keys, table)) == [i if i < 1000 else -1 for i in range(0, 2000, 7)]
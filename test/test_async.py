@@ -0,0 +1,84 @@
+import asyncio
+import pytest
+from cstring import cstring
+
+
+def test_afind():
+    async def main():
+        target = cstring('hello, world')
+        return (await target.afind('world'), await target.arfind('o'), await target.acount('l'))
+
+    assert asyncio.run(main()) == (7, 8, 3)
+
+
+def test_afind_large():
+    target = cstring('x' * 1000000 + 'needle')
+
+    async def main():
+        return await target.afind('needle')
+
+    assert asyncio.run(main()) == 1000000
+
+
+def test_asplit():
+    async def main():
+        return [piece async for piece in cstring('a,b,,c').asplit(cstring(','))]
+
+    assert asyncio.run(main()) == cstring('a,b,,c').split(cstring(','))
+
+
+def test_asplit_whitespace_maxsplit():
+    async def main():
+        return [piece async for piece in cstring('  a b  c ').asplit(maxsplit=1)]
+
+    assert asyncio.run(main()) == [cstring('a'), cstring('b  c ')]
+
+
+def _ticks_during(make_iter):
+    ticks = []
+
+    async def ticker():
+        while True:
+            ticks.append(1)
+            await asyncio.sleep(0)
+
+    async def main():
+        task = asyncio.create_task(ticker())
+        await asyncio.sleep(0)
+        before = len(ticks)
+        pieces = [piece async for piece in make_iter()]
+        during = len(ticks) - before
+        task.cancel()
+        return pieces, during
+
+    return asyncio.run(main())
+
+
+def test_asplit_yields_to_loop():
+    pieces, during = _ticks_during(lambda: cstring('x ' * 1000).asplit(chunk=100))
+    assert len(pieces) == 1000
+    assert during >= 10
+
+
+@pytest.mark.parametrize('sep', [None, cstring(','), cstring('::')])
+def test_asplit_yields_inside_a_piece(sep):
+    target = cstring('x' * 10000)
+    pieces, during = _ticks_during(lambda: target.asplit(sep, chunk=100))
+    assert pieces == [target]
+    assert during >= 50
+
+
+@pytest.mark.parametrize('chunk', [1, 2, 3, 7, 64])
+@pytest.mark.parametrize('sep,maxsplit', [(None, -1), (None, 2), (cstring(','), -1), (cstring(',,'), -1), (cstring(','), 3)])
+def test_asplit_matches_split(chunk, sep, maxsplit):
+    target = cstring('  ab,,c  d,e,,,fgh , ,,i   ')
+
+    async def main():
+        return [piece async for piece in target.asplit(sep, maxsplit, chunk)]
+
+    assert asyncio.run(main()) == target.split(sep, maxsplit)
+
+
+def test_asplit_bad_chunk():
+    with pytest.raises(ValueError):
+        cstring('a').asplit(chunk=0)
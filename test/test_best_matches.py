@@ -0,0 +1,80 @@
+import random
+
+import pytest
+
+from cstring import best_matches, cstringarray, damerau, jaro_winkler, lcs_len, levenshtein
+
+METRICS = {
+    'levenshtein': (levenshtein, False),
+    'damerau': (damerau, False),
+    'lcs_len': (lcs_len, True),
+    'jaro_winkler': (jaro_winkler, True),
+}
+
+
+def _expected(query, candidates, metric, k, threshold):
+    fn, similarity = METRICS[metric]
+    scored = [(fn(query, c), i) for i, c in enumerate(candidates)]
+    if threshold is not None:
+        scored = [(s, i) for s, i in scored if (s >= threshold if similarity else s <= threshold)]
+    scored.sort(key=lambda t: (-t[0] if similarity else t[0], t[1]))
+    return [i for _, i in scored[:k]], [s for s, _ in scored[:k]]
+
+
+def _names(count, seed=0):
+    rng = random.Random(seed)
+    return [''.join(rng.choice('abcde fg') for _ in range(rng.randint(0, 80))) for _ in range(count)]
+
+
+@pytest.mark.parametrize('metric', sorted(METRICS))
+@pytest.mark.parametrize('threshold', [None, 'tight'])
+@pytest.mark.parametrize('threads', [1, 4])
+def test_matches_pairwise(metric, threshold, threads):
+    candidates = _names(500)
+    if threshold == 'tight':
+        threshold = 0.8 if metric == 'jaro_winkler' else 10
+    for query in candidates[:5] + ['abc', '']:
+        indices, scores = best_matches(query, candidates, metric, k=7, threshold=threshold, threads=threads)
+        want_indices, want_scores = _expected(query, candidates, metric, 7, threshold)
+        assert list(indices) == want_indices
+        assert list(scores) == pytest.approx(want_scores)
+
+
+def test_cstringarray_and_codepoints():
+    candidates = ['café', 'cafe', 'caffè', 'tea', 'coffee']
+    indices, scores = best_matches('café', cstringarray(candidates), k=2, codepoints=True)
+    assert list(indices) == [0, 1]
+    assert list(scores) == [0, 1]
+    indices, scores = best_matches('café', candidates, k=2)
+    assert list(scores) == [0, 2]
+
+
+def test_result_types():
+    indices, scores = best_matches('abc', ['abd', 'xyz'], 'jaro_winkler', k=5)
+    assert indices.typecode == 'q' and scores.typecode == 'd'
+    assert list(indices) == [0, 1]
+    indices, scores = best_matches('abc', ['abd', 'xyz'], k=5, threshold=1)
+    assert scores.typecode == 'q'
+    assert list(indices) == [0]
+    indices, scores = best_matches('abc', [])
+    assert len(indices) == len(scores) == 0
+
+
+def test_errors():
+    with pytest.raises(ValueError):
+        best_matches('a', ['b'], 'hamming')
+    with pytest.raises(ValueError):
+        best_matches('a', ['b'], k=0)
+    with pytest.raises(TypeError):
+        best_matches('a', ['b', 1])
+    with pytest.raises(ValueError):
+        best_matches('a', ['b'], threshold=float('nan'))
+
+
+def test_buffer_inputs():
+    query = bytearray(b'kitten')
+    candidates = [bytearray(b'sitting'), bytearray(b'kitten')]
+    indices, scores = best_matches(query, candidates, threads=2)
+    assert list(indices) == [1] and list(scores) == [0]
+    query.extend(b'!')  # raises BufferError if a view leaked
+    candidates[0].extend(b'!')
@@ -0,0 +1,53 @@
+import sys
+
+import pytest
+
+from cstring import cstring, total_memory
+
+
+def test_borrow_bytes():
+    payload = b'hello, world' * 10
+    result = cstring(payload, copy=False)
+    assert result == cstring(payload)
+    assert hash(result) == hash(cstring(payload))
+    assert result.find('world') == 7
+    assert result[0:5] == cstring('hello')
+    assert result.upper() == cstring(payload.upper())
+    assert sys.getsizeof(result) < sys.getsizeof(cstring(payload, copy=True))
+
+
+def test_borrow_str():
+    text = 'café ' * 10
+    result = cstring(text, copy=False)
+    assert result == cstring(text)
+    assert str(result) == text
+
+
+def test_borrow_keeps_source_alive():
+    result = cstring(bytes(range(1, 200)), copy=False)
+    assert result == cstring(bytes(range(1, 200)))
+    assert result + cstring('!') == cstring(bytes(range(1, 200)) + b'!')
+
+
+def test_copy_by_default():
+    payload = b'x' * (1 << 20)
+    assert sys.getsizeof(cstring(payload)) > len(payload)
+    assert sys.getsizeof(cstring(payload, copy=None)) > len(payload)
+    assert sys.getsizeof(cstring(payload, copy=False)) < 1000
+
+
+def test_borrow_mutable_rejected():
+    with pytest.raises(ValueError):
+        cstring(bytearray(b'abc'), copy=False)
+
+
+def test_copy_true_copies():
+    payload = b'x' * (1 << 20)
+    assert sys.getsizeof(cstring(payload, copy=True)) > len(payload)
+
+
+def test_total_memory_counts_shared_base_once():
+    payload = b'y' * 4096
+    a = cstring(payload, copy=False)
+    b = cstring(payload, copy=False)
+    assert total_memory([a, b]) == sys.getsizeof([a, b]) + sys.getsizeof(a) * 2 + sys.getsizeof(payload)
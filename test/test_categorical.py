@@ -0,0 +1,64 @@
+import pytest
+
+from cstring import cstring, cstringarray, cstringcategorical
+
+
+def test_new():
+    target = cstringcategorical(['200', '404', '200', '500', '200'])
+    assert len(target) == 5
+    assert list(target) == [cstring(s) for s in ['200', '404', '200', '500', '200']]
+
+
+def test_categories_and_codes():
+    target = cstringcategorical(['b', 'a', 'b', 'b', 'c'])
+    assert target.categories == cstringarray(['b', 'a', 'c'])
+    assert list(target.codes) == [0, 1, 0, 0, 2]
+
+
+def test_subscript():
+    target = cstringcategorical(['x', 'y', 'x'])
+    assert target[1] == cstring('y')
+    assert target[-1] == cstring('x')
+
+
+def test_to_array():
+    values = ['GET', 'POST', 'GET', 'HEAD']
+    assert cstringcategorical(cstringarray(values)).to_array() == cstringarray(values)
+
+
+def test_take():
+    target = cstringcategorical(['a', 'b', 'c', 'a'])
+    assert list(target.take([3, 2])) == [cstring('a'), cstring('c')]
+
+
+def test_filter():
+    target = cstringcategorical(['a', 'b', 'c', 'a'])
+    assert target.filter([True, False, True, False]).to_array() == cstringarray(['a', 'c'])
+
+
+def test_mask():
+    target = cstringcategorical(['host1', 'db1', 'host2', 'host1'])
+    assert list(target.mask('startswith', 'host')) == [1, 0, 1, 1]
+
+
+def test_array_mask():
+    target = cstringarray(['host1', 'db1', 'host2'])
+    mask = target.mask('startswith', 'host')
+    assert list(mask) == [1, 0, 1]
+    assert target.filter(mask) == cstringarray(['host1', 'host2'])
+
+
+MASK_WORDS = ['', 'abc', 'ABC', 'Abc1', '123', '  ', 'a b', 'caf\xe9', 'x\ty', 'host1', 'ho']
+
+
+@pytest.mark.parametrize('args', [
+    ('isalnum',), ('isalpha',), ('isdigit',), ('islower',), ('isprintable',), ('isspace',), ('isupper',),
+    ('startswith', 'ho'), ('startswith', ''), ('endswith', cstring('1')), ('endswith', b'c'),
+    ('find', 'b'), ('find', ''), ('count', 'a'), ('count', ''),
+    ('startswith', 'b', 1), ('find', 'c', 1), ('__contains__', cstring('b')),
+])
+def test_array_mask_matches_methods(args):
+    target = cstringarray(MASK_WORDS)
+    expected = [int(bool(getattr(w, args[0])(*args[1:]))) for w in target]
+    assert list(target.mask(*args)) == expected
+    assert list(cstringcategorical(MASK_WORDS).mask(*args)) == expected
@@ -0,0 +1,54 @@
+import os
+import subprocess
+import sys
+
+import pytest
+
+import cstring
+
+CHECK = r'''
+import random
+from cstring import cstring, cpu_features
+assert cpu_features()['kernels'] == VARIANT, cpu_features()
+rng = random.Random(0)
+for n in list(range(70)) + [1000, 4099]:
+    text = ''.join(rng.choice('abAB z\xe9') for _ in range(n))
+    c = cstring(text)
+    assert c.lower() == cstring(text.encode().lower().decode())
+    assert c.upper() == cstring(text.encode().upper().decode())
+    for sub in ('a', 'ab', 'bA', 'z a', 'aBz', text[n // 2:n // 2 + 7], 'zzzzzzzz'):
+        if sub:
+            assert c.find(sub) == text.encode().find(sub.encode()), (text, sub)
+            assert c.count(sub) == text.encode().count(sub.encode()), (text, sub)
+assert list(cstring(SKETCH_DOC).minhash(131, shingle=2)) == MINHASH
+'''
+
+SKETCH_DOC = ' '.join('word%d' % (i * 7919 % 97) for i in range(500))
+
+
+def _run(variant):
+    minhash = list(cstring.cstring(SKETCH_DOC).minhash(131, shingle=2))
+    env = dict(os.environ, CSTRING_KERNELS=variant)
+    env['PYTHONPATH'] = os.pathsep.join(filter(None, [os.path.dirname(cstring.__file__), env.get('PYTHONPATH')]))
+    return subprocess.run(
+        [sys.executable, '-W', 'error', '-c', 'VARIANT = %r\nSKETCH_DOC = %r\nMINHASH = %r\n' % (variant, SKETCH_DOC, minhash) + CHECK],
+        env=env, capture_output=True, text=True)
+
+
+def test_cpu_features():
+    features = cstring.cpu_features()
+    assert features['available'][0] == 'scalar'
+    assert features['scalar'] is True
+    assert features['kernels'] in features['available']
+    assert features[features['kernels']] is True
+
+
+@pytest.mark.parametrize('variant', [v for v in cstring.cpu_features()['available'] if cstring.cpu_features()[v]])
+def test_forced_variant(variant):
+    result = _run(variant)
+    assert result.returncode == 0, result.stderr
+
+
+def test_unknown_variant_warns():
+    result = _run('no-such-isa')
+    assert 'RuntimeWarning' in result.stderr
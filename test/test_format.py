@@ -0,0 +1,67 @@
+import pytest
+
+from cstring import cstring, Template
+
+
+def test_format_positional():
+    assert cstring('{}:{}').format(cstring('host'), 8080) == cstring('host:8080')
+    assert cstring('{1}-{0}-{1}').format('a', 'b') == cstring('b-a-b')
+
+
+def test_format_keywords_and_escapes():
+    assert cstring('{{{name}}} = {value}').format(name='x', value=-12) == cstring('{x} = -12')
+    assert cstring('}}{{').format() == cstring('}{')
+
+
+def test_format_specs_and_conversions():
+    assert cstring('[{:>5}|{:.2f}|{!r}|{:x}]').format(cstring('ab'), 3.14159, 'q', 255) == cstring("[   ab|3.14|'q'|ff]")
+    assert cstring('{0!s:^7}').format(12) == cstring('  12   ')
+
+
+def test_format_big_int_and_unicode():
+    assert cstring('{}').format(10 ** 30) == cstring(str(10 ** 30))
+    assert cstring('é{}é').format('ü') == cstring('éüé')
+
+
+def test_format_fallback():
+    assert cstring('{0[1]}{1.real}').format([5, 6], 2) == cstring('62')
+    assert cstring('{:{w}}|').format(1, w=3) == cstring('  1|')
+
+
+def test_format_map():
+    assert cstring('{a}/{b}').format_map({'a': 1, 'b': cstring('z')}) == cstring('1/z')
+
+    class Default(dict):
+        def __missing__(self, key):
+            return '?'
+
+    assert cstring('{a}{b}').format_map(Default(a='x')) == cstring('x?')
+    with pytest.raises(ValueError):
+        cstring('{}').format_map({})
+
+
+@pytest.mark.parametrize('template,exc', [
+    ('{', ValueError),
+    ('}', ValueError),
+    ('{0', ValueError),
+    ('{}{0}', ValueError),
+    ('{!x}', ValueError),
+])
+def test_format_bad_templates(template, exc):
+    with pytest.raises(exc):
+        cstring(template).format(1)
+
+
+def test_format_missing_arguments():
+    with pytest.raises(IndexError):
+        cstring('{} {}').format(1)
+    with pytest.raises(KeyError):
+        cstring('{x}').format(y=1)
+
+
+def test_template():
+    t = Template('{level}: {}')
+    assert t.template == cstring('{level}: {}')
+    assert t.render('started', level='INFO') == cstring('INFO: started')
+    assert Template('{a}').render_map({'a': 5}) == cstring('5')
+    assert Template('').render() == cstring('')
@@ -0,0 +1,52 @@
+import array
+import pytest
+from cstring import cstringarray, group_indices, group_sum
+
+
+def test_group_indices():
+    groups, offsets, indices = group_indices(['a', 'b', 'a', 'c', 'b', 'a'])
+    assert groups == cstringarray(['a', 'b', 'c'])
+    assert list(offsets) == [0, 3, 5, 6]
+    assert list(indices) == [0, 2, 5, 1, 4, 3]
+
+
+def test_group_indices_empty():
+    groups, offsets, indices = group_indices([])
+    assert len(groups) == 0
+    assert list(offsets) == [0]
+    assert list(indices) == []
+
+
+def test_group_sum_ints():
+    groups, sums = group_sum(cstringarray(['x', 'y', 'x']), [1, 2, 3])
+    assert groups == cstringarray(['x', 'y'])
+    assert sums.typecode == 'q'
+    assert list(sums) == [4, 2]
+
+
+def test_group_sum_floats():
+    groups, sums = group_sum(['x', 'y', 'x'], array.array('d', [0.5, 2.0, 0.25]))
+    assert sums.typecode == 'd'
+    assert list(sums) == [0.75, 2.0]
+
+
+def test_group_sum_int_buffer():
+    groups, sums = group_sum(['x', 'y', 'x'], array.array('i', [1, -2, 3]))
+    assert list(sums) == [4, -2]
+
+
+def test_group_sum_bad_length():
+    with pytest.raises(ValueError):
+        group_sum(['x', 'y'], [1])
+
+
+def test_group_sum_unsigned_overflow():
+    with pytest.raises(OverflowError):
+        group_sum(['x'], array.array('Q', [2**64 - 1]))
+
+
+def test_group_sum_overflow():
+    with pytest.raises(OverflowError):
+        group_sum(['x', 'x'], [2**62, 2**62])
+    with pytest.raises(OverflowError):
+        group_sum(['x', 'x'], array.array('q', [-2**63, -1]))
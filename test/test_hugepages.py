@@ -0,0 +1,48 @@
+import sys
+
+import pytest
+
+import cstring as module
+from cstring import cstring
+
+try:
+    module.set_hugepage_threshold(module.set_hugepage_threshold(0))
+    HAVE_HUGEPAGES = True
+except NotImplementedError:
+    HAVE_HUGEPAGES = False
+
+pytestmark = pytest.mark.skipif(not HAVE_HUGEPAGES, reason='no mmap on this platform')
+
+MAPPING = 2 * 1024 * 1024
+
+
+@pytest.fixture
+def small_threshold():
+    previous = module.set_hugepage_threshold(4096)
+    yield
+    module.set_hugepage_threshold(previous)
+
+
+def test_mapped_storage(small_threshold):
+    text = 'Lorem Ipsum ' * 1000
+    result = cstring(text, copy=True)
+    assert sys.getsizeof(result) - sys.getsizeof(cstring('')) >= MAPPING - 32
+    assert result == cstring(text.encode(), copy=True)
+    assert hash(result) == hash(cstring(text.encode(), copy=True))
+    assert result.lower() == cstring(text.lower())
+    assert result.find('Ipsum', 100) == 102
+    assert str(result[:11]) == 'Lorem Ipsum'
+
+
+def test_mapped_join_grows(small_threshold):
+    piece = cstring('x' * 5000)
+    result = cstring(',').join([piece] * 1000)
+    assert len(result) == 5000 * 1000 + 999
+    assert result.count(',') == 999
+
+
+def test_threshold_validation():
+    with pytest.raises(ValueError):
+        module.set_hugepage_threshold(-1)
+    previous = module.set_hugepage_threshold(123)
+    assert module.set_hugepage_threshold(previous) == 123
@@ -0,0 +1,59 @@
+import os
+import threading
+import pytest
+import cstring as cstring_module
+
+try:
+    import _interpreters as interpreters
+except ImportError:
+    try:
+        import _xxsubinterpreters as interpreters
+    except ImportError:
+        interpreters = None
+
+
+WORKLOAD = '''
+import sys
+sys.path.insert(0, %r)
+from cstring import cstring, cstringarray, lookup
+sep = cstring(',')
+items = [cstring(str(i)) for i in range(100)]
+for _ in range(100):
+    assert sep.join(items).split(sep) == items
+    assert cstring('') is cstring(b'')
+assert list(lookup(['3', 'x'], cstringarray(['1', '2', '3']))) == [2, -1]
+''' % os.path.dirname(os.path.abspath(cstring_module.__file__))
+
+
+def _run(interp):
+    result = interpreters.run_string(interp, WORKLOAD)
+    assert result is None
+
+
+@pytest.mark.skipif(interpreters is None, reason='subinterpreters not available')
+def test_concurrent_interpreters():
+    interps = [interpreters.create() for _ in range(4)]
+    errors = []
+
+    def worker(interp):
+        try:
+            _run(interp)
+        except Exception as e:
+            errors.append(e)
+
+    try:
+        threads = [threading.Thread(target=worker, args=(i,)) for i in interps]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+    finally:
+        for interp in interps:
+            interpreters.destroy(interp)
+    assert errors == []
+
+
+def test_types_per_module():
+    from cstring import cstring
+    assert type(cstring('a')) is cstring
+    assert cstring('') is cstring(b'')
@@ -0,0 +1,43 @@
+import sys
+from cstring import cstring, cstringarray, cstringcategorical, total_memory
+
+
+def test_sizeof_cstring():
+    # data (including the terminator) is padded to a multiple of 32 bytes
+    small = cstring('a')
+    assert sys.getsizeof(cstring('a' * 31)) == sys.getsizeof(small)
+    assert sys.getsizeof(cstring('a' * 32)) - sys.getsizeof(small) == 32
+    assert sys.getsizeof(cstring('a' * 1001)) - sys.getsizeof(small) == 992
+
+
+def test_sizeof_cstringarray():
+    small = cstringarray(['a'])
+    large = cstringarray(['a' * 100, 'b'])
+    # 99 more bytes in the first element, one more element ('b\0' and an offset)
+    assert sys.getsizeof(large) - sys.getsizeof(small) == 99 + 2 + 8
+
+
+def test_sizeof_categorical():
+    small = cstringcategorical(['a'])
+    large = cstringcategorical(['a'] * 11)
+    assert sys.getsizeof(large) - sys.getsizeof(small) == 40
+
+
+def test_total_memory_dedup():
+    s = cstring('hello')
+    objs = [s, s, (s,)]
+    expected = sys.getsizeof(objs) + sys.getsizeof((s,)) + sys.getsizeof(s)
+    assert total_memory(objs) == expected
+
+
+def test_total_memory_dict_and_categorical():
+    cat = cstringcategorical(['a', 'b', 'a'])
+    objs = {'k': cat}
+    expected = sys.getsizeof(objs) + sys.getsizeof('k') + sys.getsizeof(cat) + sys.getsizeof(cat.categories)
+    assert total_memory(objs) == expected
+
+
+def test_total_memory_recursive():
+    objs = []
+    objs.append(objs)
+    assert total_memory(objs) == sys.getsizeof(objs)
@@ -0,0 +1,112 @@
+import random
+
+import pytest
+
+from cstring import cstring, damerau, jaro_winkler, lcs_len, levenshtein
+
+
+def _levenshtein(a, b):
+    prev = list(range(len(b) + 1))
+    for i, x in enumerate(a, 1):
+        cur = [i]
+        for j, y in enumerate(b, 1):
+            cur.append(min(prev[j] + 1, cur[j - 1] + 1, prev[j - 1] + (x != y)))
+        prev = cur
+    return prev[-1]
+
+
+def _osa(a, b):
+    d = [[i + j if not i or not j else 0 for j in range(len(b) + 1)] for i in range(len(a) + 1)]
+    for i in range(1, len(a) + 1):
+        for j in range(1, len(b) + 1):
+            d[i][j] = min(d[i - 1][j] + 1, d[i][j - 1] + 1, d[i - 1][j - 1] + (a[i - 1] != b[j - 1]))
+            if i > 1 and j > 1 and a[i - 1] == b[j - 2] and a[i - 2] == b[j - 1]:
+                d[i][j] = min(d[i][j], d[i - 2][j - 2] + 1)
+    return d[-1][-1]
+
+
+def _lcs(a, b):
+    prev = [0] * (len(b) + 1)
+    for x in a:
+        cur = [0]
+        for j, y in enumerate(b, 1):
+            cur.append(prev[j - 1] + 1 if x == y else max(prev[j], cur[j - 1]))
+        prev = cur
+    return prev[-1]
+
+
+def _pairs(alphabet, lengths, count=25):
+    rng = random.Random(len(alphabet))
+    for _ in range(count):
+        a = ''.join(rng.choice(alphabet) for _ in range(rng.choice(lengths)))
+        b = list(a)
+        for _ in range(rng.randint(0, 8)):
+            i = rng.randint(0, len(b))
+            if rng.random() < 0.5:
+                b.insert(i, rng.choice(alphabet))
+            elif i < len(b) - 1:
+                b[i], b[i + 1] = b[i + 1], b[i]
+        yield a, ''.join(b)
+
+
+@pytest.mark.parametrize('lengths', [(0, 1, 5, 30, 63), (64, 65, 100, 140)])
+def test_distances_match_dp(lengths):
+    for a, b in _pairs('abcd', lengths):
+        assert levenshtein(a, b) == _levenshtein(a, b)
+        assert damerau(a, b) == _osa(a, b)
+        assert lcs_len(a, b) == _lcs(a, b)
+
+
+@pytest.mark.parametrize('lengths', [(0, 3, 20), (70, 150)])
+def test_codepoints(lengths):
+    for a, b in _pairs('aé€😀', lengths):
+        assert levenshtein(a, b, codepoints=True) == _levenshtein(a, b)
+        assert damerau(a, b, codepoints=True) == _osa(a, b)
+        assert lcs_len(a, b, codepoints=True) == _lcs(a, b)
+        assert levenshtein(a, b) == _levenshtein(a.encode(), b.encode())
+
+
+def test_known_values():
+    assert levenshtein('kitten', 'sitting') == 3
+    assert levenshtein(cstring('flaw'), b'lawn') == 2
+    assert damerau('ca', 'ac') == 1
+    assert levenshtein('ca', 'ac') == 2
+    assert damerau('ca', 'abc') == 3
+    assert lcs_len('ABCBDAB', 'BDCABA') == 4
+    assert levenshtein('é', 'è') == 1
+    assert levenshtein(b'\xc3\xa9x\xff', b'\xc3\xa8x', codepoints=True) == 2
+
+
+@pytest.mark.parametrize('n', [10, 200])
+def test_max(n):
+    a = 'a' * n
+    b = 'b' * 5 + 'a' * (n - 5)
+    assert levenshtein(a, b) == 5
+    assert levenshtein(a, b, max=5) == 5
+    assert levenshtein(a, b, max=4) == 5
+    assert levenshtein(a, b, max=0) == 1
+    assert damerau(a, b, max=2) == 3
+    assert levenshtein(a, a + 'xyz', max=1) == 2
+    with pytest.raises(ValueError):
+        levenshtein(a, b, max=-1)
+
+
+def test_jaro_winkler():
+    assert jaro_winkler('MARTHA', 'MARHTA') == pytest.approx(0.9611111)
+    assert jaro_winkler('MARTHA', 'MARHTA', prefix_weight=0) == pytest.approx(0.9444444)
+    assert jaro_winkler('DIXON', 'DICKSONX') == pytest.approx(0.8133333)
+    assert jaro_winkler('', '') == 1.0
+    assert jaro_winkler('abc', '') == 0.0
+    assert jaro_winkler('abc', 'xyz') == 0.0
+    long = 'the quick brown fox jumps over the lazy dog ' * 3
+    assert 0.9 < jaro_winkler(long, long.replace('fox', 'cat')) < 1.0
+    assert jaro_winkler('café', 'cafe', codepoints=True) > jaro_winkler('café', 'cafe')
+    with pytest.raises(ValueError):
+        jaro_winkler('a', 'b', prefix_weight=0.5)
+
+
+def test_bad_arguments():
+    with pytest.raises(TypeError):
+        levenshtein('a', 1)
+    with pytest.raises(TypeError):
+        lcs_len('a')
@@ -0,0 +1,72 @@
+import array
+import math
+
+import pytest
+
+from cstring import cstring, cstringarray
+
+
+@pytest.mark.parametrize('n', [0, 7, -7, 2 ** 63 - 1, -2 ** 63, 2 ** 64, -(10 ** 40)])
+@pytest.mark.parametrize('base', [2, 8, 10, 16, 36])
+def test_from_int(n, base):
+    result = cstring.from_int(n, base=base)
+    assert int(str(result), base) == n
+    if base == 10:
+        assert result == cstring(str(n))
+    if base == 16:
+        assert result == cstring(format(n, 'x'))
+
+
+def test_from_int_errors():
+    with pytest.raises(ValueError):
+        cstring.from_int(1, base=1)
+    with pytest.raises(TypeError):
+        cstring.from_int(1.5)
+
+
+@pytest.mark.parametrize('x', [0.0, -0.0, 0.1, 1 / 3, 1e300, -1e-300, 5e-324, 1e16, 123.0, math.inf, -math.inf, math.nan])
+def test_from_float(x):
+    assert cstring.from_float(x) == cstring(repr(x))
+
+
+def test_from_float_accepts_ints():
+    assert cstring.from_float(3) == cstring('3.0')
+
+
+def test_from_ints_sequence():
+    values = [0, -5, 10 ** 25, 255]
+    assert list(cstringarray.from_ints(values)) == [cstring(str(v)) for v in values]
+    assert list(cstringarray.from_ints(values, base=16)) == [cstring(format(v, 'x')) for v in values]
+
+
+@pytest.mark.parametrize('typecode', 'bBhHiIlLqQ')
+def test_from_ints_buffer(typecode):
+    values = array.array(typecode, [0, 1, 100, 127])
+    if typecode in 'bhilq':
+        values.append(-128)
+    assert list(cstringarray.from_ints(values)) == [cstring(str(v)) for v in values]
+    assert list(cstringarray.from_ints(values, base=2)) == [cstring(format(v, 'b')) for v in values]
+
+
+def test_from_ints_extremes():
+    values = array.array('q', [2 ** 63 - 1, -2 ** 63])
+    assert list(cstringarray.from_ints(values, base=2)) == [cstring(format(v, 'b')) for v in values]
+    values = array.array('Q', [2 ** 64 - 1])
+    assert list(cstringarray.from_ints(values)) == [cstring(str(2 ** 64 - 1))]
+
+
+def test_from_floats():
+    values = [0.1, -2.5, 1e300, math.nan, 7]
+    expected = [cstring(repr(float(v))) for v in values]
+    assert list(cstringarray.from_floats(values)) == expected
+    assert list(cstringarray.from_floats(array.array('d', values))) == expected
+    assert list(cstringarray.from_floats(array.array('f', [0.5]))) == [cstring('0.5')]
+    assert list(cstringarray.from_floats(array.array('i', [3]))) == [cstring('3.0')]
+
+
+def test_from_numbers_errors():
+    with pytest.raises(TypeError):
+        cstringarray.from_ints(array.array('d', [1.0]))
+    with pytest.raises(TypeError):
+        cstringarray.from_ints(['x'])
+    assert len(cstringarray.from_ints([])) == 0
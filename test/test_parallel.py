@@ -0,0 +1,56 @@
+import pytest
+from cstring import cstring, cstringarray, parallel_map
+
+
+WORDS = [cstring(w) for w in ['  Hello ', 'WORLD', 'abc123', '', ' \t', 'MiXeD case']]
+
+
+@pytest.mark.parametrize('threads', [1, 4])
+def test_transform(threads):
+    assert parallel_map('lower', WORDS, threads=threads) == [w.lower() for w in WORDS]
+    assert parallel_map('upper', WORDS, threads=threads) == [w.upper() for w in WORDS]
+    assert parallel_map('swapcase', WORDS, threads=threads) == [w.swapcase() for w in WORDS]
+
+
+@pytest.mark.parametrize('threads', [1, 4])
+def test_strip(threads):
+    assert parallel_map('strip', WORDS, threads=threads) == [w.strip() for w in WORDS]
+    assert parallel_map('lstrip', WORDS, 'H ', threads=threads) == [w.lstrip('H ') for w in WORDS]
+    assert parallel_map('rstrip', WORDS, threads=threads) == [w.rstrip() for w in WORDS]
+
+
+def test_predicates():
+    assert list(parallel_map('isalnum', WORDS)) == [w.isalnum() for w in WORDS]
+    assert list(parallel_map('isupper', WORDS)) == [w.isupper() for w in WORDS]
+    assert list(parallel_map('startswith', WORDS, 'WO')) == [w.startswith('WO') for w in WORDS]
+    assert list(parallel_map('endswith', WORDS, 'se')) == [w.endswith('se') for w in WORDS]
+
+
+def test_ints():
+    hashes = list(parallel_map('hash', WORDS + WORDS, threads=4))
+    assert hashes[:len(WORDS)] == hashes[len(WORDS):]
+    assert len(set(hashes)) == len(set(WORDS))
+    assert list(parallel_map('hash', cstringarray(WORDS))) == hashes[:len(WORDS)]
+    assert list(parallel_map('find', WORDS, 'l')) == [w.find('l') for w in WORDS]
+    assert list(parallel_map('count', ['aaaa', 'a', ''], 'aa')) == [2, 0, 0]
+
+
+def test_array_input():
+    source = cstringarray(str(i) + ' X ' for i in range(10000))
+    result = parallel_map('lower', source, threads=4)
+    assert isinstance(result, cstringarray)
+    assert list(result) == [s.lower() for s in source]
+    stripped = parallel_map('strip', source, threads=4)
+    assert stripped == cstringarray(str(i) + ' X' for i in range(10000))
+
+
+def test_unsupported():
+    with pytest.raises(ValueError):
+        parallel_map('split', WORDS)
+
+
+def test_buffer_inputs():
+    data = bytearray(b'Hello')
+    assert parallel_map('lower', [data, 'World'], threads=4) == [cstring('hello'), cstring('world')]
+    assert list(parallel_map('find', [data], data)) == [0]
+    data.extend(b'!')  # raises BufferError if a view leaked
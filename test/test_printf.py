@@ -0,0 +1,60 @@
+import pytest
+
+from cstring import cstring
+
+
+@pytest.mark.parametrize('fmt,args', [
+    ('%s:%d', ('host', 8080)),
+    ('%s', 'single'),
+    ('%s', 5),
+    ('%d%%', (50,)),
+    ('%i %u', (-3, 4)),
+    ('[%5s|%-5s|%.2s]', ('ab', 'cd', 'efgh')),
+    ('%x %X %#x %o', (255, 255, 255, 8)),
+    ('%f %.3f %10.1f %-8.2f|', (1.5, 3.14159, -2.25, 0.5)),
+    ('%e %g %G %E', (12345.678, 0.0001, 1e20, 1.5)),
+    ('%+d % d %05d', (3, 3, -42)),
+    ('%*d|%-*s|%.*f', (5, 1, 4, 'x', 2, 3.14159)),
+    ('%*d|', (-4, 7)),
+    ('%r %a', ('q', 'é')),
+    ('%c%c', (65, 'b')),
+    ('%d', (10 ** 30,)),
+    ('%ld %hd', (1, 2)),
+    ('é%sé', ('ü',)),
+    ('', ()),
+])
+def test_matches_str(fmt, args):
+    assert cstring(fmt) % args == cstring(fmt % args)
+
+
+def test_cstring_arguments():
+    assert cstring('%s=%r') % (cstring('k'), cstring('v')) == cstring("k='v'")
+    assert cstring('[%4s]') % (cstring('ab'),) == cstring('[  ab]')
+
+
+def test_mapping():
+    assert cstring('%(a)s=%(b)05d') % {'a': 'k', 'b': 42} == cstring('k=00042')
+    assert cstring('%s') % {'a': 1} == cstring("{'a': 1}")
+    with pytest.raises(KeyError):
+        cstring('%(missing)s') % {}
+
+
+@pytest.mark.parametrize('fmt,args,exc', [
+    ('%s %s', ('a',), TypeError),
+    ('%s', ('a', 'b'), TypeError),
+    ('%', (), ValueError),
+    ('%q', (1,), ValueError),
+    ('%d', ('x',), TypeError),
+    ('%(a)s', ('x',), TypeError),
+])
+def test_errors(fmt, args, exc):
+    with pytest.raises(exc):
+        cstring(fmt) % args
+    with pytest.raises(exc):
+        fmt % args
+
+
+def test_not_implemented_for_other_left_operands():
+    assert '%s' % cstring('x') == 'x'
+    with pytest.raises(TypeError):
+        5 % cstring('x')
@@ -0,0 +1,97 @@
+import random
+
+import pytest
+
+from cstring import cstring, cstringarray
+
+
+def _docs(count, words=300, seed=0):
+    rng = random.Random(seed)
+    vocab = ['w%d' % i for i in range(5000)]
+    return [' '.join(rng.choice(vocab) for _ in range(words)) for _ in range(count)]
+
+
+def _jaccard(a, b, k=5):
+    def shingles(doc):
+        tokens = doc.split()
+        return {tuple(tokens[i:i + k]) for i in range(len(tokens) - k + 1)}
+    a, b = shingles(a), shingles(b)
+    return len(a & b) / len(a | b)
+
+
+def _near_duplicate(doc, seed=1):
+    rng = random.Random(seed)
+    tokens = doc.split()
+    for _ in range(3):
+        tokens[rng.randrange(len(tokens))] = 'changed'
+    return ' '.join(tokens)
+
+
+def test_minhash_estimates_jaccard():
+    doc, other = _docs(2)
+    near = _near_duplicate(doc)
+    for b in (near, other):
+        sig_a = cstring(doc).minhash(512)
+        sig_b = cstring(b).minhash(512)
+        assert sig_a.typecode == 'I' and len(sig_a) == 512
+        estimate = sum(x == y for x, y in zip(sig_a, sig_b)) / 512
+        assert abs(estimate - _jaccard(doc, b)) < 0.1
+
+
+def test_minhash_ignores_whitespace_and_order_of_shingles():
+    assert cstring('a b c d e f').minhash(16) == cstring('a  b\tc d\ne f').minhash(16)
+    assert cstring('a b c d e f').minhash(16, shingle=1) == cstring('f e d c b a').minhash(16, shingle=1)
+    assert cstring('a b c d e f').minhash(16, shingle=2) != cstring('f e d c b a').minhash(16, shingle=2)
+
+
+def test_short_and_empty():
+    assert list(cstring('').minhash(4)) == [2 ** 32 - 1] * 4
+    assert cstring('').simhash() == 0
+    # fewer words than a shingle: the whole document is one shingle
+    assert cstring('a b').minhash(8) == cstring('a b').minhash(8, shingle=2)
+    assert cstring('a b').minhash(8) != cstring('a c').minhash(8)
+
+
+def test_simhash():
+    doc, other = _docs(2)
+    near = _near_duplicate(doc)
+    h = cstring(doc).simhash()
+    assert 0 <= h < 2 ** 64
+    assert bin(h ^ cstring(near).simhash()).count('1') < bin(h ^ cstring(other).simhash()).count('1')
+    assert cstring(doc).simhash(seed=1) != h
+
+
+def test_char_shingles():
+    a = cstring('the quick brown fox').minhash(64, shingle=3, analyzer='char')
+    b = cstring('the quick brown fix').minhash(64, shingle=3, analyzer='char')
+    assert 0.5 < sum(x == y for x, y in zip(a, b)) / 64 < 1.0
+    assert cstring('héllo').simhash(shingle=2, analyzer='char') != cstring('hello').simhash(shingle=2, analyzer='char')
+
+
+@pytest.mark.parametrize('threads', [1, 4])
+def test_batch(threads):
+    docs = _docs(50, words=40) + ['', 'one']
+    arr = cstringarray(docs)
+    matrix = arr.minhash(37, shingle=3, seed=5, threads=threads)
+    assert matrix.typecode == 'I' and len(matrix) == len(docs) * 37
+    for i, doc in enumerate(docs):
+        assert matrix[i * 37:(i + 1) * 37] == cstring(doc).minhash(37, shingle=3, seed=5)
+    simhashes = arr.simhash(analyzer='char', threads=threads)
+    assert simhashes.typecode == 'Q'
+    assert list(simhashes) == [cstring(doc).simhash(analyzer='char') for doc in docs]
+    assert len(cstringarray([]).minhash(8)) == 0
+
+
+def test_errors():
+    with pytest.raises(ValueError):
+        cstring('a').minhash(0)
+    with pytest.raises(ValueError):
+        cstring('a b').minhash(2**60)
+    with pytest.raises(ValueError):
+        cstringarray(['a b']).minhash(2**60)
+    with pytest.raises(ValueError):
+        cstring('a').simhash(shingle=0)
+    with pytest.raises(ValueError):
+        cstring('a').minhash(analyzer='bytes')
+    with pytest.raises(TypeError):
+        cstring('a').minhash(threads=2)
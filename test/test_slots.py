@@ -37,3 +37,10 @@ def test_hash():
     assert a is not b
     assert set((a, b)) == set((a,)) == set((b,))
 
+
+def test_hash_of_derived():
+    s = cstring('hello')
+    assert hash(s[1:3]) == hash(cstring('el'))
+    assert hash(s + s) == hash(cstring('hellohello'))
+    assert hash(s * 2) == hash(cstring('hellohello'))
+
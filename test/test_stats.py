@@ -0,0 +1,57 @@
+import cstring as module
+from cstring import cstring
+
+
+def _collect(fn):
+    module.reset_stats()
+    previous = module.enable_stats()
+    try:
+        fn()
+    finally:
+        module.enable_stats(previous)
+    return module.stats()
+
+
+def test_stats_disabled_by_default():
+    module.reset_stats()
+    cstring('hello').find('l')
+    assert all(v == 0 for v in module.stats().values())
+
+
+def test_stats_alloc_and_hash():
+    def run():
+        s = cstring('hello')
+        hash(s)
+        hash(s)
+        s[1:3]
+
+    stats = _collect(run)
+    assert stats['allocs'] == 2
+    assert stats['copy_bytes'] == 5 + 2
+    assert stats['hash_computes'] == 1
+    assert stats['hash_hits'] == 1
+    assert stats['hash_bytes'] == 6
+
+
+def test_stats_search_and_split():
+    s = cstring('a b c d')
+
+    def run():
+        s.find('c')
+        s.rfind('c')
+        s.count(' ')
+        s.split()
+
+    stats = _collect(run)
+    assert stats['searches'] == 3
+    assert stats['search_bytes'] == 21
+    assert stats['splits'] == 1
+    assert stats['split_pieces'] == 4
+    assert stats['split_bytes'] == 7
+
+
+def test_reset_stats():
+    _collect(lambda: cstring('abc').find('b'))
+    module.reset_stats()
+    assert all(v == 0 for v in module.stats().values())
+
@@ -0,0 +1,69 @@
+import threading
+from cstring import cstring, cstringarray, lookup
+
+
+THREADS = 8
+ROUNDS = 200
+
+
+def _run_threads(target):
+    errors = []
+    barrier = threading.Barrier(THREADS)
+
+    def worker(n):
+        try:
+            barrier.wait()
+            target(n)
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=worker, args=(n,)) for n in range(THREADS)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    assert errors == []
+
+
+def test_shared_hash():
+    shared = [cstring('key-%d' % i) for i in range(100)]
+    expected = [hash(cstring('key-%d' % i)) for i in range(100)]
+
+    def target(n):
+        for _ in range(ROUNDS):
+            assert [hash(s) for s in shared] == expected
+
+    _run_threads(target)
+
+
+def test_empty_singleton():
+    def target(n):
+        for _ in range(ROUNDS):
+            assert cstring('') is cstring(b'')
+            assert cstring('abc') * 0 == cstring('')
+
+    _run_threads(target)
+
+
+def test_join_and_split():
+    sep = cstring(',')
+    items = [cstring(str(i)) for i in range(50)]
+
+    def target(n):
+        for _ in range(ROUNDS):
+            joined = sep.join(items)
+            assert joined.split(sep) == items
+
+    _run_threads(target)
+
+
+def test_shared_lookup():
+    table = cstringarray(str(i) for i in range(1000))
+    keys = cstringarray(str(i) for i in range(0, 2000, 3))
+    expected = [i if i < 1000 else -1 for i in range(0, 2000, 3)]
+
+    def target(n):
+        for _ in range(ROUNDS // 10):
+            assert list(lookup(keys, table)) == expected
+
+    _run_threads(target)
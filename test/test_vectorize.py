@@ -0,0 +1,85 @@
+import random
+from collections import Counter
+
+import pytest
+
+from cstring import cstring, cstringarray, hash_vectorize
+
+
+def _ngrams(doc, analyzer, nmin, nmax):
+    units = doc.split() if analyzer == 'word' else list(doc)
+    for n in range(nmin, nmax + 1):
+        for i in range(len(units) - n + 1):
+            yield ' '.join(units[i:i + n]) if analyzer == 'word' else ''.join(units[i:i + n])
+
+
+def _feature(ngram, analyzer, n, **kwargs):
+    """Index of a single n-gram, by vectorizing it as its own document."""
+    _, indices, _ = hash_vectorize(ngram, analyzer=analyzer, ngram_range=(n, n), **kwargs)
+    assert len(indices) == 1
+    return indices[0]
+
+
+def _docs(count, seed=0):
+    rng = random.Random(seed)
+    words = ['the', 'cat', 'sat', 'on', 'mat', 'café', 'a', 'b']
+    return [' \t'.join(rng.choice(words) for _ in range(rng.randint(0, 12))) for _ in range(count)]
+
+
+@pytest.mark.parametrize('analyzer,ngram_range', [('word', (1, 1)), ('word', (1, 3)), ('char', (2, 4))])
+def test_matches_python_ngrams(analyzer, ngram_range):
+    docs = _docs(50)
+    kwargs = dict(n_features=1000, seed=7)
+    indptr, indices, counts = hash_vectorize(docs, analyzer=analyzer, ngram_range=ngram_range, **kwargs)
+    assert indptr.typecode == 'q' and indices.typecode == 'i' and counts.typecode == 'i'
+    assert len(indptr) == len(docs) + 1 and indptr[0] == 0 and indptr[-1] == len(indices) == len(counts)
+    for row, doc in enumerate(docs):
+        want = Counter()
+        for ngram in _ngrams(doc, analyzer, *ngram_range):
+            n = len(ngram.split()) if analyzer == 'word' else len(ngram)
+            want[_feature(ngram, analyzer, n, **kwargs)] += 1
+        lo, hi = indptr[row], indptr[row + 1]
+        assert list(indices[lo:hi]) == sorted(want)
+        assert list(counts[lo:hi]) == [want[i] for i in sorted(want)]
+
+
+def test_word_ngrams():
+    _, a, _ = hash_vectorize('red  fox', ngram_range=(2, 2))
+    _, b, _ = hash_vectorize('red fox', ngram_range=(2, 2))
+    _, c, _ = hash_vectorize('fox red', ngram_range=(2, 2))
+    assert list(a) == list(b) and list(a) != list(c)
+    _, indices, counts = hash_vectorize('to be or not to be', n_features=2 ** 31 - 1)
+    assert sorted(counts) == [1, 1, 2, 2]
+
+
+def test_inputs():
+    docs = _docs(20)
+    expected = hash_vectorize(docs)
+    assert hash_vectorize(cstringarray(docs)) == expected
+    assert hash_vectorize([d.encode() for d in docs]) == expected
+    assert hash_vectorize(docs, threads=4) == expected
+    single = hash_vectorize(cstring(docs[3]))
+    assert list(single[0]) == [0, expected[0][4] - expected[0][3]]
+    assert list(hash_vectorize([])[0]) == [0]
+    assert list(hash_vectorize(['', '   '])[0]) == [0, 0, 0]
+    buffers = [bytearray(d.encode()) for d in docs]
+    assert hash_vectorize(buffers, threads=4) == expected
+    buffers[0].extend(b' x')  # raises BufferError if a view leaked
+
+
+def test_seed():
+    docs = _docs(20)
+    assert hash_vectorize(docs, seed=1) != hash_vectorize(docs, seed=2)
+
+
+def test_errors():
+    with pytest.raises(ValueError):
+        hash_vectorize('a', n_features=0)
+    with pytest.raises(ValueError):
+        hash_vectorize('a', analyzer='char_wb')
+    with pytest.raises(ValueError):
+        hash_vectorize('a', ngram_range=(2, 1))
+    with pytest.raises(TypeError):
+        hash_vectorize('a', ngram_range=3)
+    with pytest.raises(TypeError):
+        hash_vectorize(['a', 1])